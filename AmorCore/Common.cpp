@@ -1,13 +1,390 @@
 #include "pch.h"
 #include "Common.h"
+#include "Util.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdarg>
 
 namespace amor {
 	namespace logging {
-		Log::Log() {
+		// records the queue holds, has to be a power of two
+		static constexpr u32 QUEUE_SIZE = 1024;
+		// text stored inline in a record, longer ones get a heap buffer
+		static constexpr u32 RECORD_TEXT = 240;
+		// how long the writer sleeps when nothing woke it
+		static constexpr auto WRITER_INTERVAL = std::chrono::milliseconds(5);
+
+		static_assert((QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0, "log queue size has to be a power of two");
+
+		/*
+			LOG_BINARY file: a header, a dictionary of the source and format strings records refer to by id,
+			then the record ring. Records are 8 byte aligned and never wrap around the end of the ring, the
+			space left at the end is covered by a padding record (format 0). head and tail count bytes since
+			the file was started, the ring holds the records in [tail, head). Everything is native endian
+		*/
+		static constexpr char BINARY_MAGIC[4] = { 'A', 'M', 'L', 'B' };
+		static constexpr u32 BINARY_VERSION = 1;
+		static constexpr u64 BINARY_DICTIONARY_SIZE = 256 * 1024;
+		static constexpr u64 BINARY_MIN_RING = 64 * 1024;
+
+		struct BinaryFileHeader {
+			char magic[4];
+			u32 version;
+			u64 dictionaryOffset;
+			u64 dictionarySize;
+			u64 dictionaryUsed;
+			u64 ringOffset;
+			u64 ringSize;
+			u64 head;
+			u64 tail;
+		};
+
+		enum class DictionaryKind : u8 {
+			Source = 1,
+			Format = 2
+		};
+
+		// followed by length characters
+		struct DictionaryEntry {
+			DictionaryKind kind;
+			u8 reserved;
+			u16 length;
+			u32 id;
+		};
+
+		// followed by argCount arguments as written by binary::encode
+		struct BinaryRecord {
+			u32 size;
+			u32 format;
+			// system clock, nanoseconds since the epoch
+			u64 timestamp;
+			u16 source;
+			u8 level;
+			u8 argCount;
+			u32 reserved;
+		};
+
+		/*
+			Bounded multi producer queue (sequence numbered slots). A producer claims a position by
+			bumping head, formats into the slot and publishes it by setting the slot sequence to
+			position + 1. The writer is the only consumer, it takes published slots in order and
+			hands them back by moving their sequence a lap ahead.
+		*/
+		struct Log::Backend {
+			struct Record {
+				std::atomic<u64> sequence;
+				Level level;
+				u32 outputs;
+				u32 length;
+				char* overflow;
+				char text[RECORD_TEXT];
+			};
+
+			Record records[QUEUE_SIZE];
+			alignas(64) std::atomic<u64> head{ 0 };
+			// only the writer moves it, producers read it to see how far behind it is
+			alignas(64) std::atomic<u64> tail{ 0 };
+
+			std::thread writer;
+			std::mutex lock;
+			std::condition_variable wake;
+			std::condition_variable flushed;
+			std::atomic<bool> wakeRequested{ false };
+			std::atomic<bool> quit{ false };
+
+			// guarded by lock, highest position a flush waits for and how far the writer got
+			u64 flushRequested = 0;
+			u64 flushedTo = 0;
+
+			std::ofstream file;
+			std::string fileBatch, streamBatch;
+
+			// guards the source names and the formats
+			std::mutex sourceLock;
+			std::unordered_map<std::string, u32> sourceIds;
+			std::vector<std::string> formats{ "" };
+			std::unordered_map<std::string, u32> formatIds;
+			std::atomic<u32> messageFormat{ 0 };
+
+			// the binary file is opened by the writer before the first binary record is written, records
+			// logged until then wait in the queue. Only the writer touches any of it
+			bool binaryOpen = false, binaryFailed = false;
+			util::MappedFile binaryFile;
+			BinaryFileHeader* binaryHeader = nullptr;
+			byte* ring = nullptr;
+			u64 binaryHead = 0, binaryTail = 0;
+			// dictionary entries written so far, ids are handed out in order
+			u32 sourcesWritten = 1, formatsWritten = 1;
+
+			Backend() {
+				for (u32 i = 0; i < QUEUE_SIZE; ++i) {
+					records[i].sequence.store(i, std::memory_order_relaxed);
+					records[i].overflow = nullptr;
+				}
+				fileBatch.reserve(64 * 1024);
+				streamBatch.reserve(16 * 1024);
+			}
+
+			Record& claim(u64& position) {
+				position = head.load(std::memory_order_relaxed);
+				for (;;) {
+					Record& record = records[position & (QUEUE_SIZE - 1)];
+					i64 difference = (i64)record.sequence.load(std::memory_order_acquire) - (i64)position;
+
+					if (difference == 0) {
+						if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+							return record;
+						}
+					}
+					else if (difference < 0) {
+						// a full lap behind, the writer has to catch up first
+						request_wake();
+						std::this_thread::yield();
+						position = head.load(std::memory_order_relaxed);
+					}
+					else {
+						position = head.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			void publish(Record& record, u64 position) {
+				Level level = record.level;
+				record.sequence.store(position + 1, std::memory_order_release);
+
+				// the writer polls, only get it up early when it matters
+				if (level >= Level::Error || position - tail.load(std::memory_order_relaxed) >= QUEUE_SIZE / 2) {
+					request_wake();
+				}
+			}
+
+			void request_wake() {
+				if (!wakeRequested.exchange(true, std::memory_order_acq_rel)) {
+					wake.notify_one();
+				}
+			}
+
+			void write_stream(Level level, std::ostream*& current) {
+				std::ostream* stream = level >= Level::Error ? &std::cerr : &std::cout;
+				if (stream != current && !streamBatch.empty()) {
+					current->write(streamBatch.data(), streamBatch.size());
+					current->flush();
+					streamBatch.clear();
+				}
+				current = stream;
+			}
+
+			// a line written by the writer itself, it can't queue it without waiting on itself. Goes to
+			// the text outputs, stderr when there are none
+			void write_text(Log& log, Level level, const std::string& message, std::ostream*& stream) {
+				char prefix[PREFIX_SIZE];
+				u32 prefixLength = log.write_prefix(prefix, level, "Log", 3);
+
+				u32 outputs = log.m_OutputFlags & ~LOG_BINARY;
+				if (outputs & LOG_FILE) {
+					fileBatch.append(prefix, prefixLength).append(message).append(1, '\n');
+				}
+				if ((outputs & LOG_STDOUT) || outputs == 0) {
+					write_stream(level, stream);
+					streamBatch.append(prefix, prefixLength).append(message).append(1, '\n');
+				}
+			}
+
+			// starts the file over, anything from a previous run is dropped. If it can't be opened that's
+			// reported once and binary records are dropped from then on
+			void open_binary(Log& log, std::ostream*& stream) {
+				u64 ringSize = std::max(log.m_BinaryCapacity, BINARY_MIN_RING) & ~7ull;
+				u64 dictionaryOffset = (sizeof(BinaryFileHeader) + 63) & ~63ull;
+				u64 ringOffset = dictionaryOffset + BINARY_DICTIONARY_SIZE;
+
+				if (!binaryFile.open(log.m_BinaryFilename, util::MappedFile::Mode::ReadWrite, ringOffset + ringSize)) {
+					binaryFailed = true;
+					write_text(log, Level::Error, binaryFile.error() + ", binary records are dropped", stream);
+					return;
+				}
+
+				binaryHeader = (BinaryFileHeader*)binaryFile.data();
+				memcpy(binaryHeader->magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+				binaryHeader->version = BINARY_VERSION;
+				binaryHeader->dictionaryOffset = dictionaryOffset;
+				binaryHeader->dictionarySize = BINARY_DICTIONARY_SIZE;
+				binaryHeader->dictionaryUsed = 0;
+				binaryHeader->ringOffset = ringOffset;
+				binaryHeader->ringSize = ringSize;
+				binaryHeader->head = 0;
+				binaryHeader->tail = 0;
+				ring = binaryFile.data() + ringOffset;
+				binaryOpen = true;
+			}
+
+			void add_dictionary_entry(DictionaryKind kind, u32 id, const std::string& text) {
+				DictionaryEntry entry = { kind, 0, (u16)std::min<size_t>(text.size(), 0xffff), id };
+				u64 used = binaryHeader->dictionaryUsed;
+				if (used + sizeof(entry) + entry.length > binaryHeader->dictionarySize) {
+					// full, the decoder shows the id instead
+					return;
+				}
+
+				byte* at = binaryFile.data() + binaryHeader->dictionaryOffset + used;
+				memcpy(at, &entry, sizeof(entry));
+				memcpy(at + sizeof(entry), text.data(), entry.length);
+				binaryHeader->dictionaryUsed = used + sizeof(entry) + entry.length;
+			}
+
+			void sync_dictionary(Log& log) {
+				std::lock_guard<std::mutex> guard(sourceLock);
+				for (; sourcesWritten < log.m_SourceCount; ++sourcesWritten) {
+					add_dictionary_entry(DictionaryKind::Source, sourcesWritten, log.m_SourceNames[sourcesWritten]);
+				}
+				for (; formatsWritten < formats.size(); ++formatsWritten) {
+					add_dictionary_entry(DictionaryKind::Format, formatsWritten, formats[formatsWritten]);
+				}
+			}
+
+			// drops the oldest records until size more bytes fit
+			void make_room(u64 size) {
+				u64 ringSize = binaryHeader->ringSize;
+				while (binaryHead + size - binaryTail > ringSize) {
+					u32 skipped;
+					memcpy(&skipped, ring + binaryTail % ringSize, sizeof(skipped));
+					binaryTail += skipped;
+				}
+				binaryHeader->tail = binaryTail;
+			}
+
+			void write_binary(Log& log, const byte* data, u32 length, std::ostream*& stream) {
+				if (!binaryOpen) {
+					if (binaryFailed) {
+						return;
+					}
+					open_binary(log, stream);
+					if (!binaryOpen) {
+						return;
+					}
+				}
+
+				BinaryRecord record;
+				memcpy(&record, data, sizeof(record));
+				if (record.format >= formatsWritten || record.source >= sourcesWritten) {
+					sync_dictionary(log);
+				}
+
+				u64 ringSize = binaryHeader->ringSize;
+				if (record.size > ringSize / 2) {
+					return;
+				}
+
+				u64 offset = binaryHead % ringSize;
+				if (ringSize - offset < record.size) {
+					BinaryRecord padding = {};
+					padding.size = (u32)(ringSize - offset);
+					make_room(padding.size);
+					memcpy(ring + offset, &padding, sizeof(u32) * 2);
+					binaryHead += padding.size;
+					offset = 0;
+				}
+
+				make_room(record.size);
+				memcpy(ring + offset, data, length);
+				memset(ring + offset + length, 0, record.size - length);
+				binaryHead += record.size;
+				binaryHeader->head = binaryHead;
+			}
+
+			// writes every published record
+			void drain(Log& log) {
+				std::ostream* stream = nullptr;
+
+				u64 position = tail.load(std::memory_order_relaxed);
+				for (;;) {
+					Record& record = records[position & (QUEUE_SIZE - 1)];
+					if (record.sequence.load(std::memory_order_acquire) != position + 1) {
+						break;
+					}
+
+					const char* text = record.overflow ? record.overflow : record.text;
+					if (record.outputs & LOG_BINARY) {
+						write_binary(log, (const byte*)text, record.length, stream);
+					}
+					if (record.outputs & LOG_FILE) {
+						fileBatch.append(text, record.length);
+					}
+					if (record.outputs & LOG_STDOUT) {
+						write_stream(record.level, stream);
+						streamBatch.append(text, record.length);
+					}
+
+					delete[] record.overflow;
+					record.overflow = nullptr;
+					record.sequence.store(position + QUEUE_SIZE, std::memory_order_release);
+					++position;
+				}
+				tail.store(position, std::memory_order_relaxed);
+
+				if (!fileBatch.empty()) {
+					if (!file.is_open()) {
+						file.open(log.m_LogFilename, std::ios_base::app);
+					}
+					file.write(fileBatch.data(), fileBatch.size());
+					if (!log.m_UseBufferedFileOutput) {
+						file.flush();
+					}
+					fileBatch.clear();
+				}
+
+				if (!streamBatch.empty()) {
+					stream->write(streamBatch.data(), streamBatch.size());
+					stream->flush();
+					streamBatch.clear();
+				}
+			}
+
+			void run(Log& log) {
+				for (;;) {
+					bool stopping = quit.load(std::memory_order_acquire);
+					drain(log);
+
+					{
+						std::unique_lock<std::mutex> guard(lock);
+						u64 written = tail.load(std::memory_order_relaxed);
+						if (flushRequested > flushedTo && written >= flushRequested) {
+							file.flush();
+							binaryFile.flush();
+							flushedTo = written;
+							flushed.notify_all();
+						}
+
+						// records claimed before the quit still have to be published and written
+						if (stopping && written == head.load(std::memory_order_acquire)) {
+							break;
+						}
+
+						wake.wait_for(guard, WRITER_INTERVAL, [this] { return wakeRequested.load(std::memory_order_acquire); });
+						wakeRequested.store(false, std::memory_order_release);
+					}
+				}
+
+				file.close();
+				binaryFile.close();
+			}
+		};
 
+		Log::Log() : m_Backend(new Backend()) {
+			m_Backend->writer = std::thread(&Backend::run, m_Backend, std::ref(*this));
 		}
 		Log::~Log() {
-			flush();
+			m_Backend->quit.store(true, std::memory_order_release);
+			m_Backend->request_wake();
+			m_Backend->writer.join();
+
+			delete m_Backend;
+			m_Backend = nullptr;
 		}
 
 		Level& Log::LogLevel() {
@@ -30,138 +407,537 @@ namespace amor {
 			return m_LogFilename;
 		}
 
+		std::string& Log::BinaryLogFile() {
+			return m_BinaryFilename;
+		}
+
+		u64& Log::BinaryLogCapacity() {
+			return m_BinaryCapacity;
+		}
+
 		void Log::out(Level level, const std::string& message, const std::string& source) {
-			if (!should_log(level, source)) {
+			if (!should_log(level, source) || m_OutputFlags == 0) {
 				return;
 			}
 
-			std::stringstream str;
+			if (m_OutputFlags & LOG_BINARY) {
+				u32 format = m_Backend->messageFormat.load(std::memory_order_relaxed);
+				if (format == 0) {
+					format = intern_format("%s");
+					m_Backend->messageFormat.store(format, std::memory_order_relaxed);
+				}
 
-			write_timestamp(str);
-			write_level(str, level, source);
-			str << "- " << message << std::endl;
+				const char* text = message.c_str();
+				u64 position;
+				byte* at = begin_binary(level, intern(source), format, 1, binary::encoded_size(text), position);
+				binary::encode(at, text);
+				end_binary(position);
 
-			if (m_OutputFlags & LOG_FILE) {
-				write_to_file(str.str());
+				if ((m_OutputFlags & ~LOG_BINARY) == 0) {
+					return;
+				}
 			}
 
-			if (m_OutputFlags & LOG_STDOUT) {
-				write_to_stdout(str.str(), level);
+			char prefix[PREFIX_SIZE];
+			u32 prefixLength = write_prefix(prefix, level, source.data(), (u32)source.size());
+			u32 length = prefixLength + (u32)message.size() + 1;
+
+			u64 position;
+			Backend::Record& record = m_Backend->claim(position);
+			record.level = level;
+			record.outputs = m_OutputFlags & ~LOG_BINARY;
+			record.length = length;
+
+			char* text = record.text;
+			if (length > RECORD_TEXT) {
+				text = record.overflow = new char[length];
 			}
+			memcpy(text, prefix, prefixLength);
+			memcpy(text + prefixLength, message.data(), message.size());
+			text[length - 1] = '\n';
+
+			m_Backend->publish(record, position);
 		}
 
-		void Log::flush() {
-			if (m_UseBufferedFileOutput) {
-				std::ofstream file;
+		void Log::outf_text(Level level, u32 source, const char* format, ...) {
+			const std::string& name = m_SourceNames[source < MAX_SOURCES ? source : 0];
+			char prefix[PREFIX_SIZE];
+			u32 prefixLength = write_prefix(prefix, level, name.data(), (u32)name.size());
 
-				if (std::filesystem::exists(m_LogFilename)) {
-					file.open(m_LogFilename, std::ios_base::app);
-				}
-				else {
-					file.open(m_LogFilename, std::ios_base::out);
-				}
-				file.write(m_FileBuffer.str().c_str(), m_FileBuffer.str().length());
-				file.close();
+			u64 position;
+			Backend::Record& record = m_Backend->claim(position);
+			record.level = level;
+			record.outputs = m_OutputFlags & ~LOG_BINARY;
+			memcpy(record.text, prefix, prefixLength);
+
+			va_list args;
+			va_start(args, format);
+			va_list retry;
+			va_copy(retry, args);
+
+			// room for the newline, vsnprintf puts its terminator there
+			i32 written = vsnprintf(record.text + prefixLength, RECORD_TEXT - prefixLength, format, args);
+			u32 messageLength = written > 0 ? (u32)written : 0;
+			record.length = prefixLength + messageLength + 1;
+
+			char* text = record.text;
+			if (record.length > RECORD_TEXT) {
+				text = record.overflow = new char[record.length];
+				memcpy(text, prefix, prefixLength);
+				vsnprintf(text + prefixLength, messageLength + 1, format, retry);
+			}
+			text[record.length - 1] = '\n';
+
+			va_end(retry);
+			va_end(args);
+
+			m_Backend->publish(record, position);
+		}
+
+		u32 Log::intern(const std::string& source) {
+			if (source.empty()) {
+				return 0;
+			}
+
+			std::lock_guard<std::mutex> guard(m_Backend->sourceLock);
+			auto found = m_Backend->sourceIds.find(source);
+			if (found != m_Backend->sourceIds.end()) {
+				return found->second;
+			}
+
+			if (m_SourceCount == MAX_SOURCES) {
+				// out of ids, logs without its name from here on
+				return 0;
+			}
+
+			u32 id = m_SourceCount++;
+			m_SourceNames[id] = source;
+			m_Backend->sourceIds.emplace(source, id);
+			return id;
+		}
+
+		u32 Log::intern_format(const char* format) {
+			std::lock_guard<std::mutex> guard(m_Backend->sourceLock);
+			auto found = m_Backend->formatIds.find(format);
+			if (found != m_Backend->formatIds.end()) {
+				return found->second;
+			}
+
+			u32 id = (u32)m_Backend->formats.size();
+			m_Backend->formats.emplace_back(format);
+			m_Backend->formatIds.emplace(format, id);
+			return id;
+		}
+
+		byte* Log::begin_binary(Level level, u32 source, u32 format, u32 argCount, u32 length, u64& position) {
+			BinaryRecord header;
+			header.size = (u32)((sizeof(BinaryRecord) + length + 7) & ~7ull);
+			header.format = format;
+			header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			header.source = (u16)source;
+			header.level = (u8)level;
+			header.argCount = (u8)argCount;
+			header.reserved = 0;
+
+			Backend::Record& record = m_Backend->claim(position);
+			record.level = level;
+			record.outputs = LOG_BINARY;
+			record.length = sizeof(BinaryRecord) + length;
+
+			char* data = record.text;
+			if (record.length > RECORD_TEXT) {
+				data = record.overflow = new char[record.length];
 			}
+			memcpy(data, &header, sizeof(header));
+			return (byte*)data + sizeof(header);
+		}
+
+		void Log::end_binary(u64 position) {
+			m_Backend->publish(m_Backend->records[position & (QUEUE_SIZE - 1)], position);
+		}
+
+		u32 Log::find_source(const std::string& source) {
+			if (source.empty()) {
+				return 0;
+			}
+
+			std::lock_guard<std::mutex> guard(m_Backend->sourceLock);
+			auto found = m_Backend->sourceIds.find(source);
+			return found != m_Backend->sourceIds.end() ? found->second : MAX_SOURCES;
+		}
+
+		void Log::flush() {
+			u64 target = m_Backend->head.load(std::memory_order_acquire);
+
+			std::unique_lock<std::mutex> guard(m_Backend->lock);
+			m_Backend->flushRequested = std::max(m_Backend->flushRequested, target);
+			m_Backend->wakeRequested.store(true, std::memory_order_release);
+			m_Backend->wake.notify_one();
+			m_Backend->flushed.wait(guard, [&] { return m_Backend->flushedTo >= target; });
 		}
 
 		void Log::add_allowed_source(const std::string& source) {
-			m_AllowedSources.insert(source);
+			u32 id = intern(source);
+			if (id == 0 || id >= MASKED_SOURCES) {
+				warn("Too many sources to filter '" + source + "', it's only filtered by level", "Log");
+				return;
+			}
+
+			// the empty source is always let through
+			u64 mask = m_SourceMask.load(std::memory_order_relaxed);
+			u64 next;
+			do {
+				next = (mask == ~0ull ? 1 : mask) | 1ull << id;
+			} while (!m_SourceMask.compare_exchange_weak(mask, next, std::memory_order_relaxed));
 		}
 		void Log::remove_allowed_source(const std::string& source) {
-			m_AllowedSources.erase(source);
+			u32 id = find_source(source);
+			if (id == 0 || id >= MASKED_SOURCES) {
+				return;
+			}
+
+			u64 mask = m_SourceMask.load(std::memory_order_relaxed);
+			u64 next;
+			do {
+				if (mask == ~0ull) {
+					return;
+				}
+				next = mask & ~(1ull << id);
+				// nothing left in the filter, everything is allowed again
+				if (next == 1) {
+					next = ~0ull;
+				}
+			} while (!m_SourceMask.compare_exchange_weak(mask, next, std::memory_order_relaxed));
 		}
-		
+
 		// only log if:
 		//		1: The allowed logging level is greater or equal to the current logging level
-		//		2: All sources are allowed (the allowed source list is empty)
+		//		2: All sources are allowed (no source filter is set)
 		//		3: (or) the given source is in the allowed list
 		//		4: if the source itself is empty log it
 		bool Log::should_log(Level level, const std::string& source) {
-			return level >= m_LogLevel && (m_AllowedSources.empty() || source.empty() || m_AllowedSources.contains(source));
+			if (level < m_LogLevel) {
+				return false;
+			}
+			u64 mask = m_SourceMask.load(std::memory_order_relaxed);
+			if (mask == ~0ull || source.empty()) {
+				return true;
+			}
+
+			u32 id = find_source(source);
+			return id < MASKED_SOURCES ? (mask >> id) & 1 : id != MAX_SOURCES;
 		}
 
-		// timestamp [level: source] - message
-		void Log::write_level(std::stringstream& buffer, Level level, const std::string& source) {
-			buffer << "[";
+		static const char* level_name(Level level) {
 			switch (level) {
-			case Level::Info:
-				buffer << "Info";
-				break;
-			case Level::Warning:
-				buffer << "Warning";
-				break;
-			case Level::Error:
-				buffer << "Error";
-				break;
-			case Level::Failure:
-				buffer << "Failure";
-				break;
+			case Level::Info: return "Info";
+			case Level::Warning: return "Warning";
+			case Level::Error: return "Error";
+			case Level::Failure: return "Failure";
+			default: return "";
 			}
+		}
+
+		// timestamp [level: source] - message
+		u32 Log::write_prefix(char* buffer, Level level, const char* source, u32 sourceLength) {
+			// long names are cut so the prefix always fits
+			sourceLength = std::min(sourceLength, 64u);
 
-			if (source != "") {
-				buffer << ": " << source;
+			char* at = buffer + write_timestamp(buffer);
+			auto append = [&at](const char* text, size_t count) {
+				memcpy(at, text, count);
+				at += count;
+			};
+
+			const char* name = level_name(level);
+			append("[", 1);
+			append(name, strlen(name));
+			if (sourceLength != 0) {
+				append(": ", 2);
+				append(source, sourceLength);
 			}
-			buffer << "] ";
+			append("] - ", 4);
+			return (u32)(at - buffer);
 		}
-		void Log::write_timestamp(std::stringstream& buffer) {
-			auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 
-			std::string date(30, '\0');
-			std::string time(30, '\0');
+		// formatting the time is the expensive part, so it's only redone when the second changes
+		struct TimestampCache {
+			time_t second = -1;
+			TimestampMode mode = TimestampMode::None;
+			u32 length = 0;
+			char text[32];
+		};
+		static thread_local TimestampCache t_Timestamp;
 
-			if ((u32)m_TimestampMode & (u32)TimestampMode::Date) {
-				tm t;
-				localtime_s(&t, &now);
-				std::strftime(&date[0], date.size(), "%Y-%m-%d", &t);
+		u32 Log::write_timestamp(char* buffer) {
+			if (m_TimestampMode == TimestampMode::None) {
+				return 0;
 			}
 
-			if ((u32)m_TimestampMode & (u32)TimestampMode::Time) {
+			time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+			if (now != t_Timestamp.second || m_TimestampMode != t_Timestamp.mode) {
+				const char* pattern = "%Y-%m-%d %H:%M:%S ";
+				if (m_TimestampMode == TimestampMode::Date) {
+					pattern = "%Y-%m-%d ";
+				}
+				else if (m_TimestampMode == TimestampMode::Time) {
+					pattern = "%H:%M:%S ";
+				}
+
 				tm t;
 				localtime_s(&t, &now);
-				std::strftime(&time[0], time.size(), "%H:%M:%S", &t);
+				t_Timestamp.length = (u32)std::strftime(t_Timestamp.text, sizeof(t_Timestamp.text), pattern, &t);
+				t_Timestamp.second = now;
+				t_Timestamp.mode = m_TimestampMode;
 			}
 
-			buffer << date << (date.empty() ? "" : " ") << time << " ";
+			memcpy(buffer, t_Timestamp.text, t_Timestamp.length);
+			return t_Timestamp.length;
 		}
 
 
-		void Log::write_to_stdout(const std::string& str, Level level) {
-			switch (level) {
-			case Level::Info:
-			case Level::Warning:
-				std::cout << str << std::endl;
-				break;
-			case Level::Error:
-			case Level::Failure:
-				std::cerr << str << std::endl;
-				break;
+		void Log::info(const std::string& message, const std::string& source) { out(Level::Info, message, source); }
+		void Log::warn(const std::string& message, const std::string& source) { out(Level::Warning, message, source); }
+		void Log::error(const std::string& message, const std::string& source) { out(Level::Error, message, source); }
+		void Log::fail(const std::string& message, const std::string& source) { out(Level::Failure, message, source); }
+
+
+		// snprintf into the end of output
+		template<typename T> static void append_format(std::string& output, const std::string& spec, T value) {
+			char buffer[256];
+			i32 length = snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+			if (length < 0) {
+				return;
+			}
+			if ((u32)length < sizeof(buffer)) {
+				output.append(buffer, length);
+				return;
 			}
+
+			size_t at = output.size();
+			output.resize(at + length + 1);
+			snprintf(&output[at], length + 1, spec.c_str(), value);
+			output.resize(at + length);
 		}
 
-		void Log::write_to_file(const std::string& str) {
-			if (m_UseBufferedFileOutput) {
-				m_FileBuffer << str << std::endl;
-			}
-			else {
-				std::ofstream file;
+		// walks the arguments of one binary record
+		struct ArgumentReader {
+			const byte* at;
+			const byte* end;
+			u32 left;
+
+			bool next(binary::ArgType& type, u64& bits, std::string& text) {
+				if (left == 0 || at >= end) {
+					return false;
+				}
+				--left;
 
-				if (std::filesystem::exists(m_LogFilename)) {
-					file.open(m_LogFilename, std::ios_base::app);
+				type = (binary::ArgType)*at++;
+				u32 size = type == binary::ArgType::Int32 || type == binary::ArgType::UInt32 ? 4 : type == binary::ArgType::String ? 2 : 8;
+				if ((u64)(end - at) < size) {
+					return false;
+				}
+
+				if (type == binary::ArgType::String) {
+					u16 length;
+					memcpy(&length, at, sizeof(length));
+					at += sizeof(length);
+					length = (u16)std::min<u64>(length, end - at);
+					text.assign((const char*)at, length);
+					at += length;
+				}
+				else if (size == 4) {
+					u32 value;
+					memcpy(&value, at, 4);
+					bits = type == binary::ArgType::Int32 ? (u64)(i64)(i32)value : value;
+					at += 4;
 				}
 				else {
-					file.open(m_LogFilename, std::ios_base::out);
+					memcpy(&bits, at, 8);
+					at += 8;
+				}
+				return true;
+			}
+		};
+
+		// printf over the stored arguments. Length modifiers in the format are replaced by the ones
+		// matching the stored type, so the argument sizes of the logging platform don't matter
+		static void format_message(const std::string& format, ArgumentReader& args, std::string& output) {
+			binary::ArgType type;
+			u64 bits = 0;
+			std::string text;
+
+			for (size_t i = 0; i < format.size(); ++i) {
+				if (format[i] != '%') {
+					output += format[i];
+					continue;
+				}
+				if (i + 1 < format.size() && format[i + 1] == '%') {
+					output += '%';
+					++i;
+					continue;
+				}
+
+				std::string spec = "%";
+				size_t j = i + 1;
+				auto number = [&]() {
+					if (j < format.size() && format[j] == '*') {
+						spec += args.next(type, bits, text) ? std::to_string((i32)bits) : "0";
+						++j;
+						return;
+					}
+					while (j < format.size() && isdigit((unsigned char)format[j])) {
+						spec += format[j++];
+					}
+				};
+
+				while (j < format.size() && strchr("-+ #0", format[j]) != nullptr) {
+					spec += format[j++];
+				}
+				number();
+				if (j < format.size() && format[j] == '.') {
+					spec += format[j++];
+					number();
+				}
+				while (j < format.size() && strchr("hljztL", format[j]) != nullptr) {
+					++j;
+				}
+				if (j >= format.size()) {
+					output.append(format, i, std::string::npos);
+					return;
+				}
+
+				char conversion = format[j];
+				i = j;
+
+				if (!args.next(type, bits, text)) {
+					output += "<missing>";
+					continue;
+				}
+
+				switch (type) {
+				case binary::ArgType::String:
+					append_format(output, spec + "s", text.c_str());
+					break;
+				case binary::ArgType::Double: {
+					double value;
+					memcpy(&value, &bits, sizeof(value));
+					append_format(output, spec + (strchr("fFeEgGaA", conversion) != nullptr ? conversion : 'g'), value);
+					break;
+				}
+				case binary::ArgType::Pointer:
+					append_format(output, spec + "p", (void*)(uintptr_t)bits);
+					break;
+				case binary::ArgType::Int32:
+				case binary::ArgType::Int64:
+				case binary::ArgType::UInt32:
+				case binary::ArgType::UInt64: {
+					bool isSigned = type == binary::ArgType::Int32 || type == binary::ArgType::Int64;
+					if (conversion == 'c') {
+						append_format(output, spec + "c", (i32)bits);
+					}
+					else if (strchr("diuoxX", conversion) != nullptr) {
+						append_format(output, spec + "ll" + conversion, bits);
+					}
+					else {
+						append_format(output, spec + (isSigned ? "lld" : "llu"), bits);
+					}
+					break;
+				}
+				default:
+					output += "<unknown>";
+					break;
 				}
-				file.write(str.c_str(), str.length());
-				file.close();
 			}
 		}
 
+		bool DecodeBinaryLog(const std::string& filename, std::ostream& output) {
+			util::MappedFile file;
+			if (!file.open(filename, util::MappedFile::Mode::Read)) {
+				AMOR_LOG_ERROR("Log", "%s", file.error().c_str());
+				return false;
+			}
 
-		void Log::info(const std::string& message, const std::string& source) { out(Level::Info, message, source); }
-		void Log::warn(const std::string& message, const std::string& source) { out(Level::Warning, message, source); }
-		void Log::error(const std::string& message, const std::string& source) { out(Level::Error, message, source); }
-		void Log::fail(const std::string& message, const std::string& source) { out(Level::Failure, message, source); }
+			BinaryFileHeader header;
+			bool valid = file.size() >= sizeof(header);
+			if (valid) {
+				memcpy(&header, file.data(), sizeof(header));
+				valid = memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0 && header.version == BINARY_VERSION &&
+					header.dictionaryOffset + header.dictionarySize <= file.size() && header.dictionaryUsed <= header.dictionarySize &&
+					header.ringOffset + header.ringSize <= file.size() && header.ringSize % 8 == 0 &&
+					header.tail <= header.head && header.head - header.tail <= header.ringSize;
+			}
+			if (!valid) {
+				AMOR_LOG_ERROR("Log", "%s is not a binary log", filename.c_str());
+				return false;
+			}
+
+			std::unordered_map<u32, std::string> sources, formats;
+			const byte* dictionary = file.data() + header.dictionaryOffset;
+			for (u64 at = 0; at + sizeof(DictionaryEntry) <= header.dictionaryUsed;) {
+				DictionaryEntry entry;
+				memcpy(&entry, dictionary + at, sizeof(entry));
+				at += sizeof(entry);
+				if (at + entry.length > header.dictionaryUsed) {
+					break;
+				}
+
+				std::string text((const char*)dictionary + at, entry.length);
+				(entry.kind == DictionaryKind::Source ? sources : formats)[entry.id] = std::move(text);
+				at += entry.length;
+			}
+
+			const byte* ring = file.data() + header.ringOffset;
+			std::string line;
+			for (u64 position = header.tail; position < header.head;) {
+				u64 offset = position % header.ringSize;
+
+				BinaryRecord record;
+				memcpy(&record, ring + offset, sizeof(u32) * 2);
+				if (record.size < sizeof(u32) * 2 || record.size % 8 != 0 || record.size > header.ringSize - offset) {
+					AMOR_LOG_ERROR("Log", "%s has a broken record at %llu", filename.c_str(), (unsigned long long)position);
+					return false;
+				}
+				position += record.size;
+
+				// padding up to the end of the ring
+				if (record.format == 0 || record.size < sizeof(record)) {
+					continue;
+				}
+				memcpy(&record, ring + offset, sizeof(record));
+
+				line.clear();
+				time_t seconds = (time_t)(record.timestamp / 1000000000ull);
+				tm t;
+				localtime_s(&t, &seconds);
+				char timestamp[48];
+				size_t length = std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &t);
+				snprintf(timestamp + length, sizeof(timestamp) - length, ".%03u ", (u32)(record.timestamp / 1000000ull % 1000));
+				line += timestamp;
+
+				line += '[';
+				line += level_name((Level)record.level);
+				if (record.source != 0) {
+					auto source = sources.find(record.source);
+					line += ": ";
+					line += source != sources.end() ? source->second : "source " + std::to_string(record.source);
+				}
+				line += "] - ";
+
+				auto format = formats.find(record.format);
+				if (format != formats.end()) {
+					ArgumentReader args = { ring + offset + sizeof(record), ring + offset + record.size, record.argCount };
+					format_message(format->second, args, line);
+				}
+				else {
+					line += "<format " + std::to_string(record.format) + ">";
+				}
+				line += '\n';
+				output.write(line.data(), line.size());
+			}
+
+			return output.good();
+		}
 
 
 		Log* GetInstance() {
@@ -169,4 +945,4 @@ namespace amor {
 			return &__log;
 		}
 	}
-}
\ No newline at end of file
+}
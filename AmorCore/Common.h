@@ -1,7 +1,10 @@
 #pragma once
 #include <string>
 #include <sstream>
-#include <unordered_set>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
 
 typedef unsigned __int64 u64;
 typedef unsigned __int32 u32;
@@ -22,11 +25,49 @@ typedef double real;
 
 #define CLASS_INVOKE(instance, method, ...) (instance.*(method))(__VA_ARGS__) 
 
+/*
+	Format string logging. AMOR_LOG_INFO("Source", "loaded %u textures in %.2fms", count, ms)
+	Arguments are only formatted when the level and source pass the filter, a filtered call costs
+	a branch and nothing is allocated either way. Formats are printf style and the source has to
+	be a string literal, it's interned once per call site.
+
+	Calls below AMOR_LOG_MIN_LEVEL (0 Info .. 3 Failure) are compiled out. It defaults to
+	Warning in release builds (NDEBUG) and Info otherwise.
+
+	With LOG_BINARY set the arguments are stored as they are instead of being formatted, see
+	logging::LOG_BINARY. Arguments have to be numbers, enums, pointers or C strings then.
+*/
+#ifndef AMOR_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define AMOR_LOG_MIN_LEVEL 1
+#else
+#define AMOR_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+#define AMOR_LOG_AT(level, sourceName, ...) do { \
+		if constexpr ((u32)(level) >= AMOR_LOG_MIN_LEVEL) { \
+			static const ::amor::logging::Log::Site _amor_log_site(sourceName); \
+			if (_amor_log_site.log->enabled(level, _amor_log_site.source)) { \
+				_amor_log_site.log->outf(level, _amor_log_site, __VA_ARGS__); \
+			} \
+		} \
+	} while (0)
+
+#define AMOR_LOG_INFO(source, ...) AMOR_LOG_AT(::amor::logging::Level::Info, source, __VA_ARGS__)
+#define AMOR_LOG_WARN(source, ...) AMOR_LOG_AT(::amor::logging::Level::Warning, source, __VA_ARGS__)
+#define AMOR_LOG_ERROR(source, ...) AMOR_LOG_AT(::amor::logging::Level::Error, source, __VA_ARGS__)
+#define AMOR_LOG_FAIL(source, ...) AMOR_LOG_AT(::amor::logging::Level::Failure, source, __VA_ARGS__)
+
 namespace amor {
 	namespace logging {
 
 		constexpr u32 LOG_STDOUT = 1;
 		constexpr u32 LOG_FILE = 2;
+		// compact records (timestamp, level, source id, format id, raw arguments) in a memory mapped ring
+		// file, the newest BinaryLogCapacity() bytes are kept. Nothing is formatted when logging, the
+		// file is turned into text afterwards by DecodeBinaryLog (or the LogDecoder tool)
+		constexpr u32 LOG_BINARY = 4;
 
 		enum class Level {
 			Info = 0,
@@ -42,12 +83,143 @@ namespace amor {
 			DateTime = 3
 		};
 
+		namespace binary {
+			enum class ArgType : u8 {
+				Int32 = 1,
+				UInt32 = 2,
+				Int64 = 3,
+				UInt64 = 4,
+				Double = 5,
+				String = 6,
+				Pointer = 7
+			};
+
+			// longer string arguments are cut
+			constexpr u32 MAX_STRING = 4096;
+
+			template<typename T> inline u32 encoded_size(const T& value) {
+				using Arg = std::decay_t<T>;
+				static_assert(std::is_arithmetic_v<Arg> || std::is_enum_v<Arg> || std::is_pointer_v<Arg> || std::is_null_pointer_v<Arg>,
+					"binary log arguments have to be numbers, enums, pointers or C strings");
+
+				if constexpr (std::is_same_v<Arg, const char*> || std::is_same_v<Arg, char*>) {
+					const char* text = value != nullptr ? value : "(null)";
+					size_t length = strlen(text);
+					return 1 + sizeof(u16) + (u32)(length < MAX_STRING ? length : MAX_STRING);
+				}
+				else if constexpr (std::is_floating_point_v<Arg> || std::is_pointer_v<Arg> || std::is_null_pointer_v<Arg> || sizeof(Arg) > 4) {
+					return 1 + 8;
+				}
+				else {
+					return 1 + 4;
+				}
+			}
+
+			// type tag followed by the value, unaligned
+			template<typename T> inline byte* encode(byte* at, const T& value) {
+				using Arg = std::decay_t<T>;
+
+				auto put = [&at](ArgType type, const void* data, u32 size) {
+					*at++ = (byte)type;
+					memcpy(at, data, size);
+					at += size;
+				};
+
+				if constexpr (std::is_same_v<Arg, const char*> || std::is_same_v<Arg, char*>) {
+					const char* text = value != nullptr ? value : "(null)";
+					size_t length = strlen(text);
+					u16 size = (u16)(length < MAX_STRING ? length : MAX_STRING);
+					put(ArgType::String, &size, sizeof(size));
+					memcpy(at, text, size);
+					at += size;
+				}
+				else if constexpr (std::is_floating_point_v<Arg>) {
+					double number = (double)value;
+					put(ArgType::Double, &number, 8);
+				}
+				else if constexpr (std::is_pointer_v<Arg> || std::is_null_pointer_v<Arg>) {
+					u64 address = (u64)(uintptr_t)value;
+					put(ArgType::Pointer, &address, 8);
+				}
+				else if constexpr (std::is_enum_v<Arg>) {
+					return encode(at, (std::underlying_type_t<Arg>)value);
+				}
+				else if constexpr (sizeof(Arg) > 4) {
+					u64 number = (u64)value;
+					put(std::is_signed_v<Arg> ? ArgType::Int64 : ArgType::UInt64, &number, 8);
+				}
+				else if constexpr (std::is_signed_v<Arg>) {
+					i32 number = (i32)value;
+					put(ArgType::Int32, &number, 4);
+				}
+				else {
+					u32 number = (u32)value;
+					put(ArgType::UInt32, &number, 4);
+				}
+				return at;
+			}
+		}
+
+		/*
+			Records are formatted on the calling thread into a bounded lock-free queue and written by a
+			background thread, which keeps the log file open and writes whatever queued up in one batch.
+			Calls only block when the queue is full. Errors and failures wake the writer right away,
+			everything else is picked up within a few milliseconds. flush() waits until everything
+			logged before it is written.
+		*/
+		class Log;
+		Log* GetInstance();
+
 		class Log {
 		public:
+			// sources are filtered by a bitmask over their interned id, ids past the mask are only
+			// filtered by level. Id 0 is the empty source
+			static constexpr u32 MAX_SOURCES = 256;
+			static constexpr u32 MASKED_SOURCES = 64;
+
+			// per call site state of the AMOR_LOG_ macros
+			struct Site {
+				Log* log;
+				u32 source;
+				// binary format id, interned on first use
+				mutable std::atomic<u32> format;
+
+				Site(const char* name) : log(GetInstance()), source(log->intern(name)), format(0) {}
+			};
+
 			Log();
 			~Log();
 
 			void out(Level level, const std::string& message, const std::string& source = "");
+
+			// printf style, normally called through the AMOR_LOG_ macros
+			template<typename... Args> void outf(Level level, const Site& site, const char* format, const Args&... args) {
+				if (m_OutputFlags & LOG_BINARY) {
+					u32 formatId = site.format.load(std::memory_order_relaxed);
+					if (formatId == 0) {
+						formatId = intern_format(format);
+						site.format.store(formatId, std::memory_order_relaxed);
+					}
+
+					u32 length = (0 + ... + binary::encoded_size(args));
+					u64 position;
+					byte* at = begin_binary(level, site.source, formatId, (u32)sizeof...(Args), length, position);
+					((at = binary::encode(at, args)), ...);
+					end_binary(position);
+				}
+				if (m_OutputFlags & ~LOG_BINARY) {
+					outf_text(level, site.source, format, args...);
+				}
+			}
+
+			// id for a source name, the same name always gets the same id
+			u32 intern(const std::string& source);
+
+			inline bool enabled(Level level, u32 source) const {
+				return level >= m_LogLevel && (source >= MASKED_SOURCES || (m_SourceMask.load(std::memory_order_relaxed) >> source) & 1);
+			}
+
+			// blocks until every record logged so far is written out
 			void flush();
 
 			void info(const std::string& message, const std::string& source = "");
@@ -64,18 +236,37 @@ namespace amor {
 
 			TimestampMode& TimeMode();
 
+			// read when the file is opened, by the first record that goes to the file
 			std::string& LogFile();
 
+			// true leaves the file to the stream buffer, false flushes it after every batch
 			bool& UseBufferedFileOutput();
 
+			// both are read by the writer when it gets to the first binary record, which starts the file over
+			std::string& BinaryLogFile();
+			u64& BinaryLogCapacity();
+
 		private:
+			struct Backend;
+
 			bool should_log(Level level, const std::string& source);
 
-			void write_level(std::stringstream& buffer, Level level, const std::string& source = "");
-			void write_timestamp(std::stringstream& buffer);
+			// "timestamp [level: source] - ", the message follows it. buffer needs PREFIX_SIZE bytes
+			static constexpr u32 PREFIX_SIZE = 128;
+			u32 write_prefix(char* buffer, Level level, const char* source, u32 sourceLength);
+			u32 write_timestamp(char* buffer);
+
+			// finds an id without interning, MAX_SOURCES if the name was never seen
+			u32 find_source(const std::string& source);
+
+			void outf_text(Level level, u32 source, const char* format, ...);
 
-			void write_to_file(const std::string& str);
-			void write_to_stdout(const std::string& str, Level level);
+			u32 intern_format(const char* format);
+
+			// claims a binary record with room for length bytes of arguments and returns where they go,
+			// end_binary publishes it
+			byte* begin_binary(Level level, u32 source, u32 format, u32 argCount, u32 length, u64& position);
+			void end_binary(u64 position);
 
 		private:
 			Level m_LogLevel = Level::Info;
@@ -83,11 +274,19 @@ namespace amor {
 			TimestampMode m_TimestampMode = TimestampMode::None;
 			std::string m_LogFilename = "log.txt";
 			bool m_UseBufferedFileOutput = true;
-			std::stringstream m_FileBuffer{ "" };
-			std::string m_Source = "";
-			std::unordered_set<std::string> m_AllowedSources;
+			std::string m_BinaryFilename = "log.bin";
+			u64 m_BinaryCapacity = 4 << 20;
+
+			// bit per source id, all set while no source filter is active. Read by every logging thread,
+			// changes are compare and swapped so concurrent filter changes don't lose each other
+			std::atomic<u64> m_SourceMask{ ~0ull };
+			std::string m_SourceNames[MAX_SOURCES];
+			u32 m_SourceCount = 1;
+
+			Backend* m_Backend;
 		};
 
-		Log* GetInstance();
+		// writes a LOG_BINARY file out as text, oldest record first. Returns false if it isn't one
+		bool DecodeBinaryLog(const std::string& filename, std::ostream& output);
 	}
 }
\ No newline at end of file
@@ -10,8 +10,6 @@ namespace amor {
         Vec3f::Vec3f(real u) : x{ u }, y{ u }, z{ u } {}
         Vec3f::Vec3f(real x, real y, real z) : x{ x }, y{ y }, z{ z } {}
 
-        Vec3f::~Vec3f() {};
-
         bool Vec3f::operator==(const Vec3f& o) const {
             return x == o.x && y == o.y && z == o.z;
         }
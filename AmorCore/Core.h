@@ -9,7 +9,6 @@ namespace amor {
 			Vec3f(const Vec3f& o);
 			Vec3f(real u);
 			Vec3f(real x, real y, real z = 0.0f);
-			~Vec3f();
 
 			bool operator==(const Vec3f& o) const;
 			bool operator!=(const Vec3f& o) const;
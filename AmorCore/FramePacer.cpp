@@ -0,0 +1,69 @@
+#include "pch.h"
+#include "FramePacer.h"
+#include "Util.h"
+
+#include <thread>
+
+namespace amor {
+	namespace util {
+
+		static constexpr double SLEEP_STEP_NS = 1e6;
+		// weight of a new sleep sample, about the last 20 sleeps matter
+		static constexpr double SLEEP_SAMPLE_WEIGHT = 0.05;
+
+		FramePacer::FramePacer(double targetFps) :
+				m_TargetFps(0.0), m_PeriodNs(0), m_Deadline(0),
+				m_Mean(SLEEP_STEP_NS), m_Variance(0.0), m_Estimate(2.0 * SLEEP_STEP_NS) {
+
+			set_target_fps(targetFps);
+		}
+
+		FramePacer::~FramePacer() {}
+
+		void FramePacer::set_target_fps(double fps) {
+			m_TargetFps = fps > 0.0 ? fps : 0.0;
+			m_PeriodNs = m_TargetFps > 0.0 ? (u64)(1e9 / m_TargetFps) : 0;
+			reset();
+		}
+
+		void FramePacer::reset() {
+			m_Deadline = Timer::now_ns() + m_PeriodNs;
+		}
+
+		void FramePacer::observe_sleep(double ns) {
+			double difference = ns - m_Mean;
+			m_Mean += SLEEP_SAMPLE_WEIGHT * difference;
+			m_Variance = (1.0 - SLEEP_SAMPLE_WEIGHT) * (m_Variance + SLEEP_SAMPLE_WEIGHT * difference * difference);
+			m_Estimate = m_Mean + std::sqrt(m_Variance);
+		}
+
+		void FramePacer::wait() {
+			if (m_PeriodNs == 0) {
+				return;
+			}
+
+			u64 now = Timer::now_ns();
+			if (now > m_Deadline + m_PeriodNs) {
+				// too far behind, catching up would only run a burst of frames
+				m_Deadline = now + m_PeriodNs;
+				return;
+			}
+
+			while (now < m_Deadline && (double)(m_Deadline - now) > m_Estimate) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds((u64)SLEEP_STEP_NS));
+
+				u64 woke = Timer::now_ns();
+				observe_sleep((double)(woke - now));
+				now = woke;
+			}
+
+			while (now < m_Deadline) {
+				std::this_thread::yield();
+				now = Timer::now_ns();
+			}
+
+			m_Deadline += m_PeriodNs;
+		}
+
+	}
+}
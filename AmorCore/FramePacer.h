@@ -0,0 +1,47 @@
+#pragma once
+#include "Common.h"
+
+namespace amor {
+	namespace util {
+
+		/*
+			Holds a loop to a target frame rate. wait() blocks until the next frame deadline, deadlines
+			advance by a fixed period so the average rate stays exact even if single frames run late.
+			A frame that ends more than a period behind restarts the schedule instead of bursting to catch up.
+
+			OS sleeps overshoot by anything from tens of microseconds to a full scheduler tick (~15.6ms on
+			Windows by default), so the wait sleeps in 1ms steps only while the remaining time is larger than
+			the overshoot seen so far (running mean + standard deviation) and spins for the rest.
+		*/
+		class FramePacer {
+		public:
+			FramePacer(double targetFps = 0.0);
+			~FramePacer();
+
+			// 0 turns pacing off, wait() then returns right away
+			void set_target_fps(double fps);
+			inline double target_fps() const { return m_TargetFps; }
+
+			// starts the schedule over from now, call after the loop was paused
+			void reset();
+
+			// blocks until the next frame deadline
+			void wait();
+
+			// current estimate of how far a 1ms sleep overshoots, in nanoseconds
+			inline u64 sleep_estimate_ns() const { return (u64)m_Estimate; }
+
+		private:
+			void observe_sleep(double ns);
+
+		private:
+			double m_TargetFps;
+			u64 m_PeriodNs;
+			u64 m_Deadline;
+
+			// exponentially weighted statistics of how long a 1ms sleep really takes
+			double m_Mean, m_Variance, m_Estimate;
+		};
+
+	}
+}
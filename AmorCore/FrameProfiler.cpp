@@ -0,0 +1,166 @@
+#include "pch.h"
+#include "FrameProfiler.h"
+
+#include <algorithm>
+
+namespace amor {
+	namespace util {
+
+		FrameProfiler::FrameProfiler(u32 capacity) :
+				m_Frames(capacity ? capacity : 1), m_Head(0), m_Count(0), m_Current{},
+				m_LastMark(0), m_InFrame(false), m_Enabled(true) {}
+
+		FrameProfiler::~FrameProfiler() {}
+
+		u64 FrameProfiler::now_ns() {
+			return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		const char* FrameProfiler::stage_name(FrameStage stage) {
+			switch (stage) {
+			case FrameStage::BeginFrame: return "BeginFrame";
+			case FrameStage::Input: return "Input";
+			case FrameStage::Update: return "OnUserUpdate";
+			case FrameStage::PrepareFrame: return "PrepareFrame";
+			case FrameStage::Render: return "OnUserRender";
+			case FrameStage::RenderFrame: return "RenderFrame";
+			case FrameStage::PostRenderFrame: return "PostRenderFrame";
+			case FrameStage::Swap: return "Swap";
+			default: return "Unknown";
+			}
+		}
+
+		void FrameProfiler::begin_frame() {
+			if (!m_Enabled) return;
+
+			m_Current = {};
+			m_Current.begin = now_ns();
+			m_LastMark = m_Current.begin;
+			m_InFrame = true;
+		}
+
+		void FrameProfiler::mark(FrameStage stage) {
+			if (!m_InFrame) return;
+
+			m_LastMark = now_ns();
+			m_Current.stages[(u32)stage] = m_LastMark;
+		}
+
+		void FrameProfiler::end_frame() {
+			if (!m_InFrame) return;
+			m_InFrame = false;
+
+			m_Current.end = now_ns();
+			m_Frames[m_Head] = m_Current;
+			m_Head = (m_Head + 1) % (u32)m_Frames.size();
+			if (m_Count < (u32)m_Frames.size()) ++m_Count;
+		}
+
+		void FrameProfiler::clear() {
+			m_Head = 0;
+			m_Count = 0;
+			m_InFrame = false;
+		}
+
+		const FrameProfiler::Frame& FrameProfiler::at(u32 i) const {
+			u32 oldest = (m_Head + (u32)m_Frames.size() - m_Count) % (u32)m_Frames.size();
+			return m_Frames[(oldest + i) % m_Frames.size()];
+		}
+
+		FrameProfiler::Summary FrameProfiler::summarize(std::vector<double>& samples) {
+			Summary summary{};
+			summary.samples = (u32)samples.size();
+			if (samples.empty()) return summary;
+
+			std::sort(samples.begin(), samples.end());
+
+			double total = 0.0;
+			for (double s : samples) total += s;
+			summary.mean = total / samples.size();
+
+			// nearest rank
+			auto percentile = [&](double p) {
+				size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+				return samples[rank ? rank - 1 : 0];
+			};
+			summary.p50 = percentile(50.0);
+			summary.p95 = percentile(95.0);
+			summary.p99 = percentile(99.0);
+			summary.max = samples.back();
+			return summary;
+		}
+
+		FrameProfiler::Summary FrameProfiler::frame_summary() const {
+			std::vector<double> samples;
+			samples.reserve(m_Count);
+
+			for (u32 i = 0; i < m_Count; ++i) {
+				const Frame& frame = at(i);
+				samples.push_back((frame.end - frame.begin) / 1e6);
+			}
+			return summarize(samples);
+		}
+
+		FrameProfiler::Summary FrameProfiler::stage_summary(FrameStage stage) const {
+			std::vector<double> samples;
+			samples.reserve(m_Count);
+
+			for (u32 i = 0; i < m_Count; ++i) {
+				const Frame& frame = at(i);
+				u64 begin = frame.begin;
+
+				for (u32 s = 0; s < (u32)FrameStage::COUNT; ++s) {
+					if (frame.stages[s] == 0) continue;
+
+					if (s == (u32)stage) {
+						samples.push_back((frame.stages[s] - begin) / 1e6);
+						break;
+					}
+					begin = frame.stages[s];
+				}
+			}
+			return summarize(samples);
+		}
+
+		bool FrameProfiler::export_chrome_trace(const std::string& filename) const {
+			std::ofstream file(filename, std::ios::out | std::ios::trunc);
+			if (!file.is_open()) {
+				AMOR_LOG_ERROR("FrameProfiler", "Unable to open %s", filename.c_str());
+				return false;
+			}
+
+			u64 origin = m_Count ? at(0).begin : 0;
+			auto us = [origin](u64 ns) { return (ns - origin) / 1000.0; };
+
+			char line[256];
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main_loop\"}}";
+
+			for (u32 i = 0; i < m_Count; ++i) {
+				const Frame& frame = at(i);
+
+				snprintf(line, sizeof(line), ",\n{\"name\":\"Frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+					us(frame.begin), (frame.end - frame.begin) / 1000.0);
+				file << line;
+
+				u64 begin = frame.begin;
+				for (u32 s = 0; s < (u32)FrameStage::COUNT; ++s) {
+					if (frame.stages[s] == 0) continue;
+
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+						stage_name((FrameStage)s), us(begin), (frame.stages[s] - begin) / 1000.0);
+					file << line;
+					begin = frame.stages[s];
+				}
+			}
+
+			file << "\n]}\n";
+			if (!file.good()) {
+				AMOR_LOG_ERROR("FrameProfiler", "Unable to write %s", filename.c_str());
+				return false;
+			}
+			return true;
+		}
+
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "Common.h"
+
+#include <string>
+#include <vector>
+
+namespace amor {
+	namespace util {
+
+		// stages of WindowBase::main_loop in the order they run
+		enum class FrameStage : u32 {
+			BeginFrame = 0,
+			Input,			// glfwPollEvents and the input update
+			Update,			// OnUserUpdate
+			PrepareFrame,
+			Render,			// OnUserRender
+			RenderFrame,
+			PostRenderFrame,
+			Swap,
+			COUNT
+		};
+
+		/*
+			Records how long every stage of the last N frames took, using steady_clock nanosecond
+			timestamps. A frame is begin_frame(), a mark() at the end of every stage and end_frame().
+			The stage that ends at a mark is taken to have started at the previous mark.
+
+			Summaries give percentiles over the recorded frames so stutter shows up (p99 and max)
+			where an fps average hides it. export_chrome_trace writes the frames in the chrome trace
+			event format, open it in chrome://tracing or https://ui.perfetto.dev
+		*/
+		class FrameProfiler {
+		public:
+			struct Summary {
+				u32 samples;
+				// milliseconds
+				double mean, p50, p95, p99, max;
+			};
+
+			FrameProfiler(u32 capacity = 600);
+			~FrameProfiler();
+
+			static u64 now_ns();
+			static const char* stage_name(FrameStage stage);
+
+			inline void set_enabled(bool enabled) { m_Enabled = enabled; }
+			inline bool enabled() const { return m_Enabled; }
+
+			void begin_frame();
+			void mark(FrameStage stage);
+			void end_frame();
+
+			// drops all recorded frames, the capacity stays
+			void clear();
+
+			// frames currently held, at most capacity
+			inline u32 size() const { return m_Count; }
+			inline u32 capacity() const { return (u32)m_Frames.size(); }
+
+			// whole frame, begin_frame to end_frame
+			Summary frame_summary() const;
+			Summary stage_summary(FrameStage stage) const;
+
+			// returns false if the file couldn't be written
+			bool export_chrome_trace(const std::string& filename) const;
+
+		private:
+			struct Frame {
+				u64 begin, end;
+				// timestamp each stage ended at, 0 if it wasn't marked this frame
+				u64 stages[(u32)FrameStage::COUNT];
+			};
+
+			// i = 0 is the oldest frame held
+			const Frame& at(u32 i) const;
+			static Summary summarize(std::vector<double>& samples);
+
+		private:
+			std::vector<Frame> m_Frames;
+			u32 m_Head;
+			u32 m_Count;
+			Frame m_Current;
+			u64 m_LastMark;
+			bool m_InFrame;
+			bool m_Enabled;
+		};
+
+	}
+}
@@ -1,6 +1,10 @@
 #include "pch.h"
 #include "Graphics.h"
 #include "Input.h"
+#include "SpanKernels.h"
+#include "Raster.h"
+#include "TileRasterizer.h"
+#include "TextureLoader.h"
 
 #include <glad/glad.h>
 #include <glfw/glfw3.h>
@@ -8,7 +12,6 @@
 
 #include <fstream>
 #include <filesystem>
-#include <zlib.h>
 
 namespace amor {
     namespace graphics {
@@ -29,7 +32,7 @@ namespace amor {
 #pragma endregion
 #pragma region class::WindowBase
         static void glfw_error_callback(int error, const char* description) {
-            logging::GetInstance()->error(std::string("errno ") + std::to_string(error) + " - " + description, "GLFW");
+            AMOR_LOG_ERROR("GLFW", "errno %d - %s", error, description);
         }
 
         WindowBase::WindowBase(RendererBase* renderer, const std::string& title, u32 width, u32 height) :
@@ -40,7 +43,12 @@ namespace amor {
                         m_Input(nullptr),
                         m_Fps(0.0),
                         m_Timer(new util::Timer()),
-                        m_FpsTimer(new util::Timer()) {
+                        m_FpsTimer(new util::Timer()),
+                        m_Profiler(new util::FrameProfiler()),
+                        m_Pacer(new util::FramePacer()),
+                        m_FrameArena(new util::Arena()),
+                        m_UpdateArena(new util::Arena()),
+                        m_TextureLoader(new TextureLoader()) {
 
             // this was originally was to be put into the InitializeGraphicsPipeline
             // however since our library is built around using glfw for window creation and 
@@ -48,9 +56,11 @@ namespace amor {
             // left to the graphics pipeline however which should still theoretically allow for any
             // glfw compatible rendering api to be used. Some basic research suggests that most all
             // rendering apis are supported on glfw including (OpenGl, Vulkan, Metal, and DirectX)
-            if (glfwInit() == GL_FALSE) {
-                logging::GetInstance()->fail("Unable to initialize glfw", "GLFW");
-                throw std::runtime_error("glfw init");
+            // not fatal here, without a display the window can still be run headless
+            m_GlfwReady = glfwInit() != GL_FALSE;
+            if (!m_GlfwReady) {
+                logging::GetInstance()->warn("Unable to initialize glfw, only headless runs are available", "GLFW");
+                return;
             }
 
             glfwSetErrorCallback(glfw_error_callback);
@@ -66,18 +76,27 @@ namespace amor {
                         m_Input(nullptr),
                         m_Fps(0.0),
                         m_Timer(new util::Timer()),
-                        m_FpsTimer(new util::Timer()) {
-
-
-            if (glfwInit() == GL_FALSE) {
-                logging::GetInstance()->fail("Unable to initialize glfw", "GLFW");
-                throw std::runtime_error("glfw init");
+                        m_FpsTimer(new util::Timer()),
+                        m_Profiler(new util::FrameProfiler()),
+                        m_Pacer(new util::FramePacer()),
+                        m_FrameArena(new util::Arena()),
+                        m_UpdateArena(new util::Arena()),
+                        m_TextureLoader(new TextureLoader()) {
+
+
+            // not fatal here, without a display the window can still be run headless
+            m_GlfwReady = glfwInit() != GL_FALSE;
+            if (!m_GlfwReady) {
+                logging::GetInstance()->warn("Unable to initialize glfw, only headless runs are available", "GLFW");
+                return;
             }
 
             glfwSetErrorCallback(glfw_error_callback);
         }
 
         WindowBase::~WindowBase() {
+            stop_update_thread();
+
             if (m_WindowHandle != nullptr) {
                 glfwDestroyWindow(m_WindowHandle);
                 m_WindowHandle = nullptr;
@@ -98,14 +117,128 @@ namespace amor {
                 m_FpsTimer = nullptr;
             }
 
-            glfwTerminate();
+            if (m_Profiler != nullptr) {
+                delete m_Profiler;
+                m_Profiler = nullptr;
+            }
+
+            if (m_Pacer != nullptr) {
+                delete m_Pacer;
+                m_Pacer = nullptr;
+            }
+
+            if (m_FrameArena != nullptr) {
+                delete m_FrameArena;
+                m_FrameArena = nullptr;
+            }
+
+            if (m_UpdateArena != nullptr) {
+                delete m_UpdateArena;
+                m_UpdateArena = nullptr;
+            }
+
+            if (m_TextureLoader != nullptr) {
+                delete m_TextureLoader;
+                m_TextureLoader = nullptr;
+            }
+
+            if (m_GlfwReady) {
+                glfwTerminate();
+            }
         }
 
         double WindowBase::fps() const {
             return m_Fps;
         }
 
+        void WindowBase::set_fixed_timestep(u32 ticksPerSecond, u32 maxTicksPerFrame) {
+            m_TicksPerSecond = ticksPerSecond;
+            m_MaxTicksPerFrame = maxTicksPerFrame ? maxTicksPerFrame : 1;
+            m_TickNs = ticksPerSecond ? 1000000000ull / ticksPerSecond : 0;
+            m_Accumulator = 0;
+            m_Alpha = 1.0;
+            m_RenderAlpha = 1.0;
+        }
+
+        bool WindowBase::update(u64 frameNs) {
+            if (m_TickNs == 0) {
+                m_Alpha = 1.0;
+                return OnUserUpdate((double)frameNs / 1e9);
+            }
+
+            // integer nanoseconds so the accumulator doesn't drift over long runs
+            m_Accumulator += frameNs;
+
+            u64 ticks = m_Accumulator / m_TickNs;
+            if (ticks > m_MaxTicksPerFrame) {
+                ticks = m_MaxTicksPerFrame;
+                m_Accumulator = m_Accumulator % m_TickNs + ticks * m_TickNs;
+            }
+
+            double tickSeconds = (double)m_TickNs / 1e9;
+            for (u64 i = 0; i < ticks; ++i) {
+                m_Accumulator -= m_TickNs;
+                if (!OnUserUpdate(tickSeconds)) {
+                    return false;
+                }
+            }
+
+            m_Alpha = (double)m_Accumulator / (double)m_TickNs;
+            return true;
+        }
+
+        void WindowBase::set_target_fps(double fps) {
+            m_Pacer->set_target_fps(fps);
+        }
+
+        double WindowBase::target_fps() const {
+            return m_Pacer->target_fps();
+        }
+
+        void WindowBase::set_swap_interval(i32 interval) {
+            m_SwapInterval = interval;
+            m_SwapIntervalSet = true;
+
+            if (m_WindowHandle != nullptr) {
+                glfwSwapInterval(m_SwapInterval);
+            }
+        }
+
+        void WindowBase::set_threaded_update(bool threaded) {
+            if (m_UpdateThread.joinable()) {
+                logging::GetInstance()->error("Threaded update can't be changed while the window is running", "MainWindow");
+                return;
+            }
+            m_ThreadedUpdate = threaded;
+        }
+
+        void WindowBase::set_idle_mode(bool enabled, double timeoutSeconds) {
+            m_IdleMode = enabled;
+            m_IdleTimeout = timeoutSeconds > 0.0 ? timeoutSeconds : 0.5;
+            m_IdleFrames = IDLE_GRACE_FRAMES;
+        }
+
+        util::FrameProfiler& WindowBase::profiler() {
+            return *m_Profiler;
+        }
+
+        // the arena of the loop thread the caller is on, set while main_loop, run_headless or update_thread runs
+        static thread_local util::Arena* t_FrameArena = nullptr;
+
+        util::Arena& WindowBase::frame_arena() {
+            return t_FrameArena != nullptr ? *t_FrameArena : *m_FrameArena;
+        }
+
+        TextureLoader& WindowBase::texture_loader() {
+            return *m_TextureLoader;
+        }
+
         void WindowBase::show() {
+            if (!m_GlfwReady) {
+                logging::GetInstance()->fail("Unable to show a window, glfw is not initialized", "GLFW");
+                throw std::runtime_error("glfw init");
+            }
+
             // renderer initializes graphics here. For opengl the main thing to initialize are the window hints
             m_RendererHandle->InitializeGraphicsPipeline();
 
@@ -119,6 +252,11 @@ namespace amor {
 
             m_RendererHandle->InitializeWindowGraphicsPipeline(this);
 
+            // the renderer made the context current, swap interval applies to it
+            if (m_SwapIntervalSet) {
+                glfwSwapInterval(m_SwapInterval);
+            }
+
             logging::GetInstance()->info("Window Created", "GLFW");
             logging::GetInstance()->info("Entering Main Loop", "MainWindow");
             main_loop();
@@ -126,6 +264,77 @@ namespace amor {
             m_RendererHandle->DeinitializeGraphicsPipeline(this);
         }
 
+        void WindowBase::run_headless(u64 frames, double delta) {
+            if (!m_RendererHandle->IsHeadless()) {
+                logging::GetInstance()->fail("Headless runs need a headless renderer", "MainWindow");
+                throw std::runtime_error("renderer is not headless");
+            }
+
+            m_RendererHandle->InitializeGraphicsPipeline();
+
+            // no window, input polls nothing
+            m_Input = new input::Input(this);
+
+            m_RendererHandle->InitializeWindowGraphicsPipeline(this);
+
+            logging::GetInstance()->info("Entering Headless Loop", "MainWindow");
+
+            if (OnUserInit()) {
+                t_FrameArena = m_FrameArena;
+                m_FpsTimer->start();
+                m_Accumulator = 0;
+
+                // simulated time, the fixed timestep still applies so ticks per frame match a real run
+                u64 deltaNs = (u64)(delta * 1e9 + 0.5);
+
+                double avgFps = 0.0;
+                for (u64 frame = 0; frames == 0 || frame < frames; ++frame) {
+                    avgFps = (avgFps + m_FpsTimer->delta_seconds()) / 2.0;
+                    m_Fps = 1.0 / avgFps;
+
+                    m_Profiler->begin_frame();
+                    m_FrameArena->reset();
+
+                    m_RendererHandle->BeginFrame(this);
+                    m_Profiler->mark(util::FrameStage::BeginFrame);
+
+                    m_Input->Update(this);
+                    m_TextureLoader->dispatch();
+                    m_Profiler->mark(util::FrameStage::Input);
+
+                    if (m_TickNs == 0 ? !OnUserUpdate(delta) : !update(deltaNs)) {
+                        break;
+                    }
+                    m_Profiler->mark(util::FrameStage::Update);
+
+                    OnUserHandoff();
+                    m_RenderAlpha = m_Alpha;
+
+                    m_RendererHandle->PrepareFrame(this);
+                    m_Profiler->mark(util::FrameStage::PrepareFrame);
+                    OnUserRender(m_RendererHandle, m_RenderAlpha);
+                    m_Profiler->mark(util::FrameStage::Render);
+                    m_RendererHandle->RenderFrame(this);
+                    m_Profiler->mark(util::FrameStage::RenderFrame);
+                    m_RendererHandle->PostRenderFrame(this);
+                    m_Profiler->mark(util::FrameStage::PostRenderFrame);
+
+                    m_Profiler->end_frame();
+                }
+
+                OnUserDeinit();
+                t_FrameArena = nullptr;
+            }
+            else {
+                logging::GetInstance()->error("User Init exited with value of 'false'", "User");
+            }
+
+            m_RendererHandle->DeinitializeGraphicsPipeline(this);
+
+            delete m_Input;
+            m_Input = nullptr;
+        }
+
         i32 WindowBase::get_display_count() const {
             i32 count;
             glfwGetMonitors(&count);
@@ -181,34 +390,153 @@ namespace amor {
 
             m_Timer->start();
             m_FpsTimer->start();
-            
+            m_Accumulator = 0;
+
+            m_Pacer->reset();
+            t_FrameArena = m_FrameArena;
+            m_UpdateArena->reset();
+
+            if (m_ThreadedUpdate) {
+                m_UpdatesStarted = 0;
+                m_UpdatesFinished = 0;
+                m_StopUpdates = false;
+                m_UpdateExit = false;
+                m_UpdateThread = std::thread(&WindowBase::update_thread, this);
+            }
+
             double avgFps = 0.0;
             while (!glfwWindowShouldClose(m_WindowHandle)) {
+                if (m_IdleMode && m_IdleFrames == 0) {
+                    glfwWaitEventsTimeout(m_IdleTimeout);
+
+                    // nothing ran while blocked, don't hand the wait to OnUserUpdate or the pacer
+                    m_Timer->delta_ns();
+                    m_Pacer->reset();
+                    m_IdleFrames = IDLE_GRACE_FRAMES;
+                }
+
                 avgFps = (avgFps + m_FpsTimer->delta_seconds()) / 2.0;
                 m_Fps = 1.0 / avgFps;
 
+                m_Profiler->begin_frame();
+                m_FrameArena->reset();
+
+                m_RendererHandle->BeginFrame(this);
+                m_Profiler->mark(util::FrameStage::BeginFrame);
+
                 glfwPollEvents();
-                m_Input->Update(this);
+                if (m_ThreadedUpdate) {
+                    m_Profiler->mark(util::FrameStage::Input);
 
-                if (!OnUserUpdate(m_Timer->delta_seconds())) {
-                    break;
+                    // handoff, the update thread is stopped from here until the next update is started
+                    wait_for_update();
+                    if (m_UpdateExit) {
+                        break;
+                    }
+
+                    m_Input->Update(this);
+                    m_TextureLoader->dispatch();
+                    OnUserHandoff();
+                    m_RenderAlpha = m_Alpha;
+
+                    // the handoff was the last look at what the update allocated
+                    m_UpdateArena->reset();
+
+                    m_UpdateFrameNs = m_Timer->delta_ns();
+                    m_UpdatesStarted.fetch_add(1, std::memory_order_release);
+                    m_UpdatesStarted.notify_one();
                 }
+                else {
+                    m_Input->Update(this);
+                    m_TextureLoader->dispatch();
+                    m_Profiler->mark(util::FrameStage::Input);
+
+                    if (!update(m_Timer->delta_ns())) {
+                        break;
+                    }
+                    OnUserHandoff();
+                    m_RenderAlpha = m_Alpha;
+                }
+                m_Profiler->mark(util::FrameStage::Update);
 
                 m_RendererHandle->PrepareFrame(this);
-                OnUserRender(m_RendererHandle);
+                m_Profiler->mark(util::FrameStage::PrepareFrame);
+                OnUserRender(m_RendererHandle, m_RenderAlpha);
+                m_Profiler->mark(util::FrameStage::Render);
                 m_RendererHandle->RenderFrame(this);
+                m_Profiler->mark(util::FrameStage::RenderFrame);
                 m_RendererHandle->PostRenderFrame(this);
+                m_Profiler->mark(util::FrameStage::PostRenderFrame);
 
                 glfwSwapBuffers(m_WindowHandle);
+                m_Profiler->mark(util::FrameStage::Swap);
+
+                m_Profiler->end_frame();
+
+                if (m_RedrawRequested.exchange(false, std::memory_order_relaxed)) {
+                    m_IdleFrames = IDLE_GRACE_FRAMES;
+                }
+                else if (m_IdleFrames > 0) {
+                    --m_IdleFrames;
+                }
+
+                m_Pacer->wait();
             }
 
+            stop_update_thread();
+
             OnUserDeinit();
+            t_FrameArena = nullptr;
+        }
+
+        void WindowBase::update_thread() {
+            t_FrameArena = m_UpdateArena;
+
+            u64 finished = 0;
+            for (;;) {
+                m_UpdatesStarted.wait(finished, std::memory_order_acquire);
+                if (m_StopUpdates.load(std::memory_order_acquire)) {
+                    break;
+                }
+
+                if (!update(m_UpdateFrameNs)) {
+                    m_UpdateExit = true;
+                }
+
+                ++finished;
+                m_UpdatesFinished.store(finished, std::memory_order_release);
+                m_UpdatesFinished.notify_one();
+            }
+        }
+
+        void WindowBase::wait_for_update() {
+            u64 started = m_UpdatesStarted.load(std::memory_order_relaxed);
+            u64 finished = m_UpdatesFinished.load(std::memory_order_acquire);
+            while (finished != started) {
+                m_UpdatesFinished.wait(finished, std::memory_order_acquire);
+                finished = m_UpdatesFinished.load(std::memory_order_acquire);
+            }
+        }
+
+        void WindowBase::stop_update_thread() {
+            if (!m_UpdateThread.joinable()) {
+                return;
+            }
+
+            wait_for_update();
+
+            m_StopUpdates.store(true, std::memory_order_release);
+            m_UpdatesStarted.fetch_add(1, std::memory_order_release);
+            m_UpdatesStarted.notify_one();
+            m_UpdateThread.join();
         }
 
         bool WindowBase::OnUserInit() { return true; }
         void WindowBase::OnUserDeinit() {}
         bool WindowBase::OnUserUpdate(double d) { return true; }
         void WindowBase::OnUserRender(RendererBase* r) {}
+        void WindowBase::OnUserRender(RendererBase* r, double alpha) { OnUserRender(r); }
+        void WindowBase::OnUserHandoff() {}
 
         void WindowBase::refresh_context() {
             glfwMakeContextCurrent(m_WindowHandle);
@@ -232,6 +560,8 @@ namespace amor {
             glClear(GL_COLOR_BUFFER_BIT);
         };
         void RendererBase::PostRenderFrame(WindowBase* win) { };
+        void RendererBase::BeginFrame(WindowBase* win) { };
+        bool RendererBase::IsHeadless() const { return false; }
 #pragma endregion
 #pragma region class::Texture
         Texture::Texture() : m_Width(0), m_Height(0), m_Pixels(nullptr), m_ImageLoaded(false) {
@@ -240,11 +570,15 @@ namespace amor {
         Texture::Texture(u32 width, u32 height) : m_Width(width), m_Height(height), m_Pixels(nullptr), m_ImageLoaded(false) {
             m_Pixels = new Color[width * height];
         }
+        Texture::Texture(u32 width, u32 height, util::Allocator& allocator) : m_Width(0), m_Height(0), m_Pixels(nullptr), m_ImageLoaded(false),
+                        m_Allocator(&allocator) {
+            allocate_pixels(width, height);
+        }
         Texture::Texture(const char* filename) {
             i32 w, h, n;
             byte* data = stbi_load(filename, &w, &h, &n, 4);
             if (data == NULL) {
-                logging::GetInstance()->error("Error loading image file: " + std::string(filename), "Texture");
+                AMOR_LOG_ERROR("Texture", "Error loading image file: %s", filename);
                 throw std::runtime_error("Cannot load file");
             }
 
@@ -254,10 +588,35 @@ namespace amor {
             m_ImageLoaded = true;
         }
         Texture::~Texture() {
+            release_pixels();
+        }
+
+        void Texture::allocate_pixels(u32 width, u32 height) {
+            release_pixels();
+
+            m_Width = width;
+            m_Height = height;
+            if (m_Allocator != nullptr) {
+                // cache line aligned for the SIMD kernels
+                m_Pixels = (Color*)m_Allocator->allocate((size_t)width * height * sizeof(Color), 64);
+            }
+            else {
+                m_Pixels = new Color[width * height];
+            }
+        }
+
+        void Texture::release_pixels() {
             if (m_Pixels == nullptr) return;
-            if (m_ImageLoaded) {
+            if (m_Mapping != nullptr) {
+                delete m_Mapping;
+                m_Mapping = nullptr;
+            }
+            else if (m_ImageLoaded) {
                 stbi_image_free(m_Pixels);
             }
+            else if (m_Allocator != nullptr) {
+                m_Allocator->deallocate(m_Pixels, (size_t)m_Width * m_Height * sizeof(Color), 64);
+            }
             else {
                 delete[] m_Pixels;
             }
@@ -275,142 +634,179 @@ namespace amor {
             return m_Pixels;
         }
 
+        void Texture::premultiply() {
+            if (m_Premultiplied) return;
 
-        // not truly noendian, but this will use math to force a specific endian
-        // format for the u32 bytes, unsafe because there's no buffer checks
-        // so be careful with buffer overflows
-        void write_u32_noendian_unsafe(byte* buffer, u32 value, u64& index) {
-            buffer[index++] = (byte)((value >> 24) & 0xFF);
-            buffer[index++] = (byte)((value >> 16) & 0xFF);
-            buffer[index++] = (byte)((value >>  8) & 0xFF);
-            buffer[index++] = (byte)((value) & 0xFF);
+            for (u32 i = 0; i < m_Width * m_Height; ++i) {
+                Color& c = m_Pixels[i];
+                c.r = kernels::div255(c.r * c.a);
+                c.g = kernels::div255(c.g * c.a);
+                c.b = kernels::div255(c.b * c.a);
+            }
+            m_Premultiplied = true;
         }
-
-        void read_u32_noendian_unsafe(byte* buffer, u32& value, u64& index) {
-            value = (static_cast<u32>(buffer[index]) << 24) |
-                    (static_cast<u32>(buffer[index+1]) << 16) |
-                    (static_cast<u32>(buffer[index+2]) << 8) |
-                    (static_cast<u32>(buffer[index+3]));
-            index += 4;
+        bool Texture::is_premultiplied() const {
+            return m_Premultiplied;
+        }
+        void Texture::set_premultiplied(bool premultiplied) {
+            m_Premultiplied = premultiplied;
         }
 
-        // buffer_size (for colors): width * height * 4 (rgba)
-        // u32: [b0] [b1] [b2] [b3]
-        // file format: 'P', 'X', 'I', 'M', [width b0], [width b1], [width b2], [width b3], [height b0], [height b1], [height b2], [height b3], <compressed color stream>
-        void Texture::save(const char* filename) {
-            byte* colorBuffer = new byte[m_Width * m_Height * 4];
-            byte* compressionBuffer = new byte[m_Width * m_Height * 4];
-            uLongf compressedLength = (m_Width * m_Height * 4);
 
-            std::copy((byte*)m_Pixels, (byte*)(m_Pixels + m_Width * m_Height), colorBuffer);
+        // file format: see Pxim.h
+        void Texture::save(const char* filename, pxim::Compression compression) {
+            AMOR_PROFILE_SCOPE("Texture::save");
+            pxim::WriteOptions options;
+            options.compression = compression;
+            pxim::Write(filename, m_Pixels, m_Width, m_Height, options);
+        }
+        void Texture::load(const char* filename, u32 threads) {
+            AMOR_PROFILE_SCOPE("Texture::load");
+            pxim::Reader reader;
+            reader.set_threads(threads);
+            if (!reader.open(filename)) {
+                return;
+            }
 
-            if (compress(compressionBuffer, &compressedLength, colorBuffer, m_Width * m_Height * 4) != Z_OK) {
-                logging::GetInstance()->error("Unabled to compress color buffer", "Texture.Save");
-                delete[] colorBuffer;
-                delete[] compressionBuffer;
+            // nothing to decode, the pages are the pixels and are only read when they're touched
+            if (reader.is_mappable() && map_pixels(filename, reader, util::MappedFile::Mode::CopyOnWrite)) {
                 return;
             }
 
-            u64 index = 4;
-            byte* headerBuffer = new byte[12];
-            headerBuffer[0] = 'P';
-            headerBuffer[1] = 'X';
-            headerBuffer[2] = 'I';
-            headerBuffer[3] = 'M';
-            write_u32_noendian_unsafe(headerBuffer, m_Width, index);
-            write_u32_noendian_unsafe(headerBuffer, m_Height, index);
+            // decoded straight into the new pixels, nothing else the size of the image is allocated
+            allocate_pixels(reader.width(), reader.height());
+            m_Premultiplied = false;
 
-            std::ofstream file(filename, std::ios::binary | std::ios::out);
-            if (file.is_open()) {
+            if (!reader.read(m_Pixels)) {
+                AMOR_LOG_ERROR("Texture.Load", "Unable to decode %s", filename);
+                release_pixels();
+                m_Width = m_Height = 0;
+            }
+        }
+        void Texture::load_region(const char* filename, const math::Rect& region) {
+            AMOR_PROFILE_SCOPE("Texture::load_region");
+            pxim::Reader reader;
+            if (!reader.open(filename)) {
+                return;
+            }
+            if (region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0 ||
+                    (u32)region.x2() > reader.width() || (u32)region.y2() > reader.height()) {
+                AMOR_LOG_ERROR("Texture.Load", "Region %d,%d %dx%d is outside the %ux%u image %s", region.x, region.y, region.width, region.height,
+                    reader.width(), reader.height(), filename);
+                return;
+            }
 
-                file.write((char*)headerBuffer, 12);
-                file.write((char*)compressionBuffer, compressedLength);
+            allocate_pixels(region.width, region.height);
+            m_Premultiplied = false;
 
-                file.close();
-            }
-            else {
-                logging::GetInstance()->error("Unabled to open file for saving", "Texture.Save");
+            if (!reader.read_region(region, m_Pixels, region.width)) {
+                AMOR_LOG_ERROR("Texture.Load", "Unable to decode a region of %s", filename);
+                release_pixels();
+                m_Width = m_Height = 0;
             }
+        }
 
-            delete[] colorBuffer;
-            delete[] compressionBuffer;
-            delete[] headerBuffer;
+        void Texture::save_mappable(const char* filename) {
+            AMOR_PROFILE_SCOPE("Texture::save_mappable");
+            pxim::WriteOptions options;
+            options.mappable = true;
+            pxim::Write(filename, m_Pixels, m_Width, m_Height, options);
         }
-        void Texture::load(const char* filename) {
-            if (!std::filesystem::exists(filename)) {
-                logging::GetInstance()->error("File not found", "Texture.Load");
+        void Texture::map(const char* filename, util::MappedFile::Mode mode) {
+            AMOR_PROFILE_SCOPE("Texture::map");
+            if (mode == util::MappedFile::Mode::ReadWrite) {
+                // the texture would write to the asset itself
+                AMOR_LOG_ERROR("Texture.Map", "Textures can only be mapped read only or copy on write, not mapping %s", filename);
                 return;
             }
-            u64 fileSize = 0;
 
-            {
-                std::ifstream fsize(filename, std::ios::binary | std::ios::ate);
-                fileSize = fsize.tellg();
-                fsize.close();
-            }
-            if (fileSize == 0) {
-                logging::GetInstance()->error("Unexpected file size for texture loading", "Texture.Load");
+            pxim::Reader reader;
+            if (!reader.open(filename)) {
                 return;
             }
-            
-            byte* fileBuffer = new byte[fileSize];
-            std::ifstream file(filename, std::ios::binary);
-            if (file.is_open()) {
-                file.read((char*)fileBuffer, fileSize);
-                file.close();
-            }
-            else {
-                logging::GetInstance()->error("Unabled to open file for reading", "Texture.Load");
-                delete[] fileBuffer;
+            if (!reader.is_mappable()) {
+                AMOR_LOG_ERROR("Texture.Map", "%s isn't laid out to be mapped, save it with save_mappable", filename);
                 return;
             }
-
-            if ((char)fileBuffer[0] != 'P' || (char)fileBuffer[1] != 'X' || (char)fileBuffer[2] != 'I' || (char)fileBuffer[3] != 'M') {
-                logging::GetInstance()->error("Unexpected file format", "Texture.Load");
-                delete[] fileBuffer;
-                return;
+            map_pixels(filename, reader, mode);
+        }
+        bool Texture::map_pixels(const char* filename, const pxim::Reader& reader, util::MappedFile::Mode mode) {
+            util::MappedFile* mapping = new util::MappedFile();
+            u64 end = reader.pixel_offset() + (u64)reader.width() * reader.height() * sizeof(Color);
+            if (!mapping->open(filename, mode) || mapping->size() < end) {
+                if (!mapping->is_open()) {
+                    AMOR_LOG_ERROR("Texture.Map", "%s", mapping->error().c_str());
+                }
+                else {
+                    // changed since the reader looked at it
+                    AMOR_LOG_ERROR("Texture.Map", "%s is shorter than its pixels", filename);
+                }
+                delete mapping;
+                return false;
             }
 
-            u64 offset = 4;
-            u32 width, height;
-            read_u32_noendian_unsafe(fileBuffer, width, offset);
-            read_u32_noendian_unsafe(fileBuffer, height, offset);
+            release_pixels();
+            m_Mapping = mapping;
+            m_Pixels = reinterpret_cast<Color*>(mapping->data() + reader.pixel_offset());
+            m_Width = reader.width();
+            m_Height = reader.height();
+            m_Premultiplied = false;
+            return true;
+        }
 
-            // offset pointer past the header and size info to the start of the compressed color buffer
-            fileBuffer += offset;
-            uLongf colorBufferSize = (uLongf)(fileSize - offset);
+#pragma endregion
+#pragma region class::PrimitiveContext2D
 
-            uLongf uncompressedSize = (width * height * 4);
-            byte* uncompressedStream = new byte[uncompressedSize];
+        static math::Rect Union(const math::Rect& a, const math::Rect& b) {
+            i32 x0 = math::min(a.x, b.x);
+            i32 y0 = math::min(a.y, b.y);
+            i32 x1 = math::max(a.x2(), b.x2());
+            i32 y1 = math::max(a.y2(), b.y2());
+            return { x0, y0, x1 - x0, y1 - y0 };
+        }
 
-            if (uncompress(uncompressedStream, &uncompressedSize, fileBuffer, colorBufferSize) != Z_OK) {
-                logging::GetInstance()->error("Unabled to decompress color data", "Texture.Load");
-                delete[] uncompressedStream;
-                delete[] (fileBuffer - offset);
-                return;
-            }
+        static i64 Area(const math::Rect& r) {
+            return (i64)r.width * r.height;
+        }
 
-            if (m_ImageLoaded) {
-                stbi_image_free(m_Pixels);
-                m_Pixels = nullptr;
-            }
-            else if (m_Pixels != nullptr) {
-                delete[] m_Pixels;
+        void DirtyRegion::add(const math::Rect& rect) {
+            if (rect.width <= 0 || rect.height <= 0) return;
+
+            math::Rect merged = rect;
+            // merging can make the result overlap rects that were checked earlier, so start over
+            for (u32 i = 0; i < m_Count; ) {
+                if (m_Rects[i].contains(merged)) return;
+
+                if (m_Rects[i].overlaps(merged)) {
+                    merged = Union(merged, m_Rects[i]);
+                    m_Rects[i] = m_Rects[--m_Count];
+                    i = 0;
+                    continue;
+                }
+                ++i;
             }
 
-            m_Width = width;
-            m_Height = height;
-            m_Pixels = new Color[width * height];
+            if (m_Count == MAX_RECTS) {
+                u32 best = 0;
+                i64 bestGrowth = INT64_MAX;
+                for (u32 i = 0; i < m_Count; ++i) {
+                    i64 growth = Area(Union(m_Rects[i], merged)) - Area(m_Rects[i]);
+                    if (growth < bestGrowth) {
+                        bestGrowth = growth;
+                        best = i;
+                    }
+                }
+                merged = Union(merged, m_Rects[best]);
+                m_Rects[best] = m_Rects[--m_Count];
 
-            std::copy(uncompressedStream, uncompressedStream + uncompressedSize, (byte*)m_Pixels);
+                // the grown rect may now overlap others
+                add(merged);
+                return;
+            }
 
-            delete[] uncompressedStream;
-            delete[] (fileBuffer - offset);
+            m_Rects[m_Count++] = merged;
         }
 
-#pragma endregion
-#pragma region class::PrimitiveContext2D
-
         PrimitiveContext2D Texture::GetContext() {
             return { m_Width, m_Height, m_Pixels };
         }
@@ -420,266 +816,170 @@ namespace amor {
                 m_Width(width), m_Height(height), m_Pixels(buffer), m_BufferLength(width * height) {
 
         }
+        PrimitiveContext2D::PrimitiveContext2D(const PrimitiveContext2D& other) :
+                m_Width(other.m_Width), m_Height(other.m_Height), m_Pixels(other.m_Pixels),
+                m_BufferLength(other.m_BufferLength), m_BlendMode(other.m_BlendMode) {
+
+        }
+        PrimitiveContext2D& PrimitiveContext2D::operator=(const PrimitiveContext2D& other) {
+            if (this == &other) return *this;
+
+            // whatever was recorded belongs to the old buffer
+            SetDeferred(false);
+
+            m_Width = other.m_Width;
+            m_Height = other.m_Height;
+            m_Pixels = other.m_Pixels;
+            m_BufferLength = other.m_BufferLength;
+            m_BlendMode = other.m_BlendMode;
+            return *this;
+        }
         PrimitiveContext2D::~PrimitiveContext2D() {
             // we don't own the buffer pointer so we don't free the buffer pointer
             m_Pixels = nullptr;
+
+            delete m_Deferred;
+            m_Deferred = nullptr;
+        }
+
+        BlendMode PrimitiveContext2D::TextureBlendMode(const Texture& tex) const {
+            if (m_BlendMode == BlendMode::Normal && tex.is_premultiplied()) {
+                return BlendMode::PremultipliedOver;
+            }
+            return m_BlendMode;
         }
 
         void PrimitiveContext2D::SetBlending(BlendMode mode) {
             m_BlendMode = mode;
+        }
 
-            if ((int)m_BlendMode) {
-                DrawI = &PrimitiveContext2D::DrawB;
-            }
-            else {
-                DrawI = &PrimitiveContext2D::Draw;
+        void PrimitiveContext2D::SetDeferred(bool deferred, u32 tileSize, u32 threads) {
+            if (m_Deferred != nullptr) {
+                Flush();
+                delete m_Deferred;
+                m_Deferred = nullptr;
             }
 
-            switch (m_BlendMode) {
-            case BlendMode::Normal:
-                m_BlendFunc = &PrimitiveContext2D::Blend;
-                break;
+            if (deferred) {
+                m_Deferred = new raster::TileRasterizer(tileSize, threads);
             }
         }
 
-        Color PrimitiveContext2D::Blend(const Color& src, const Color& dest) {
-            math::Vec3f a = src.to_rgb_vec();
-            math::Vec3f b = dest.to_rgb_vec();
-            double alpha = src.a / 255.0;
-            a = (a * alpha) + (b * (1.0 - alpha));
+        void PrimitiveContext2D::Flush() {
+            if (m_Deferred == nullptr) return;
+            m_Deferred->Flush(Target());
+        }
 
-            if (a.x > 1.0f) a.x = 1.0f;
-            if (a.y > 1.0f) a.y = 1.0f;
-            if (a.z > 1.0f) a.z = 1.0f;
-            if (a.x < 0.0f) a.x = 0.0f;
-            if (a.y < 0.0f) a.y = 0.0f;
-            if (a.z < 0.0f) a.z = 0.0f;
-            
-            return Color::from_rgb_vec( a );
+        raster::Surface PrimitiveContext2D::Target() const {
+            return { m_Pixels, (i32)m_Width, 0, 0, (i32)m_Width, (i32)m_Height };
         }
 
-        u32 PrimitiveContext2D::Index(i32 x, i32 y) {
-            if (x < 0 || y < 0 || x >= (i32)m_Width || y >= (i32)m_Height) return -1;
-            return (y * (i32)m_Width + x);
+        void PrimitiveContext2D::SetDirtyTracking(bool track) {
+            m_TrackDirty = track;
+            ClearDirty();
         }
 
-        void PrimitiveContext2D::Coordinate(u32 index, i32& x, i32& y) {
-            y = index / m_Width;
-            x = index & m_Width;
+        void PrimitiveContext2D::FoldPlots() {
+            if (m_PlotX1 <= m_PlotX0) return;
+            m_Dirty.add({ m_PlotX0, m_PlotY0, m_PlotX1 - m_PlotX0, m_PlotY1 - m_PlotY0 });
+            m_PlotX1 = m_PlotX0;
         }
 
-        void PrimitiveContext2D::Clear(const Color& col) {
-            std::fill(m_Pixels, m_Pixels + m_BufferLength, col);
+        void PrimitiveContext2D::MarkDirty(const math::Rect& rect) {
+            if (!m_TrackDirty) return;
+
+            math::Rect dest = rect;
+            i32 srcX = 0, srcY = 0;
+            if (!raster::clip_rect(Target(), dest, srcX, srcY)) return;
+            m_Dirty.add(dest);
         }
-        void PrimitiveContext2D::FillRect(i32 x, i32 y, i32 width, i32 height, const Color& color) {
-            if (x < 0) {
-                width += x; // x is negative
-                x = 0;
-            }
-            if (y < 0) {
-                height += y;
-                y = 0;
-            }
-            if (x >= (i32)m_Width) {
-                return;
-            }
-            if (y >= (i32)m_Height) {
-                return;
-            }
-            if (x + width > (i32)m_Width) {
-                width -= (x + width) - (i32)m_Width;
-            }
-            if (y + height > (i32)m_Height) {
-                height -= (y + height) - (i32)m_Height;
-            }
 
+        Color* PrimitiveContext2D::Data() {
+            MarkDirty({ 0, 0, (i32)m_Width, (i32)m_Height });
+            return m_Pixels;
+        }
 
-            if ((int)m_BlendMode) {
-                for (i32 i = x; i < x+width; i++) {
-                    for (i32 j = y; j < y+height; j++) {
-                        DrawB(i, j, color);
-                    }
+        void PrimitiveContext2D::Submit(const raster::Command& cmd) {
+            if (m_TrackDirty) {
+                i32 x0, y0, x1, y1;
+                if (raster::Bounds(cmd, x0, y0, x1, y1)) {
+                    x0 = math::max(x0, 0);
+                    y0 = math::max(y0, 0);
+                    x1 = math::min(x1, (i32)m_Width);
+                    y1 = math::min(y1, (i32)m_Height);
+                    if (x1 > x0 && y1 > y0) m_Dirty.add({ x0, y0, x1 - x0, y1 - y0 });
                 }
             }
+
+            if (m_Deferred != nullptr) {
+                m_Deferred->Record(cmd);
+            }
             else {
-                for (i32 j = 0; j < height; ++j) {
-                    u32 startIndex = Index(x, y + j);
-                    u32 endIndex = Index(x + width, y + j);
+                raster::Execute(cmd, Target());
+            }
+        }
 
-                    if (startIndex == -1 && endIndex == -1) continue;
-                    if (y + j >= (i32)m_Height) return;
+        u32 PrimitiveContext2D::Index(i32 x, i32 y) {
+            if (x < 0 || y < 0 || x >= (i32)m_Width || y >= (i32)m_Height) return -1;
+            return (y * (i32)m_Width + x);
+        }
 
-                    if (startIndex == -1) {
-                        startIndex = Index(0, y + j);
-                    }
-                    else if (endIndex == -1) {
-                        endIndex = Index(m_Width - 1, y + j);
-                    }
+        void PrimitiveContext2D::Coordinate(u32 index, i32& x, i32& y) {
+            y = index / m_Width;
+            x = index & m_Width;
+        }
 
-                    std::fill(m_Pixels + startIndex, m_Pixels + endIndex, color);
-                }
-            }
+        void PrimitiveContext2D::Clear(const Color& col) {
+            Submit({ raster::Op::Clear, BlendMode::None, 0, 0, 0, 0, col, nullptr });
+        }
+        void PrimitiveContext2D::FillRect(i32 x, i32 y, i32 width, i32 height, const Color& color) {
+            AMOR_PROFILE_SCOPE("PrimitiveContext2D::FillRect");
+            Submit({ raster::Op::FillRect, m_BlendMode, x, y, width, height, color, nullptr });
         }
 
-        // stupid filled circle algorithm,
-        // find a better one
         void PrimitiveContext2D::FillCircle(i32 x, i32 y, i32 radius, const Color& color) {
-            i32 x1, y1, x2, y2;
-            i32 radius_squared;
-            i32 dx, dy;
-
-            x1 = x - radius;
-            y1 = y - radius;
-            x2 = x + radius;
-            y2 = y + radius;
-            radius_squared = radius * radius;
-            for (i32 i = x1; i < x2; i++) {
-                dx = (i - x);
-                for (i32 j = y1; j < y2; j++) {
-                    dy = (j - y);
-                    if (dx*dx + dy*dy < radius_squared - radius) (*this.*DrawI)(i, j, color);
-                }
-            }
+            Submit({ raster::Op::FillEllipse, m_BlendMode, x, y, radius, radius, color, nullptr });
         }
 
-        inline void Plot8(PrimitiveContext2D* ctx, i32 xc, i32 yc, i32 x, i32 y, const Color& color) {
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc+x, yc+y, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc-x, yc+y, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc+x, yc-y, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc-x, yc-y, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc+y, yc+x, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc-y, yc+x, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc+y, yc-x, color);
-            /*ctx->Draw*/ (*ctx.*(ctx->DrawI))(xc-y, yc-x, color);
+        void PrimitiveContext2D::FillEllipse(i32 x, i32 y, i32 radiusX, i32 radiusY, const Color& color) {
+            Submit({ raster::Op::FillEllipse, m_BlendMode, x, y, radiusX, radiusY, color, nullptr });
         }
 
         // Draw Rect
         void PrimitiveContext2D::DrawRect(i32 x, i32 y, i32 width, i32 height, const Color& color) {
-            // basic approach
-            if ((int)m_BlendMode) {
-                DrawLine(x, y, x + width, y, color);
-                DrawLine(x, y + height, x + width, y + height, color);
-                DrawLine(x, y + 1, x, y + height - 1, color);
-                DrawLine(x + width, y + 1, x + width, y + height - 1, color);
-            }
-            else {
-                std::fill(m_Pixels + Index(x, y), m_Pixels + Index(x + width + 1, y), color);
-                std::fill(m_Pixels + Index(x, y + height), m_Pixels + Index(x + width + 1, y + height), color);
-                for (i32 j = 1; j < height; j++) {
-                    m_Pixels[Index(x, y + j)] = color;
-                    m_Pixels[Index(x + width, y + j)] = color; // maybe -1 needed here? not sure
-                }
-            }
+            // both edges are inclusive (same as drawing the four lines)
+            FillRect(x, y, width + 1, 1, color);
+            FillRect(x, y + height, width + 1, 1, color);
+            FillRect(x, y + 1, 1, height - 1, color);
+            FillRect(x + width, y + 1, 1, height - 1, color);
         }
 
-        // bresenham's circle algorithm
         void PrimitiveContext2D::DrawCircle(i32 x, i32 y, i32 radius, const Color& color) {
-            int xx = 0;
-            int yy = radius;
-            int d = 3 - (2 * radius);
-            Plot8(this, x, y, xx, yy, color);
-
-            while (yy >= xx) {
-                xx++;
-
-                if (d > 0) {
-                    --yy;
-                    d = d + 4 * (xx - yy) + 10;
-                }
-                else {
-                    d = d + 4 * xx + 6;
-                }
-                
-                Plot8(this, x, y, xx, yy, color);
-            }
+            Submit({ raster::Op::DrawCircle, m_BlendMode, x, y, radius, 0, color, nullptr });
         }
 
-        // Bresenham's Line algorithm
         void PrimitiveContext2D::DrawLine(i32 x1, i32 y1, i32 x2, i32 y2, const Color& color) {
-            i32 x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
-            dx = x2 - x1;
-            dy = y2 - y1;
-            dx1 = (i32)fabs(dx);
-            dy1 = (i32)fabs(dy);
-            px = 2 * dy1 - dx1;
-            py = 2 * dx1 - dy1;
-
-            if (dy1 <= dx1) {
-                if (dx >= 0) {
-                    x = x1;
-                    y = y1;
-                    xe = x2;
-                }
-                else {
-                    x = x2;
-                    y = y2;
-                    xe = x1;
-                }
-
-                (*this.*DrawI)(x, y, color);
-                for (i = 0; x < xe; ++i) {
-                    ++x;
-                    if (px < 0) {
-                        px = px + 2 * dy1;
-                    }
-                    else {
-                        if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) {
-                            ++y;
-                        }
-                        else {
-                            --y;
-                        }
-                        px = px + 2 * (dy1 - dx1);
-                    }
-                    (*this.*DrawI)(x, y, color);
-                }
-            }
-            else {
-                if (dy >= 0) {
-                    x = x1;
-                    y = y1;
-                    ye = y2;
-                }
-                else {
-                    x = x2;
-                    y = y2;
-                    ye = y1;
-                }
-                (*this.*DrawI)(x, y, color);
-                for (i = 0; y < ye; ++i) {
-                    ++y;
-                    if (py <= 0) {
-                        py = py + 2 * dx1;
-                    }
-                    else {
-                        if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) {
-                            ++x;
-                        }
-                        else {
-                            --x;
-                        }
-                        py = py + 2 * (dx1 - dy1);
-                    }
-                    (*this.*DrawI)(x, y, color);
-                }
-            }
+            Submit({ raster::Op::DrawLine, m_BlendMode, x1, y1, x2, y2, color, nullptr });
         }
 
         void PrimitiveContext2D::Draw(i32 x, i32 y, const Color& color) {
-            u32 index = Index(x, y);
-            if (index == -1) return;
-            m_Pixels[index] = color;
-        }
+            if (m_Deferred != nullptr) {
+                Submit({ raster::Op::Plot, BlendMode::None, x, y, 0, 0, color, nullptr });
+                return;
+            }
 
-        void PrimitiveContext2D::DrawB(i32 x, i32 y, const Color& src) {
             u32 index = Index(x, y);
             if (index == -1) return;
+            m_Pixels[index] = color;
 
-            Color& dest = m_Pixels[index];
-            m_Pixels[index] = (*this.*m_BlendFunc)(src, dest);
+            if (m_TrackDirty) {
+                TrackPlot(x, y);
+            }
         }
 
         Color PrimitiveContext2D::Get(i32 x, i32 y) {
+            Flush();
+
             u32 index = Index(x, y);
             if (index == -1) return { 0, 0, 0, 0 };
             return m_Pixels[index];
@@ -687,103 +987,20 @@ namespace amor {
 
         void PrimitiveContext2D::BlitUpscaled(i32 x, i32 y, const Texture& tex, i32 scaleX, i32 scaleY) {
             if (x >= (i32)m_Width || y >= (i32)m_Height) return;
-
-            i32 x2 = x + (tex.width() * scaleX);
-            i32 y2 = y + (tex.height() * scaleY);
-
-            // todo: Implove performance by calculating bounds like regular blit
-            Color* data = tex.data();
-
-            i32 drawX = x;
-            i32 drawY = y;
-            for (i32 pi = 0; pi < (i32)tex.width(); ++pi) {
-                for (i32 pj = 0; pj < (i32)tex.height(); ++pj) {
-                    FillRect(drawX, drawY, scaleX, scaleY, data[pi + pj * (i32)tex.width()]);
-                    drawY += scaleY;
-                }
-                drawX += scaleX;
-                drawY = y;
-            }
+            Submit({ raster::Op::BlitUpscaled, TextureBlendMode(tex), x, y, scaleX, scaleY, {}, &tex });
         }
 
         void PrimitiveContext2D::Blit(i32 x, i32 y, const Texture& tex) {
-            if (x >= (i32)m_Width || y >= (i32)m_Height) return;
-
-            // internal texture bounds
-            amor::math::Rect bounds{ (i32)tex.width(), (i32)tex.height()};
-            
-            if (x < 0) {
-                bounds.width += x;
-                bounds.x = -x;
-                x = 0;
-            }
-            if (y < 0) {
-                bounds.height += y;
-                bounds.y = -y;
-                y = 0;
-            }
-
-            if (x + bounds.width >= (i32)m_Width) {
-                bounds.width -= (x + bounds.width) - (i32)m_Width;
-            }
-            if (y + bounds.height >= (i32)m_Height) {
-                bounds.height -= (y + bounds.height) - (i32)m_Height;
-            }
-
-            Color* data = tex.data();
-
-            if ((int)m_BlendMode) {
-                for (i32 i = bounds.x; i < bounds.x2(); i++) {
-                    for (i32 j = bounds.y; j < bounds.y2(); j++) {
-                        DrawB(i, j, data[i + j * tex.width()]);
-                    }
-                }
-            }
-            else {
-                // j is the internal row
-                for (i32 j = bounds.y; j < bounds.y2(); ++j) {
-                    u32 textureRowOffset = j * tex.width();
-                    u32 myRowOffset = (y + j) * m_Width;
-
-                    std::copy(data + textureRowOffset + bounds.x, data + textureRowOffset + bounds.x2(), m_Pixels + myRowOffset + x);
-                }
-            }
+            AMOR_PROFILE_SCOPE("PrimitiveContext2D::Blit");
+            Submit({ raster::Op::Blit, TextureBlendMode(tex), x, y, 0, 0, {}, &tex });
         }
 
         void PrimitiveContext2D::BlitCutout(i32 x, i32 y, const Texture& tex, const Color& color) {
-            if (x >= (i32)m_Width || y >= (i32)m_Height) return;
-            // internal texture bounds
-            amor::math::Rect bounds{ (i32)tex.width(), (i32)tex.height() };
-
-            if (x < 0) {
-                bounds.width += x;
-                bounds.x = -x;
-                x = 0;
-            }
-            if (y < 0) {
-                bounds.height += y;
-                bounds.y = -y;
-                y = 0;
-            }
-
-            if (x + bounds.width >= (i32)m_Width) {
-                bounds.width -= (x + bounds.width) - (i32)m_Width;
-            }
-            if (y + bounds.height >= (i32)m_Height) {
-                bounds.height -= (y + bounds.height) - (i32)m_Height;
-            }
-
-            Color* data = tex.data();
-
-            for (i32 i = bounds.x; i < bounds.x2(); i++) {
-                for (i32 j = bounds.y; j < bounds.y2(); j++) {
-                    if (data[i + j * tex.width()] == color) continue;
-                    CLASS_INVOKE(*this, DrawI, x + i, y + j, data[i + j * tex.width()]);
-                }
-            }
+            Submit({ raster::Op::BlitCutout, m_BlendMode, x, y, 0, 0, color, &tex });
         }
 
         void PrimitiveContext2D::DrawText(i32 x, i32 y, const std::string& message, Font& font) {
+            AMOR_PROFILE_SCOPE("PrimitiveContext2D::DrawText");
             int cursorX, cursorY;
             cursorX = x;
             cursorY = y;
@@ -809,6 +1026,181 @@ namespace amor {
             }
         }
 
+#pragma endregion
+#pragma region raster::Command
+
+        namespace raster {
+
+            static void FillRectOn(const Surface& s, i32 x, i32 y, i32 width, i32 height, const Color& color, BlendMode mode) {
+                math::Rect dest{ x, y, width, height };
+                i32 srcX = 0, srcY = 0;
+                if (!clip_rect(s, dest, srcX, srcY)) return;
+
+                // BlendMode::None maps onto the plain fill kernel
+                kernels::BlendFillFn fill = kernels::Active().blend_fill[(u32)mode];
+                Color* row = &s.at(dest.x, dest.y);
+
+                for (i32 j = 0; j < dest.height; ++j, row += s.stride) {
+                    fill(row, color, (u32)dest.width);
+                }
+            }
+
+            static void BlitOn(const Surface& s, const Command& cmd) {
+                const Texture& tex = *cmd.texture;
+                math::Rect dest{ cmd.x, cmd.y, (i32)tex.width(), (i32)tex.height() };
+                i32 srcX = 0, srcY = 0;
+                if (!clip_rect(s, dest, srcX, srcY)) return;
+
+                // BlendMode::None maps onto the plain copy kernel
+                kernels::BlendSpanFn blend = kernels::Active().blend[(u32)cmd.mode];
+                const Color* src = tex.data() + (size_t)srcY * tex.width() + srcX;
+                Color* row = &s.at(dest.x, dest.y);
+
+                for (i32 j = 0; j < dest.height; ++j, src += tex.width(), row += s.stride) {
+                    blend(row, src, (u32)dest.width);
+                }
+            }
+
+            static void BlitCutoutOn(const Surface& s, const Command& cmd) {
+                const Texture& tex = *cmd.texture;
+                math::Rect dest{ cmd.x, cmd.y, (i32)tex.width(), (i32)tex.height() };
+                i32 srcX = 0, srcY = 0;
+                if (!clip_rect(s, dest, srcX, srcY)) return;
+
+                const Color* src = tex.data() + (size_t)srcY * tex.width() + srcX;
+
+                if ((int)cmd.mode) {
+                    // already clipped to the target
+                    dispatch(cmd.mode, s, false, [&](const auto& w) {
+                        blit_cutout(w, dest.x, dest.y, src, (i32)tex.width(), dest.width, dest.height, cmd.color);
+                    });
+                }
+                else {
+                    const kernels::SpanKernels& k = kernels::Active();
+                    Color* row = &s.at(dest.x, dest.y);
+
+                    for (i32 j = 0; j < dest.height; ++j, src += tex.width(), row += s.stride) {
+                        k.copy_keyed(row, src, (u32)dest.width, cmd.color);
+                    }
+                }
+            }
+
+            static void BlitUpscaledOn(const Surface& s, const Command& cmd) {
+                const Texture& tex = *cmd.texture;
+                const i32 scaleX = cmd.a, scaleY = cmd.b;
+                if (scaleX <= 0 || scaleY <= 0) return;
+
+                // only visit the texels that land inside the surface
+                i32 pi0 = math::max(0, (s.x0 - cmd.x) / scaleX);
+                i32 pj0 = math::max(0, (s.y0 - cmd.y) / scaleY);
+                i32 pi1 = math::min((i32)tex.width(), (s.x1 - cmd.x + scaleX - 1) / scaleX);
+                i32 pj1 = math::min((i32)tex.height(), (s.y1 - cmd.y + scaleY - 1) / scaleY);
+
+                const Color* data = tex.data();
+                for (i32 pj = pj0; pj < pj1; ++pj) {
+                    for (i32 pi = pi0; pi < pi1; ++pi) {
+                        FillRectOn(s, cmd.x + pi * scaleX, cmd.y + pj * scaleY, scaleX, scaleY, data[pi + pj * (i32)tex.width()], cmd.mode);
+                    }
+                }
+            }
+
+            void Execute(const Command& cmd, const Surface& s) {
+                switch (cmd.op) {
+                case Op::Clear:
+                    FillRectOn(s, s.x0, s.y0, s.x1 - s.x0, s.y1 - s.y0, cmd.color, BlendMode::None);
+                    break;
+                case Op::Plot:
+                    if (s.contains(cmd.x, cmd.y)) s.at(cmd.x, cmd.y) = cmd.color;
+                    break;
+                case Op::FillRect:
+                    FillRectOn(s, cmd.x, cmd.y, cmd.a, cmd.b, cmd.color, cmd.mode);
+                    break;
+                case Op::FillEllipse:
+                    fill_ellipse(s, kernels::Active().blend_fill[(u32)cmd.mode], cmd.x, cmd.y, cmd.a, cmd.b, cmd.color);
+                    break;
+                case Op::DrawCircle: {
+                    // radius 0 steps one pixel past the radius before the loop ends
+                    i32 r = std::abs(cmd.a) + 1;
+                    bool clip = !s.contains(cmd.x - r, cmd.y - r, cmd.x + r, cmd.y + r);
+
+                    dispatch(cmd.mode, s, clip, [&](const auto& w) {
+                        circle(w, cmd.x, cmd.y, cmd.a, cmd.color);
+                    });
+                    break;
+                }
+                case Op::DrawLine: {
+                    bool clip = !s.contains(math::min(cmd.x, cmd.a), math::min(cmd.y, cmd.b), math::max(cmd.x, cmd.a), math::max(cmd.y, cmd.b));
+
+                    dispatch(cmd.mode, s, clip, [&](const auto& w) {
+                        line(w, cmd.x, cmd.y, cmd.a, cmd.b, cmd.color);
+                    });
+                    break;
+                }
+                case Op::Blit:
+                    BlitOn(s, cmd);
+                    break;
+                case Op::BlitCutout:
+                    BlitCutoutOn(s, cmd);
+                    break;
+                case Op::BlitUpscaled:
+                    BlitUpscaledOn(s, cmd);
+                    break;
+                }
+            }
+
+            void ExecuteCircle(const Command& cmd, const Surface& s, const i32* octant, u32 count) {
+                i32 r = std::abs(cmd.a) + 1;
+                bool clip = !s.contains(cmd.x - r, cmd.y - r, cmd.x + r, cmd.y + r);
+
+                dispatch(cmd.mode, s, clip, [&](const auto& w) {
+                    circle_clipped(w, cmd.x, cmd.y, octant, count, cmd.color);
+                });
+            }
+
+            bool Bounds(const Command& cmd, i32& x0, i32& y0, i32& x1, i32& y1) {
+                switch (cmd.op) {
+                case Op::Clear:
+                    x0 = y0 = INT32_MIN;
+                    x1 = y1 = INT32_MAX;
+                    return true;
+                case Op::Plot:
+                    x0 = cmd.x; y0 = cmd.y;
+                    x1 = cmd.x + 1; y1 = cmd.y + 1;
+                    return true;
+                case Op::FillRect:
+                    x0 = cmd.x; y0 = cmd.y;
+                    x1 = cmd.x + cmd.a; y1 = cmd.y + cmd.b;
+                    break;
+                case Op::FillEllipse:
+                    x0 = cmd.x - cmd.a; y0 = cmd.y - cmd.b;
+                    x1 = cmd.x + cmd.a + 1; y1 = cmd.y + cmd.b + 1;
+                    break;
+                case Op::DrawCircle: {
+                    i32 r = std::abs(cmd.a) + 1;
+                    x0 = cmd.x - r; y0 = cmd.y - r;
+                    x1 = cmd.x + r + 1; y1 = cmd.y + r + 1;
+                    break;
+                }
+                case Op::DrawLine:
+                    x0 = math::min(cmd.x, cmd.a); y0 = math::min(cmd.y, cmd.b);
+                    x1 = math::max(cmd.x, cmd.a) + 1; y1 = math::max(cmd.y, cmd.b) + 1;
+                    break;
+                case Op::Blit:
+                case Op::BlitCutout:
+                    x0 = cmd.x; y0 = cmd.y;
+                    x1 = cmd.x + (i32)cmd.texture->width(); y1 = cmd.y + (i32)cmd.texture->height();
+                    break;
+                case Op::BlitUpscaled:
+                    x0 = cmd.x; y0 = cmd.y;
+                    x1 = cmd.x + (i32)cmd.texture->width() * cmd.a; y1 = cmd.y + (i32)cmd.texture->height() * cmd.b;
+                    break;
+                default:
+                    return false;
+                }
+                return x1 > x0 && y1 > y0;
+            }
+        }
+
 #pragma endregion
 #pragma region PixelFont
         Font::~Font() {}
@@ -63,6 +63,13 @@
 #include "Common.h"
 #include "Core.h"
 #include "Util.h"
+#include "FrameProfiler.h"
+#include "FramePacer.h"
+#include "Memory.h"
+#include "Pxim.h"
+
+#include <atomic>
+#include <thread>
 
 struct GLFWwindow;
 struct GLFWmonitor;
@@ -105,8 +112,15 @@ namespace amor {
 		enum class BlendMode {
 			None = 0,
 			Normal,
+			Additive,
+			Multiply,
+			Screen,
+			// source colors are already multiplied by their alpha (see Texture::premultiply)
+			PremultipliedOver,
 		};
 
+		constexpr u32 BLEND_MODE_COUNT = 6;
+
 		constexpr u32 BASE_FONT_SIZE = 12;
 
 
@@ -139,15 +153,48 @@ namespace amor {
 			Texture* m_TextureAtlas[256];
 		};
 
+		namespace raster {
+			struct Surface;
+			struct Command;
+			class TileRasterizer;
+		}
+
+		/*
+			Small set of rectangles covering everything written since the last clear().
+			Overlapping rectangles are merged, once MAX_RECTS is reached the new one is merged
+			into whichever rectangle grows the least. The covered area only ever grows, so it
+			may include pixels that weren't written but never misses one that was.
+		*/
+		class DirtyRegion {
+		public:
+			static constexpr u32 MAX_RECTS = 8;
+
+			void add(const math::Rect& rect);
+			inline void clear() { m_Count = 0; }
+			inline bool empty() const { return m_Count == 0; }
+
+			inline const math::Rect* begin() const { return m_Rects; }
+			inline const math::Rect* end() const { return m_Rects + m_Count; }
+			inline u32 size() const { return m_Count; }
+
+		private:
+			math::Rect m_Rects[MAX_RECTS];
+			u32 m_Count = 0;
+		};
+
 		class PrimitiveContext2D {
-			friend void Plot8(PrimitiveContext2D*, i32, i32, i32, i32, const Color&);
 		public:
 			PrimitiveContext2D(u32 width, u32 height, Color* buffer);
+			// copies start out in immediate mode, the deferred state is never shared
+			PrimitiveContext2D(const PrimitiveContext2D& other);
+			PrimitiveContext2D& operator=(const PrimitiveContext2D& other);
+			// pending deferred commands are discarded, not drawn. The buffer may already be gone
 			~PrimitiveContext2D();
 
 			void Clear(const Color& col);
 			void FillRect(i32 x, i32 y, i32 width, i32 height, const Color& color);
 			void FillCircle(i32 x, i32 y, i32 radius, const Color& color);
+			void FillEllipse(i32 x, i32 y, i32 radiusX, i32 radiusY, const Color& color);
 			void DrawRect(i32 x, i32 y, i32 width, i32 height, const Color& color);
 			void DrawCircle(i32 x, i32 y, i32 radius, const Color& color);
 			void DrawLine(i32 x1, i32 y1, i32 x2, i32 y2, const Color& color);
@@ -159,22 +206,73 @@ namespace amor {
 
 			void SetBlending(BlendMode mode);
 
+			/*
+				Deferred mode records draw calls instead of drawing them. Flush bins them into
+				tileSize x tileSize tiles and rasterizes the tiles in parallel on the shared job
+				system (threads = 1 keeps it on the calling thread). Textures and fonts passed to draw calls must stay alive and
+				unchanged until the next Flush. Turning deferred mode off flushes.
+			*/
+			void SetDeferred(bool deferred, u32 tileSize = 64, u32 threads = 0);
+			inline bool IsDeferred() const { return m_Deferred != nullptr; }
+			void Flush();
+
+			// flushes first when deferred
 			Color Get(i32 x, i32 y);
 
-			inline Color* Data() { return m_Pixels; }
+			/*
+				Dirty tracking records the area touched by every draw call so a renderer can
+				upload only what changed. Off by default.
+				Data() hands out a writable pointer, so with tracking on the whole target is
+				marked dirty when it is called. Use MarkDirty for writes done some other way.
+			*/
+			void SetDirtyTracking(bool track);
+			inline bool IsDirtyTracking() const { return m_TrackDirty; }
+			void MarkDirty(const math::Rect& rect);
+			inline const DirtyRegion& Dirty() {
+				FoldPlots();
+				return m_Dirty;
+			}
+			inline void ClearDirty() {
+				m_Dirty.clear();
+				m_PlotX1 = m_PlotX0;
+			}
+
+			Color* Data();
 			inline u32 width() const { return m_Width; }
 			inline u32 height() const { return m_Height; }
 
-		private:
-			// draw blended
-			void DrawB(i32 x, i32 y, const Color& color);
-
 		private:
 			u32 Index(i32 x, i32 y);
 			void Coordinate(u32 index, i32& x, i32& y);
 
-		private:
-			Color Blend(const Color& src, const Color& dest);
+			// mode used to draw the texture, accounts for premultiplied textures
+			BlendMode TextureBlendMode(const Texture& tex) const;
+
+			// whole context as a rasterizer target, see Raster.h
+			raster::Surface Target() const;
+
+			// executes cmd now or records it when deferred
+			void Submit(const raster::Command& cmd);
+
+			// single pixels don't go through Submit, they grow a box around the pixels plotted near each
+			// other. A pixel further than PLOT_REACH from it moves the box into m_Dirty and starts a new one
+			static constexpr i32 PLOT_REACH = 32;
+			inline void TrackPlot(i32 x, i32 y) {
+				if (m_PlotX1 > m_PlotX0 && x >= m_PlotX0 - PLOT_REACH && x < m_PlotX1 + PLOT_REACH &&
+						y >= m_PlotY0 - PLOT_REACH && y < m_PlotY1 + PLOT_REACH) {
+					m_PlotX0 = math::min(m_PlotX0, x);
+					m_PlotY0 = math::min(m_PlotY0, y);
+					m_PlotX1 = math::max(m_PlotX1, x + 1);
+					m_PlotY1 = math::max(m_PlotY1, y + 1);
+					return;
+				}
+				FoldPlots();
+				m_PlotX0 = x;
+				m_PlotY0 = y;
+				m_PlotX1 = x + 1;
+				m_PlotY1 = y + 1;
+			}
+			void FoldPlots();
 
 		protected:
 			Color* m_Pixels;
@@ -184,14 +282,22 @@ namespace amor {
 			u32 m_BufferLength;
 			
 			BlendMode m_BlendMode = BlendMode::None;
-			Color(amor::graphics::PrimitiveContext2D::*m_BlendFunc)(const Color&, const Color&);
-			void(amor::graphics::PrimitiveContext2D::*DrawI)(i32, i32, const Color&) = &PrimitiveContext2D::Draw;
+			raster::TileRasterizer* m_Deferred = nullptr;
+
+			bool m_TrackDirty = false;
+			DirtyRegion m_Dirty;
+			// box of the pixels plotted since the last FoldPlots, x1 and y1 exclusive. Empty while x1 <= x0
+			i32 m_PlotX0 = 0, m_PlotY0 = 0, m_PlotX1 = 0, m_PlotY1 = 0;
 		};
 
 		class Texture {
 		public:
 			Texture();
 			Texture(u32 width, u32 height);
+			// pixels come from allocator and go back to it with the texture (or with the allocator, an Arena
+			// reset takes them along). The allocator has to outlive the texture
+			Texture(u32 width, u32 height, util::Allocator& allocator);
+			// decodes the image with stb_image on the calling thread, see TextureLoader for loading in the background
 			Texture(const char* path);
 			~Texture();
 
@@ -201,15 +307,45 @@ namespace amor {
 			u32 height() const;
 			Color* data() const;
 
-			void save(const char* filename);
-			void load(const char* filename);
+			// PXIM files, see Pxim.h. save writes the current version, load reads any. Both spread the
+			// tiles over the shared job system, load with threads = 1 decodes on the calling thread only
+			void save(const char* filename, pxim::Compression compression = pxim::Compression::Default);
+			void load(const char* filename, u32 threads = 0);
+			// only the region of the file's image (which it has to lie in) becomes the texture
+			void load_region(const char* filename, const math::Rect& region);
+
+			// mappable PXIM files (see Pxim.h) are used in place: the texture's pixels are the file's pages,
+			// mapped until the texture lets go of them. load maps them copy on write, so the texture
+			// behaves as if it read them. With Mode::Read writing the pixels faults, that's for textures that
+			// are only ever drawn from. Files that aren't mappable can't be mapped and are left alone
+			void save_mappable(const char* filename);
+			void map(const char* filename, util::MappedFile::Mode mode = util::MappedFile::Mode::CopyOnWrite);
+
+			// converts the pixels to premultiplied alpha and flags the texture as such.
+			// Blitting a premultiplied texture with BlendMode::Normal uses PremultipliedOver
+			void premultiply();
+			bool is_premultiplied() const;
+			void set_premultiplied(bool premultiplied);
+
+		private:
+			// pixels for width x height from the texture's allocator, releasing the previous ones
+			void allocate_pixels(u32 width, u32 height);
+			void release_pixels();
+			bool map_pixels(const char* filename, const pxim::Reader& reader, util::MappedFile::Mode mode);
 
 		private:
 			bool m_ImageLoaded;
+			bool m_Premultiplied = false;
 			u32 m_Width, m_Height;
 			Color* m_Pixels;
+			// nullptr for new[] (or stb_image when m_ImageLoaded)
+			util::Allocator* m_Allocator = nullptr;
+			// the file m_Pixels point into when they're mapped
+			util::MappedFile* m_Mapping = nullptr;
 		};
 
+		class TextureLoader;
+
 		class Sprite {
 
 		};
@@ -238,6 +374,12 @@ namespace amor {
 
 			void show();
 
+			// runs the application without creating a window: OnUserInit, then frames of OnUserUpdate and
+			// OnUserRender against the renderer, then OnUserDeinit. The renderer has to be headless (see
+			// HeadlessRenderer). frames = 0 runs until OnUserUpdate returns false. Updates get a fixed delta
+			// so runs are reproducible. Input reports nothing pressed
+			void run_headless(u64 frames = 0, double delta = 1.0 / 60.0);
+
 			i32 get_display_count() const;
 			void center_on_display(i32 displayNo = PRIMARY_MONITOR);
 			void fullscreen_on_display(bool fullscreen, i32 displayNo = PRIMARY_MONITOR);
@@ -248,6 +390,58 @@ namespace amor {
 
 			double fps() const;
 
+			// fixed timestep mode: OnUserUpdate runs ticksPerSecond times per second of real time with a constant
+			// delta, as many ticks per frame as the elapsed time calls for (at most maxTicksPerFrame, time beyond
+			// that is dropped so a long hitch doesn't spiral). Rendering gets the fraction of a tick left over as
+			// interpolation alpha. 0 goes back to one variable delta update per frame
+			void set_fixed_timestep(u32 ticksPerSecond, u32 maxTicksPerFrame = 8);
+			inline u32 fixed_timestep() const { return m_TicksPerSecond; }
+
+			// how far between the last and the next simulation tick the current frame is, [0, 1). Always 1 without
+			// a fixed timestep
+			inline double interpolation_alpha() const { return m_RenderAlpha; }
+
+			// threaded mode: OnUserUpdate runs on a worker thread while the main thread renders the previous
+			// update, so simulation and rendering overlap instead of adding up. Every frame the main thread
+			// waits for the running update, samples input and calls OnUserHandoff with both sides stopped,
+			// then starts the next update and renders. OnUserRender may only read what was handed off
+			// (see util::DoubleBuffer). The fixed timestep still applies, on the update thread. Has to be
+			// set before show(), headless runs stay serial so they remain reproducible
+			void set_threaded_update(bool threaded);
+			inline bool is_threaded_update() const { return m_ThreadedUpdate; }
+
+			// caps the main loop to fps frames per second (sleeping, then spinning for the last bit), 0 runs
+			// uncapped. Useful when vsync is off or the driver ignores it
+			void set_target_fps(double fps);
+			double target_fps() const;
+
+			// glfwSwapInterval for the window: 0 no vsync, 1 vsync, -1 adaptive where supported. Applied when
+			// the window is shown if it's set before. Left to the driver default unless set
+			void set_swap_interval(i32 interval);
+
+			// idle mode for tool style windows: once a few frames passed without a request_redraw the loop blocks
+			// in glfwWaitEventsTimeout until input arrives (or timeoutSeconds pass) instead of running frames.
+			// Time spent blocked isn't passed on to OnUserUpdate
+			void set_idle_mode(bool enabled, double timeoutSeconds = 0.5);
+			inline bool is_idle_mode() const { return m_IdleMode; }
+
+			// keeps frames running in idle mode, call it every update while something animates
+			inline void request_redraw() { m_RedrawRequested.store(true, std::memory_order_relaxed); }
+
+			// per stage timings of the last frames, enabled by default
+			util::FrameProfiler& profiler();
+
+			// scratch memory for the current frame, freed all at once when the next frame starts. The update
+			// thread has its own arena in threaded mode, so it's usable from OnUserUpdate and OnUserRender
+			// alike (the update arena lives until after OnUserHandoff). Only for the loop threads, and
+			// nothing allocated from it may be kept past the frame
+			util::Arena& frame_arena();
+
+			// loads textures in the background, finished loads are delivered on the main thread between updates
+			// (the update thread is stopped then in threaded mode), so their callbacks can register textures. See
+			// TextureLoader
+			TextureLoader& texture_loader();
+
 			const amor::math::Rect& size() const;
 			GLFWwindow* internal_ptr() const;
 			input::Input* input() const;
@@ -256,6 +450,12 @@ namespace amor {
 			virtual void OnUserDeinit();
 			virtual bool OnUserUpdate(double);
 			virtual void OnUserRender(RendererBase*);
+			// called instead of OnUserRender(RendererBase*) by the main loop, defaults to forwarding to it.
+			// Override this one to blend between the previous and current simulation state by alpha
+			virtual void OnUserRender(RendererBase*, double alpha);
+			// runs between the update and the render of every frame. In threaded mode it's on the main thread
+			// while the update thread is stopped, publish the state the render needs here. Defaults to no action
+			virtual void OnUserHandoff();
 
 		protected:
 			bool m_CloseOnExit = true;
@@ -268,6 +468,13 @@ namespace amor {
 
 		private:
 			void main_loop();
+			// runs OnUserUpdate for the frame, returns false when the client asked to exit
+			bool update(u64 frameNs);
+
+			void update_thread();
+			// blocks until the update started last has finished
+			void wait_for_update();
+			void stop_update_thread();
 
 		private:
 			GLFWmonitor* select_monitor(i32 monitor) const;
@@ -275,9 +482,38 @@ namespace amor {
 		private:
 			GLFWwindow* m_WindowHandle;
 			RendererBase* m_RendererHandle;
+			// false when glfw couldn't be initialized (e.g. no display), only headless runs are possible then
+			bool m_GlfwReady = false;
 			util::Timer* m_Timer, *m_FpsTimer;
+			util::FrameProfiler* m_Profiler;
+			util::FramePacer* m_Pacer;
+			util::Arena* m_FrameArena, *m_UpdateArena;
+			TextureLoader* m_TextureLoader;
 			double m_Fps;
 			bool m_IsFullscreen = false;
+
+			u32 m_TicksPerSecond = 0, m_MaxTicksPerFrame = 8;
+			u64 m_TickNs = 0, m_Accumulator = 0;
+			double m_Alpha = 1.0, m_RenderAlpha = 1.0;
+
+			bool m_ThreadedUpdate = false;
+			std::thread m_UpdateThread;
+			// updates started by the main thread and finished by the update thread, the handoff is
+			// these two counters meeting
+			std::atomic<u64> m_UpdatesStarted{ 0 }, m_UpdatesFinished{ 0 };
+			std::atomic<bool> m_StopUpdates{ false };
+			u64 m_UpdateFrameNs = 0;
+			bool m_UpdateExit = false;
+
+			i32 m_SwapInterval = 0;
+			bool m_SwapIntervalSet = false;
+
+			// frames that still run in idle mode before the loop waits for events again
+			static constexpr u32 IDLE_GRACE_FRAMES = 3;
+			bool m_IdleMode = false;
+			std::atomic<bool> m_RedrawRequested{ true };
+			u32 m_IdleFrames = IDLE_GRACE_FRAMES;
+			double m_IdleTimeout = 0.5;
 		};
 
 		// base class for all renderers. This allows us to support a variety of renderers and rendering apis without having to change
@@ -306,6 +542,14 @@ namespace amor {
 			virtual void InitializeWindowGraphicsPipeline(WindowBase* window) = 0;
 			virtual void DeinitializeGraphicsPipeline(WindowBase* mainWindowHandle) = 0;
 
+			// true if the renderer works without a window and gl context, only those can be driven by WindowBase::run_headless.
+			// In a headless run the window is never created and every hook receives a window whose internal_ptr() is null
+			virtual bool IsHeadless() const;
+
+			// called at the very start of every frame, before input and OnUserUpdate. Defaults to no action.
+			// A renderer that lets the client write into memory the gpu may still be reading from waits for it here
+			virtual void BeginFrame(WindowBase* win);
+
 			// prepare frame is called before the client OnUserRender method is called. It defaults to clearing the color buffer to
 			// black zero-alpha. For 3d renderers this will need to be changed to also include the depth buffer, or any other pre-render
 			// setup you may need
@@ -6,7 +6,7 @@ namespace amor {
 
 		namespace ui {
 
-			EventDispatcher::EventDispatcher(WindowBase* window) {
+			EventDispatcher::EventDispatcher(WindowBase* window) : m_Window(window), m_Parent(nullptr) {
 
 			}
 			EventDispatcher::~EventDispatcher() {
@@ -15,20 +15,73 @@ namespace amor {
 
 			void EventDispatcher::update(input::Input& input) {
 				prepare_queue();
+				pump_events(input);
 
+				for (Event* event : m_FrameEventQueue) {
+					auto callback = m_Callbacks.find(event->type);
+					if (callback != m_Callbacks.end()) {
+						callback->second(event);
+					}
+				}
+			}
 
+			void EventDispatcher::prepare_queue() {
+				// last frame's events went with the frame arena
+				m_FrameEventQueue.clear();
+			}
 
+			void EventDispatcher::pump_events(input::Input& input) {
+				u64 timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 
-			}
+				u32 modifiers = 0;
+				if (input.key_check_pressed(input::Key::LeftShift) || input.key_check_pressed(input::Key::RightShift)) {
+					modifiers |= (u32)ModifierType::Shift;
+				}
+				if (input.key_check_pressed(input::Key::LeftControl) || input.key_check_pressed(input::Key::RightControl)) {
+					modifiers |= (u32)ModifierType::Control;
+				}
+				if (input.key_check_pressed(input::Key::LeftAlt) || input.key_check_pressed(input::Key::RightAlt)) {
+					modifiers |= (u32)ModifierType::Alt;
+				}
 
-			void EventDispatcher::prepare_queue() {
-				for (size_t i = 0; i < m_FrameEventQueue.size(); i++) {
-					if (m_FrameEventQueue[i] != nullptr) {
-						delete m_FrameEventQueue[i];
-						m_FrameEventQueue[i] = nullptr;
+				// a key event per key that went down or up this frame
+				for (u32 i = 0; i < (u32)input::Key::FIMKEY; ++i) {
+					input::Key key = (input::Key)i;
+					bool justPressed = input.key_check_just_pressed(key);
+					bool justReleased = input.key_check_just_released(key);
+					if (!justPressed && !justReleased) {
+						continue;
 					}
+
+					queue_event(KeyEvent{ { EventType::KeyEvent, timestamp, m_Parent }, key, input.key_check_pressed(key),
+						justPressed, justReleased, m_KeyboardTextBuffer, input.m_CurrentKeyFrame, modifiers });
+				}
+
+				math::Vec3f position = input.mouse_position();
+				math::Vec3f frameDelta = position - m_MousePreviousFrame;
+				m_MousePreviousFrame = position;
+
+				auto mouse_event = [&](input::MouseButton which, bool pressed, bool justPressed, bool justReleased) {
+					queue_event(MouseEvent{ { EventType::MouseEvent, timestamp, m_Parent }, which, pressed, justPressed, justReleased,
+						input.mouse_wheel(), input.m_CurrentMouseFrame, position, frameDelta, position - m_MousePreviousEvent });
+					m_MousePreviousEvent = position;
+				};
+
+				bool buttonChanged = false;
+				for (u32 i = 0; i < (u32)input::MouseButton::FIMKEY; ++i) {
+					input::MouseButton button = (input::MouseButton)i;
+					bool justPressed = input.mouse_check_just_pressed(button);
+					bool justReleased = input.mouse_check_just_released(button);
+					if (justPressed || justReleased) {
+						mouse_event(button, input.mouse_check_pressed(button), justPressed, justReleased);
+						buttonChanged = true;
+					}
+				}
+
+				// movement and scrolling without a button change, which is FIMKEY then
+				if (!buttonChanged && (frameDelta != math::Vec3f() || input.mouse_wheel() != 0)) {
+					mouse_event(input::MouseButton::FIMKEY, false, false, false);
 				}
-				m_FrameEventQueue.clear();
 			}
 
 			void EventDispatcher::set_parent_ptr(void* ptr) {
@@ -89,7 +89,16 @@ namespace amor {
 				void prepare_queue();
 				void pump_events(input::Input&);
 
+				// events only live for the frame they're dispatched in, they come from the window's frame arena
+				template<typename T> T* queue_event(const T& event) {
+					static_assert(std::is_trivially_destructible_v<T>, "queued events are never destroyed");
+					T* queued = m_Window->frame_arena().make<T>(event);
+					m_FrameEventQueue.push_back(queued);
+					return queued;
+				}
+
 			protected:
+				WindowBase* m_Window;
 				std::vector<Event*> m_FrameEventQueue;
 				std::unordered_map<EventType, Callback> m_Callbacks;
 				void* m_Parent;
@@ -0,0 +1,65 @@
+#include "pch.h"
+#include "HeadlessRenderer.h"
+
+namespace amor {
+    namespace graphics {
+
+        HeadlessRenderer::HeadlessRenderer(u32 width, u32 height) :
+                PrimitiveContext2D(width, height, nullptr), m_Frame(width, height),
+                m_FrameCount(0), m_FrameCallback{ [](u64, Texture&) {} }, m_DumpEvery(1) {
+
+            // PrimitiveContext2D handle to pixel data, owned by m_Frame
+            m_Pixels = m_Frame.data();
+        }
+
+        HeadlessRenderer::HeadlessRenderer(const Resolution& res) :
+                HeadlessRenderer(res.width, res.height) {
+
+        }
+
+        HeadlessRenderer::~HeadlessRenderer() {}
+
+        void HeadlessRenderer::SetFrameCallback(FrameCallback callback) {
+            m_FrameCallback = callback;
+        }
+
+        void HeadlessRenderer::DumpFrames(const std::string& directory, u32 every) {
+            m_DumpDirectory = directory;
+            m_DumpEvery = every ? every : 1;
+
+            if (!m_DumpDirectory.empty()) {
+                std::error_code error;
+                std::filesystem::create_directories(m_DumpDirectory, error);
+                if (error) {
+                    AMOR_LOG_ERROR("HeadlessRenderer", "Unable to create frame directory %s: %s", m_DumpDirectory.c_str(), error.message().c_str());
+                }
+            }
+        }
+
+        bool HeadlessRenderer::IsHeadless() const { return true; }
+
+        void HeadlessRenderer::InitializeGraphicsPipeline() {}
+        void HeadlessRenderer::InitializeWindowGraphicsPipeline(WindowBase* window) {
+            m_FrameCount = 0;
+        }
+        void HeadlessRenderer::DeinitializeGraphicsPipeline(WindowBase* window) {}
+
+        // nothing to clear, the client owns the framebuffer contents the same as with the PixelRenderer
+        void HeadlessRenderer::PrepareFrame(WindowBase* win) {}
+
+        void HeadlessRenderer::RenderFrame(WindowBase* win) {
+            Flush();
+
+            u64 frame = m_FrameCount++;
+            m_FrameCallback(frame, m_Frame);
+
+            if (!m_DumpDirectory.empty() && frame % m_DumpEvery == 0) {
+                char name[32];
+                snprintf(name, sizeof(name), "frame_%06llu.pxim", (unsigned long long)frame);
+                std::string path = (std::filesystem::path(m_DumpDirectory) / name).string();
+                m_Frame.save(path.c_str());
+            }
+        }
+
+    }
+}
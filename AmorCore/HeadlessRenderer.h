@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Graphics.h"
+#include <functional>
+
+namespace amor {
+	namespace graphics {
+
+		/*
+			Renderer without a window or a gl context. It draws into a cpu framebuffer like the
+			PixelRenderer does and hands every finished frame to a callback and/or writes it to disk.
+			Drive it with WindowBase::run_headless, this is meant for benchmarks and golden image tests
+			on machines without a display or gpu.
+
+			OnUserRender code that casts the renderer to PrimitiveContext2D works with both this and
+			the PixelRenderer.
+		*/
+		class HeadlessRenderer : public RendererBase, public PrimitiveContext2D {
+		public:
+			typedef std::function<void(u64 frame, Texture& image)> FrameCallback;
+
+			HeadlessRenderer(u32 width, u32 height);
+			HeadlessRenderer(const Resolution& res);
+			~HeadlessRenderer();
+
+			// called with every finished frame
+			void SetFrameCallback(FrameCallback callback);
+
+			// writes every nth frame to directory/frame_<number>.pxim. An empty directory turns it off
+			void DumpFrames(const std::string& directory, u32 every = 1);
+
+			inline u64 frame_count() const { return m_FrameCount; }
+			inline Texture& frame() { return m_Frame; }
+
+		public:
+			bool IsHeadless() const override;
+
+			void InitializeGraphicsPipeline() override;
+			void InitializeWindowGraphicsPipeline(WindowBase* window) override;
+			void DeinitializeGraphicsPipeline(WindowBase* window) override;
+
+			void PrepareFrame(WindowBase* win) override;
+			void RenderFrame(WindowBase* win) override;
+
+		private:
+			Texture m_Frame;
+			u64 m_FrameCount;
+			FrameCallback m_FrameCallback;
+			std::string m_DumpDirectory;
+			u32 m_DumpEvery;
+		};
+
+	}
+}
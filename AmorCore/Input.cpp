@@ -18,7 +18,10 @@ namespace amor{
 		}
 
 		Input::Input(amor::graphics::WindowBase* win) : m_Handle(win), m_WheelState(0.0) {
-			glfwSetScrollCallback(win->internal_ptr(), scroll_callback);
+			// headless runs have no window, every query reports nothing pressed
+			if (win->internal_ptr() != nullptr) {
+				glfwSetScrollCallback(win->internal_ptr(), scroll_callback);
+			}
 
 			for (u32 i = 0; i < (u32)Key::FIMKEY; i++) {
 				m_CurrentKeyFrame[i] = false;
@@ -37,6 +40,8 @@ namespace amor{
 			m_WheelState = previousYScroll;
 			previousYScroll = 0.0;
 
+			if (m_Handle->internal_ptr() == nullptr) return;
+
 
 			for (u32 i = 0; i < (u32)Key::FIMKEY; i++) {
 				if (!KeyEnumValues.contains(i)) continue;
@@ -48,20 +53,22 @@ namespace amor{
 				m_LastMouseFrame[i] = m_CurrentMouseFrame[i];
 				m_CurrentMouseFrame[i] = glfwGetMouseButton(m_Handle->internal_ptr(), i) == STATE_PRESSED;
 			}
+
+			glfwGetCursorPos(m_Handle->internal_ptr(), &m_MousePosition.x, &m_MousePosition.y);
 		}
 
 		bool Input::mouse_check_pressed(MouseButton button) const {
-			return glfwGetMouseButton(m_Handle->internal_ptr(), (int)button) == STATE_PRESSED;
+			return m_CurrentMouseFrame[(u32)button];
 		}
 		bool Input::mouse_check_released(MouseButton button) const {
-			return glfwGetMouseButton(m_Handle->internal_ptr(), (int)button) == STATE_RELEASED;
+			return !m_CurrentMouseFrame[(u32)button];
 		}
 
 		bool Input::key_check_pressed(Key key) const {
-			return glfwGetKey(m_Handle->internal_ptr(), (int)key) == STATE_PRESSED;
+			return m_CurrentKeyFrame[(u32)key];
 		}
 		bool Input::key_check_released(Key key) const {
-			return glfwGetKey(m_Handle->internal_ptr(), (int)key) == STATE_RELEASED;
+			return !m_CurrentKeyFrame[(u32)key];
 		}
 
 		bool Input::key_check_just_pressed(Key key) const {
@@ -83,9 +90,7 @@ namespace amor{
 		}
 
 		math::Vec3f Input::mouse_position() const {
-			math::Vec3f pos;
-			glfwGetCursorPos(m_Handle->internal_ptr(), &pos.x, &pos.y);
-			return pos;
+			return m_MousePosition;
 		}
 
 
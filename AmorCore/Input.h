@@ -8,6 +8,9 @@
 namespace amor {
 	namespace graphics {
 		class WindowBase;
+		namespace ui {
+			class EventDispatcher;
+		}
 	}
 
 
@@ -107,8 +110,12 @@ namespace amor {
 			FIMKEY
 		};
 
+		// state is sampled once per frame in Update, queries only read that sample. That keeps them consistent
+		// through a frame and lets a threaded update (WindowBase::set_threaded_update) read input without
+		// calling into glfw off the main thread
 		class Input {
 			friend class graphics::WindowBase;
+			friend class graphics::ui::EventDispatcher;
 		public:
 			Input(amor::graphics::WindowBase* win);
 			~Input();
@@ -144,6 +151,7 @@ namespace amor {
 		private:
 			amor::graphics::WindowBase* m_Handle;
 			double m_WheelState;
+			math::Vec3f m_MousePosition;
 			bool m_CurrentKeyFrame[(u32)Key::FIMKEY];
 			bool m_LastKeyFrame[(u32)Key::FIMKEY];
 
@@ -0,0 +1,334 @@
+#include "pch.h"
+#include "JobSystem.h"
+#include "Core.h"
+
+namespace amor {
+	namespace util {
+
+		static constexpr u32 NO_DEQUE = ~0u;
+		// idle rounds a thread yields through before it sleeps on the signal
+		static constexpr u32 SPIN_ROUNDS = 64;
+
+		struct JobSystem::Job {
+			std::function<void()> task;
+			Counter* counter;
+		};
+
+		/*
+			Chase-Lev deque over a fixed ring. Only the owning thread pushes and pops at the bottom,
+			any thread may steal from the top. The last job is raced for with a compare exchange on top.
+		*/
+		class JobSystem::WorkDeque {
+		public:
+			WorkDeque() : m_Top(0), m_Bottom(0) {
+				for (auto& job : m_Jobs) job.store(nullptr, std::memory_order_relaxed);
+			}
+
+			bool push(Job* job) {
+				i64 bottom = m_Bottom.load(std::memory_order_relaxed);
+				i64 top = m_Top.load(std::memory_order_acquire);
+				if (bottom - top >= (i64)DEQUE_CAPACITY) {
+					return false;
+				}
+
+				m_Jobs[bottom & (DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+				m_Bottom.store(bottom + 1, std::memory_order_release);
+				return true;
+			}
+
+			Job* pop() {
+				i64 bottom = m_Bottom.load(std::memory_order_relaxed) - 1;
+				m_Bottom.store(bottom, std::memory_order_seq_cst);
+				i64 top = m_Top.load(std::memory_order_seq_cst);
+
+				if (top > bottom) {
+					m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+
+				Job* job = m_Jobs[bottom & (DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+				if (top == bottom) {
+					// last one, a thief may be after it too
+					if (!m_Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+						job = nullptr;
+					}
+					m_Bottom.store(bottom + 1, std::memory_order_relaxed);
+				}
+				return job;
+			}
+
+			Job* steal() {
+				i64 top = m_Top.load(std::memory_order_seq_cst);
+				i64 bottom = m_Bottom.load(std::memory_order_seq_cst);
+				if (top >= bottom) {
+					return nullptr;
+				}
+
+				Job* job = m_Jobs[top & (DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+				if (!m_Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					return nullptr;
+				}
+				return job;
+			}
+
+		private:
+			std::atomic<i64> m_Top;
+			std::atomic<i64> m_Bottom;
+			std::atomic<Job*> m_Jobs[DEQUE_CAPACITY];
+		};
+
+		static_assert((JobSystem::DEQUE_CAPACITY & (JobSystem::DEQUE_CAPACITY - 1)) == 0, "deque capacity has to be a power of two");
+
+		static std::atomic<u64> s_NextSystemId{ 1 };
+
+		// deque of the calling thread in the system it was last used with
+		static thread_local u64 t_SystemId = 0;
+		static thread_local u32 t_Deque = NO_DEQUE;
+
+		JobSystem::JobSystem(u32 threads) :
+				m_Deques{}, m_DequeCount(0), m_Id(s_NextSystemId.fetch_add(1)), m_Signal(0), m_Quit(false) {
+
+			if (threads == 0) {
+				u32 hw = std::thread::hardware_concurrency();
+				threads = hw > 1 ? hw - 1 : 0;
+			}
+			else {
+				// the caller is one of the threads
+				--threads;
+			}
+			threads = math::min(threads, MAX_THREADS / 2);
+
+			// workers get the first deques so find_job can tell them apart
+			for (u32 i = 0; i < threads; ++i) {
+				m_Deques[i] = new WorkDeque();
+			}
+			m_DequeCount.store(threads, std::memory_order_release);
+
+			m_Workers.reserve(threads);
+			for (u32 i = 0; i < threads; ++i) {
+				m_Workers.emplace_back(&JobSystem::worker_main, this, i);
+			}
+		}
+
+		JobSystem::~JobSystem() {
+			m_Quit.store(true, std::memory_order_release);
+			m_Signal.fetch_add(1, std::memory_order_release);
+			m_Signal.notify_all();
+
+			for (auto& worker : m_Workers) {
+				worker.join();
+			}
+
+			// whatever is still queued was never waited on, run it so counters and captures settle.
+			// Continuations may queue more while doing so
+			for (bool ran = true; ran;) {
+				ran = false;
+				while (Job* job = find_job(NO_DEQUE)) {
+					execute(job);
+					ran = true;
+				}
+			}
+
+			u32 count = m_DequeCount.load(std::memory_order_acquire);
+			for (u32 i = 0; i < count; ++i) {
+				delete m_Deques[i];
+			}
+		}
+
+		JobSystem& JobSystem::Get() {
+			static JobSystem system;
+			return system;
+		}
+
+		u32 JobSystem::local_deque() {
+			if (t_SystemId == m_Id) {
+				return t_Deque;
+			}
+
+			std::lock_guard<std::mutex> lock(m_RegisterLock);
+
+			u32 deque;
+			auto found = m_Threads.find(std::this_thread::get_id());
+			if (found != m_Threads.end()) {
+				deque = found->second;
+			}
+			else {
+				deque = m_DequeCount.load(std::memory_order_relaxed);
+				if (deque < MAX_THREADS) {
+					m_Deques[deque] = new WorkDeque();
+					m_DequeCount.store(deque + 1, std::memory_order_release);
+				}
+				else {
+					logging::GetInstance()->warn("Too many threads submitting jobs, this one runs its jobs in place", "JobSystem");
+					deque = NO_DEQUE;
+				}
+				m_Threads[std::this_thread::get_id()] = deque;
+			}
+
+			t_SystemId = m_Id;
+			t_Deque = deque;
+			return deque;
+		}
+
+		void JobSystem::run(std::function<void()> task, Counter* counter) {
+			if (counter != nullptr) {
+				counter->m_Pending.fetch_add(1, std::memory_order_relaxed);
+			}
+			submit(new Job{ std::move(task), counter });
+		}
+
+		void JobSystem::run_after(Counter& dependency, std::function<void()> task, Counter* counter) {
+			if (counter != nullptr) {
+				counter->m_Pending.fetch_add(1, std::memory_order_relaxed);
+			}
+			Job* job = new Job{ std::move(task), counter };
+
+			{
+				std::lock_guard<std::mutex> lock(dependency.m_Lock);
+				if (dependency.m_Pending.load(std::memory_order_acquire) != 0) {
+					dependency.m_Continuations.push_back(job);
+					return;
+				}
+			}
+			submit(job);
+		}
+
+		void JobSystem::submit(Job* job) {
+			u32 deque = local_deque();
+			if (deque == NO_DEQUE || !m_Deques[deque]->push(job)) {
+				execute(job);
+				return;
+			}
+
+			m_Signal.fetch_add(1, std::memory_order_release);
+			m_Signal.notify_one();
+		}
+
+		void JobSystem::execute(Job* job) {
+			job->task();
+			Counter* counter = job->counter;
+			delete job;
+
+			if (counter != nullptr) {
+				finish(counter);
+			}
+		}
+
+		void JobSystem::finish(Counter* counter) {
+			u32 pending = counter->m_Pending.load(std::memory_order_relaxed);
+			while (pending > 1) {
+				if (counter->m_Pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+					return;
+				}
+			}
+
+			// last one out releases the continuations. Going to zero under the lock keeps run_after from
+			// adding to a list that was already taken
+			std::vector<Job*> continuations;
+			{
+				std::lock_guard<std::mutex> lock(counter->m_Lock);
+				continuations.swap(counter->m_Continuations);
+				counter->m_Pending.fetch_sub(1, std::memory_order_acq_rel);
+			}
+
+			// the counter may be gone from here on
+			for (Job* job : continuations) {
+				submit(job);
+			}
+		}
+
+		JobSystem::Job* JobSystem::find_job(u32 self) {
+			if (self != NO_DEQUE) {
+				if (Job* job = m_Deques[self]->pop()) {
+					return job;
+				}
+			}
+
+			u32 count = m_DequeCount.load(std::memory_order_acquire);
+			u32 start = self != NO_DEQUE ? self + 1 : 0;
+			for (u32 i = 0; i < count; ++i) {
+				u32 victim = (start + i) % count;
+				if (victim == self) continue;
+
+				if (Job* job = m_Deques[victim]->steal()) {
+					return job;
+				}
+			}
+			return nullptr;
+		}
+
+		void JobSystem::wait(Counter& counter) {
+			u32 self = local_deque();
+			u32 idle = 0;
+
+			while (counter.m_Pending.load(std::memory_order_acquire) != 0) {
+				if (Job* job = find_job(self)) {
+					execute(job);
+					idle = 0;
+				}
+				else if (++idle < SPIN_ROUNDS) {
+					std::this_thread::yield();
+				}
+				else {
+					// the jobs left are running on other threads
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+
+			// the thread that finished the counter may still hold its lock
+			std::lock_guard<std::mutex> lock(counter.m_Lock);
+		}
+
+		void JobSystem::parallel_for(u32 begin, u32 end, const std::function<void(u32 begin, u32 end)>& body, u32 grain) {
+			if (end <= begin) return;
+
+			u32 count = end - begin;
+			if (grain == 0) {
+				// a few chunks per thread so stealing can even out uneven chunks
+				u32 chunks = thread_count() * 4;
+				grain = math::max(1u, (count + chunks - 1) / chunks);
+			}
+
+			if (count <= grain || m_Workers.empty()) {
+				body(begin, end);
+				return;
+			}
+
+			Counter counter;
+			for (u32 first = begin; first < end; first += math::min(grain, end - first)) {
+				u32 last = first + math::min(grain, end - first);
+				run([&body, first, last] { body(first, last); }, &counter);
+			}
+			wait(counter);
+		}
+
+		void JobSystem::worker_main(u32 self) {
+			t_SystemId = m_Id;
+			t_Deque = self;
+
+			u32 idle = 0;
+			for (;;) {
+				u32 signal = m_Signal.load(std::memory_order_acquire);
+				if (m_Quit.load(std::memory_order_acquire)) {
+					return;
+				}
+
+				if (Job* job = find_job(self)) {
+					execute(job);
+					idle = 0;
+					continue;
+				}
+
+				if (++idle < SPIN_ROUNDS) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				// nothing was queued since signal was read, sleep until something is
+				m_Signal.wait(signal, std::memory_order_acquire);
+				idle = 0;
+			}
+		}
+
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include "Common.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Work stealing job scheduler shared by the engine and client code.
+
+	Every thread that submits jobs owns a deque, workers take from the bottom of their own deque
+	and steal from the top of the others when it runs dry. Jobs finishing decrement a Counter, a
+	thread waiting on a counter keeps running jobs (its own first, then stolen ones) instead of
+	blocking, so waiting from inside a job, from OnUserUpdate or from a nested parallel_for can't
+	starve the pool.
+
+	Typical use:
+
+		util::JobSystem& jobs = util::JobSystem::Get();
+		util::JobSystem::Counter done;
+		jobs.run([&] { decode(a); }, &done);
+		jobs.run([&] { decode(b); }, &done);
+		jobs.run_after(done, [&] { upload(a, b); });
+		...
+		jobs.wait(done);
+
+		jobs.parallel_for(0, height, [&](u32 begin, u32 end) { for rows begin..end ... });
+*/
+
+namespace amor {
+	namespace util {
+
+		class JobSystem {
+		public:
+			struct Job;
+			class WorkDeque;
+
+			// number of jobs not finished yet. A counter has to outlive its jobs and may only be
+			// destroyed once wait() on it returned
+			class Counter {
+			public:
+				Counter() : m_Pending(0) {}
+				~Counter() {}
+
+				Counter(const Counter&) = delete;
+				Counter& operator=(const Counter&) = delete;
+
+				inline u32 pending() const { return m_Pending.load(std::memory_order_acquire); }
+				inline bool done() const { return pending() == 0; }
+
+			private:
+				friend class JobSystem;
+
+				std::atomic<u32> m_Pending;
+				// the last decrement and adding continuations are serialized by this, every other
+				// decrement is a plain compare exchange
+				std::mutex m_Lock;
+				std::vector<Job*> m_Continuations;
+			};
+
+			// jobs each deque holds, submitting more than that runs the job in place
+			static constexpr u32 DEQUE_CAPACITY = 4096;
+			// threads that can own a deque, workers included
+			static constexpr u32 MAX_THREADS = 64;
+
+			// threads = 0 starts one worker less than there are hardware threads, the
+			// threads calling wait make up the difference
+			JobSystem(u32 threads = 0);
+			~JobSystem();
+
+			JobSystem(const JobSystem&) = delete;
+			JobSystem& operator=(const JobSystem&) = delete;
+
+			// the shared scheduler, started on first use
+			static JobSystem& Get();
+
+			// workers plus the calling thread
+			inline u32 thread_count() const { return (u32)m_Workers.size() + 1; }
+
+			void run(std::function<void()> task, Counter* counter = nullptr);
+
+			// task is only queued once dependency reaches zero
+			void run_after(Counter& dependency, std::function<void()> task, Counter* counter = nullptr);
+
+			// runs jobs until counter is zero
+			void wait(Counter& counter);
+
+			// calls body over [begin, end) split into chunks of grain items (0 picks a grain that gives every
+			// thread a few chunks) and returns once all are done. The caller works on chunks too
+			void parallel_for(u32 begin, u32 end, const std::function<void(u32 begin, u32 end)>& body, u32 grain = 0);
+
+		private:
+			void submit(Job* job);
+			void execute(Job* job);
+			void finish(Counter* counter);
+
+			// finds a job for the thread that owns deque, own jobs first
+			Job* find_job(u32 self);
+
+			// deque of the calling thread, registered on its first call
+			u32 local_deque();
+
+			void worker_main(u32 self);
+
+		private:
+			std::vector<std::thread> m_Workers;
+			WorkDeque* m_Deques[MAX_THREADS];
+			std::atomic<u32> m_DequeCount;
+
+			// tells systems apart in the per thread deque cache
+			u64 m_Id;
+			std::mutex m_RegisterLock;
+			std::unordered_map<std::thread::id, u32> m_Threads;
+
+			// bumped whenever a job is queued, idle workers wait on it
+			std::atomic<u32> m_Signal;
+			std::atomic<bool> m_Quit;
+		};
+
+	}
+}
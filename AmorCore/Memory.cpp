@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "Memory.h"
+#include "Core.h"
+
+namespace amor {
+	namespace util {
+
+		// blocks start on a cache line
+		static constexpr size_t BLOCK_ALIGNMENT = 64;
+
+		static inline size_t align_up(size_t value, size_t alignment) {
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		class HeapAllocator : public Allocator {
+		public:
+			void* allocate(size_t size, size_t alignment) override {
+				if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+					return ::operator new(size, std::align_val_t(alignment));
+				}
+				return ::operator new(size);
+			}
+
+			void deallocate(void* memory, size_t size, size_t alignment) override {
+				if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+					::operator delete(memory, std::align_val_t(alignment));
+				}
+				else {
+					::operator delete(memory);
+				}
+			}
+		};
+
+		Allocator& Allocator::Heap() {
+			static HeapAllocator heap;
+			return heap;
+		}
+
+
+		Arena::Arena(size_t blockSize) : m_Current(0), m_Offset(0), m_BlockSize(math::max(blockSize, BLOCK_ALIGNMENT)), m_Used(0), m_Peak(0) {}
+
+		Arena::~Arena() {
+			for (Block& block : m_Blocks) {
+				::operator delete(block.data, std::align_val_t(BLOCK_ALIGNMENT));
+			}
+		}
+
+		void Arena::add_block(size_t size) {
+			Block block;
+			block.size = align_up(size, BLOCK_ALIGNMENT);
+			block.data = (byte*)::operator new(block.size, std::align_val_t(BLOCK_ALIGNMENT));
+			m_Blocks.push_back(block);
+		}
+
+		void* Arena::allocate(size_t size, size_t alignment) {
+			for (;;) {
+				if (m_Current < m_Blocks.size()) {
+					Block& block = m_Blocks[m_Current];
+					size_t start = align_up((size_t)block.data + m_Offset, alignment) - (size_t)block.data;
+					if (start + size <= block.size) {
+						m_Used += start - m_Offset + size;
+						m_Peak = math::max(m_Peak, m_Used);
+						m_Offset = start + size;
+						return block.data + start;
+					}
+
+					// rewound or reset past this one, the next block is still there
+					if (m_Current + 1 < m_Blocks.size()) {
+						++m_Current;
+						m_Offset = 0;
+						continue;
+					}
+				}
+
+				add_block(math::max(m_BlockSize, size + alignment));
+				m_Current = (u32)m_Blocks.size() - 1;
+				m_Offset = 0;
+			}
+		}
+
+		void Arena::deallocate(void* memory, size_t size, size_t alignment) {
+			if (m_Current < m_Blocks.size() && (byte*)memory + size == m_Blocks[m_Current].data + m_Offset) {
+				m_Offset -= size;
+				m_Used -= size;
+			}
+		}
+
+		void Arena::reset() {
+			if (m_Blocks.size() > 1) {
+				size_t total = capacity();
+				for (Block& block : m_Blocks) {
+					::operator delete(block.data, std::align_val_t(BLOCK_ALIGNMENT));
+				}
+				m_Blocks.clear();
+				add_block(total);
+			}
+
+			m_Current = 0;
+			m_Offset = 0;
+			m_Used = 0;
+		}
+
+		Arena::Marker Arena::mark() const {
+			return { m_Current, m_Offset, m_Used };
+		}
+
+		void Arena::rewind(const Marker& marker) {
+			m_Current = marker.block;
+			m_Offset = marker.offset;
+			m_Used = marker.used;
+		}
+
+		size_t Arena::capacity() const {
+			size_t total = 0;
+			for (const Block& block : m_Blocks) {
+				total += block.size;
+			}
+			return total;
+		}
+
+
+		Pool::Pool(size_t blockSize, size_t alignment, u32 chunkBlocks) :
+				m_Free(nullptr), m_Alignment(math::max(alignment, alignof(FreeBlock))), m_ChunkBlocks(math::max(chunkBlocks, 1u)), m_InUse(0) {
+			// every block has to be able to hold the free list link and start aligned
+			m_BlockSize = align_up(math::max(blockSize, sizeof(FreeBlock)), m_Alignment);
+		}
+
+		Pool::~Pool() {
+			if (m_InUse != 0) {
+				AMOR_LOG_WARN("Pool", "%u blocks of %zu bytes still in use when the pool was destroyed", m_InUse, m_BlockSize);
+			}
+			for (byte* chunk : m_Chunks) {
+				::operator delete(chunk, std::align_val_t(m_Alignment));
+			}
+		}
+
+		void Pool::add_chunk() {
+			byte* chunk = (byte*)::operator new(m_BlockSize * m_ChunkBlocks, std::align_val_t(m_Alignment));
+			m_Chunks.push_back(chunk);
+
+			// linked back to front so blocks are handed out in address order
+			for (u32 i = m_ChunkBlocks; i-- > 0;) {
+				FreeBlock* block = (FreeBlock*)(chunk + i * m_BlockSize);
+				block->next = m_Free;
+				m_Free = block;
+			}
+		}
+
+		void* Pool::allocate(size_t size, size_t alignment) {
+			if (size > m_BlockSize || alignment > m_Alignment) {
+				AMOR_LOG_ERROR("Pool", "Unable to allocate %zu bytes aligned to %zu from a pool of %zu byte blocks", size, alignment, m_BlockSize);
+				throw std::bad_alloc();
+			}
+
+			if (m_Free == nullptr) {
+				add_chunk();
+			}
+
+			FreeBlock* block = m_Free;
+			m_Free = block->next;
+			++m_InUse;
+			return block;
+		}
+
+		void Pool::deallocate(void* memory, size_t size, size_t alignment) {
+			if (memory == nullptr) {
+				return;
+			}
+
+			FreeBlock* block = (FreeBlock*)memory;
+			block->next = m_Free;
+			m_Free = block;
+			--m_InUse;
+		}
+
+	}
+}
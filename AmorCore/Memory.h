@@ -0,0 +1,143 @@
+#pragma once
+#include "Common.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+	Allocators for memory whose lifetime the heap knows nothing about.
+
+	Arena hands out memory by bumping an offset and frees all of it at once with reset(). Once it has
+	seen its peak it owns a single block that large, so a reset arena serves the same workload without
+	touching the heap. WindowBase keeps one per loop thread as frame scratch (frame_arena), reset at the
+	start of every frame.
+
+	Pool hands out blocks of one size from larger chunks and keeps returned blocks on a free list, for
+	objects that come and go at one size (events, undo steps of one canvas).
+
+	Neither is thread safe, every thread needs its own.
+*/
+
+namespace amor {
+	namespace util {
+
+		class Allocator {
+		public:
+			virtual ~Allocator() {}
+
+			virtual void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) = 0;
+			// size and alignment have to match the allocate call
+			virtual void deallocate(void* memory, size_t size, size_t alignment = alignof(std::max_align_t)) = 0;
+
+			template<typename T, typename... Args> T* make(Args&&... args) {
+				return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			}
+			template<typename T> void destroy(T* object) {
+				if (object != nullptr) {
+					object->~T();
+					deallocate(object, sizeof(T), alignof(T));
+				}
+			}
+
+			// default initialized like new T[count], trivial types are left uninitialized
+			template<typename T> T* make_array(size_t count) {
+				T* array = (T*)allocate(sizeof(T) * count, alignof(T));
+				std::uninitialized_default_construct_n(array, count);
+				return array;
+			}
+			template<typename T> void destroy_array(T* array, size_t count) {
+				if (array != nullptr) {
+					std::destroy_n(array, count);
+					deallocate(array, sizeof(T) * count, alignof(T));
+				}
+			}
+
+			// operator new and delete
+			static Allocator& Heap();
+		};
+
+		class Arena : public Allocator {
+		public:
+			// position to rewind to, everything allocated after it is freed by rewind()
+			struct Marker {
+				u32 block;
+				size_t offset;
+				size_t used;
+			};
+
+			// blockSize is the size of the first block, blocks added later are at least that large
+			Arena(size_t blockSize = 64 * 1024);
+			~Arena();
+
+			Arena(const Arena&) = delete;
+			Arena& operator=(const Arena&) = delete;
+
+			void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) override;
+			// only the latest allocation is given back right away, everything else waits for reset
+			void deallocate(void* memory, size_t size, size_t alignment = alignof(std::max_align_t)) override;
+
+			// frees everything. If that took more than one block they're replaced by one as large as all
+			// of them together, so the next round fits without growing
+			void reset();
+
+			Marker mark() const;
+			void rewind(const Marker& marker);
+
+			// bytes handed out since the last reset, alignment padding included
+			inline size_t used() const { return m_Used; }
+			// most bytes in use at once
+			inline size_t peak() const { return m_Peak; }
+			size_t capacity() const;
+
+		private:
+			struct Block {
+				byte* data;
+				size_t size;
+			};
+
+			void add_block(size_t size);
+
+		private:
+			std::vector<Block> m_Blocks;
+			u32 m_Current;
+			size_t m_Offset;
+			size_t m_BlockSize;
+			size_t m_Used, m_Peak;
+		};
+
+		class Pool : public Allocator {
+		public:
+			// blocks of blockSize bytes at alignment, allocated chunkBlocks at a time
+			Pool(size_t blockSize, size_t alignment = alignof(std::max_align_t), u32 chunkBlocks = 64);
+			~Pool();
+
+			Pool(const Pool&) = delete;
+			Pool& operator=(const Pool&) = delete;
+
+			// size and alignment can't be more than the pool was made for
+			void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) override;
+			void deallocate(void* memory, size_t size, size_t alignment = alignof(std::max_align_t)) override;
+
+			inline size_t block_size() const { return m_BlockSize; }
+			inline u32 blocks_in_use() const { return m_InUse; }
+
+		private:
+			struct FreeBlock {
+				FreeBlock* next;
+			};
+
+			void add_chunk();
+
+		private:
+			std::vector<byte*> m_Chunks;
+			FreeBlock* m_Free;
+			size_t m_BlockSize, m_Alignment;
+			u32 m_ChunkBlocks;
+			u32 m_InUse;
+		};
+
+	}
+}
@@ -3,6 +3,7 @@
 #include "Graphics.h"
 #include "ShaderFactory.h"
 #include <functional>
+#include <cstring>
 
 #ifdef DEFINE_RENDERER_PIXEL
 #include <glad/glad.h>
@@ -47,8 +48,23 @@ namespace amor {
 			std::string m_Name;
 		};
 
+		// how the frame gets from m_PixelData into the gl texture
+		enum class FrameUpload {
+			// glTexSubImage2D straight from client memory, blocks until the driver has copied it
+			Direct = 0,
+			// changed rows are copied into a ring of pixel unpack buffers guarded by fences, the
+			// driver transfers frame N while frame N+1 is drawn
+			Streamed,
+			// the context draws straight into a persistently mapped unpack buffer (GL 4.4 or
+			// GL_ARB_buffer_storage), nothing is copied on the cpu. Falls back to Streamed when
+			// unsupported. Drawing has to happen between BeginFrame and RenderFrame
+			Persistent,
+		};
+
 		class PixelRenderer : public RendererBase, public PrimitiveContext2D {
 		public:
+			static constexpr u32 UPLOAD_BUFFER_COUNT = 3;
+
 			PixelRenderer(u32 width, u32 height, u32 pixelWidth, u32 pixelHeight);
 			PixelRenderer(const Resolution& res);
 			~PixelRenderer();
@@ -58,16 +74,28 @@ namespace amor {
 			void RemoveEffect(PixelShaderEffect&);
 			void UpdateShader();
 			void SetPostRenderCallback(std::function<void(WindowBase*, PixelRenderer*)> callback);
+
+			// has to be set before the window is shown, defaults to FrameUpload::Streamed
+			void SetFrameUpload(FrameUpload mode);
+			// the mode in use, may differ from the requested one if the driver lacks support
+			inline FrameUpload GetFrameUpload() const { return m_UploadMode; }
 		public:
 			void InitializeGraphicsPipeline() override;
 			void InitializeWindowGraphicsPipeline(WindowBase* window) override;
 			void DeinitializeGraphicsPipeline(WindowBase* window) override;
 
+			void BeginFrame(WindowBase* win) override;
 			void PrepareFrame(WindowBase* win) override;
 			void RenderFrame(WindowBase* win) override;
 			void PostRenderFrame(WindowBase* win) override;
 		private:
 			void CompileShader();
+			void AllocateFrameTexture();
+			void AllocateUploadBuffers();
+			void ReleaseUploadBuffers();
+			void CollectUploadRuns();
+			void UploadDirty();
+			void WaitForUpload(u32 buffer);
 
 		private:
 			u32 m_VAO, m_VBO;
@@ -75,6 +103,15 @@ namespace amor {
 			u32 m_glFrameTexture;
 			Color* m_PixelData;
 			size_t m_PixelDataLength;
+
+			FrameUpload m_UploadMode;
+			u32 m_UploadBuffers[UPLOAD_BUFFER_COUNT];
+			// GLsync, kept opaque so this header doesn't need the gl headers
+			void* m_UploadFences[UPLOAD_BUFFER_COUNT];
+			u32 m_NextUploadBuffer;
+			Color* m_MappedPixels;
+			// rectangles that go up this frame
+			std::vector<math::Rect> m_UploadRuns;
 			u32 m_Width, m_Height, m_PixWidth, m_PixHeight;
 			u32 m_uniTexture;
 			std::vector<PixelShaderEffect*> m_Effects;
@@ -146,6 +183,7 @@ namespace amor {
 		PixelRenderer::PixelRenderer(u32 width, u32 height, u32 pixelWidth, u32 pixelHeight) :
 			m_Width(width), m_Height(height), m_PixWidth(pixelWidth), m_PixHeight(pixelHeight),
 			m_VAO(0), m_VBO(0), m_glFrameTexture(0), m_uniTexture(0),
+			m_UploadMode(FrameUpload::Streamed), m_UploadBuffers{}, m_UploadFences{}, m_NextUploadBuffer(0), m_MappedPixels(nullptr),
 			PrimitiveContext2D(width, height, nullptr), m_PostRenderCallback{ [](WindowBase*,PixelRenderer*) {} } {
 
 			m_PixelDataLength = width * height;
@@ -154,11 +192,13 @@ namespace amor {
 			// PrimitiveContext2D handle to pixel data.
 			// this is an unowned pointer, m_PixelData is owned
 			m_Pixels = m_PixelData;
+			SetDirtyTracking(true);
 		}
 
 		PixelRenderer::PixelRenderer(const Resolution& res) :
 			m_Width(res.width), m_Height(res.height), m_PixWidth(res.pixelWidth), m_PixHeight(res.pixelHeight),
 			m_VAO(0), m_VBO(0), m_glFrameTexture(0), m_uniTexture(0),
+			m_UploadMode(FrameUpload::Streamed), m_UploadBuffers{}, m_UploadFences{}, m_NextUploadBuffer(0), m_MappedPixels(nullptr),
 			PrimitiveContext2D(res.width, res.height, nullptr), m_PostRenderCallback{ [](WindowBase*,PixelRenderer*) {} } {
 
 			m_PixelDataLength = res.width * res.height;
@@ -167,6 +207,7 @@ namespace amor {
 			// PrimitiveContext2D handle to pixel data.
 			// this is an unowned pointer, m_PixelData is owned
 			m_Pixels = m_PixelData;
+			SetDirtyTracking(true);
 		}
 
 		PixelRenderer::~PixelRenderer() {
@@ -190,26 +231,31 @@ namespace amor {
 		void PixelRenderer::UpdateShader() {
 			logging::GetInstance()->info("Recompiling shader", "PixelRenderer");
 			
-			u32 currentProgramID = m_ProgramID.internal_id();
+			// keeps the current program alive until the new one compiled
+			utils::opengl::Shader previous = m_ProgramID;
 
 			try {
 				CompileShader();
 			}
 			catch (std::runtime_error& e) {
 				logging::GetInstance()->error("Failed to recompile shader, falling back", "PixelRenderer");
-				m_ProgramID.internal_id() = currentProgramID;
+				m_ProgramID = previous;
 				return;
 			}
-
-			if (currentProgramID != 0) {
-				glDeleteProgram(currentProgramID);
-			}
 		}
 
 		void PixelRenderer::SetPostRenderCallback(std::function<void(WindowBase*, PixelRenderer*)> callback) {
 			m_PostRenderCallback = callback;
 		}
 
+		void PixelRenderer::SetFrameUpload(FrameUpload mode) {
+			if (m_UploadBuffers[0] != 0) {
+				logging::GetInstance()->error("Frame upload mode can only be changed before the window is shown", "PixelRenderer");
+				return;
+			}
+			m_UploadMode = mode;
+		}
+
 
 		void PixelRenderer::InitializeGraphicsPipeline() {
 			glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -264,8 +310,196 @@ namespace amor {
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+			AllocateFrameTexture();
+			AllocateUploadBuffers();
+		}
+
+		void PixelRenderer::AllocateFrameTexture() {
+			// immutable storage where available (4.2 or ARB_texture_storage), looked up by hand so
+			// it doesn't depend on what the gl loader was generated with
+			typedef void(APIENTRY* TexStorage2DFn)(GLenum, GLsizei, GLenum, GLsizei, GLsizei);
+			TexStorage2DFn texStorage2D = nullptr;
+
+			GLint major = 0, minor = 0;
+			glGetIntegerv(GL_MAJOR_VERSION, &major);
+			glGetIntegerv(GL_MINOR_VERSION, &minor);
+			if (major > 4 || (major == 4 && minor >= 2) || glfwExtensionSupported("GL_ARB_texture_storage")) {
+				texStorage2D = (TexStorage2DFn)glfwGetProcAddress("glTexStorage2D");
+			}
+
+			if (texStorage2D != nullptr) {
+				texStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, (GLsizei)m_Width, (GLsizei)m_Height);
+			}
+			else {
+				// still only allocated once, every later upload is a sub image
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (GLsizei)m_Width, (GLsizei)m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+
+			// the texture starts out undefined, the first frame goes up whole
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)m_Width, (GLsizei)m_Height, GL_RGBA, GL_UNSIGNED_BYTE, m_PixelData);
+			ClearDirty();
+		}
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_CLIENT_STORAGE_BIT
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+
+		void PixelRenderer::AllocateUploadBuffers() {
+			const GLsizeiptr size = (GLsizeiptr)(m_PixelDataLength * sizeof(Color));
+
+			if (m_UploadMode == FrameUpload::Persistent) {
+				typedef void(APIENTRY* BufferStorageFn)(GLenum, GLsizeiptr, const void*, GLbitfield);
+				BufferStorageFn bufferStorage = nullptr;
+
+				GLint major = 0, minor = 0;
+				glGetIntegerv(GL_MAJOR_VERSION, &major);
+				glGetIntegerv(GL_MINOR_VERSION, &minor);
+				if (major > 4 || (major == 4 && minor >= 4) || glfwExtensionSupported("GL_ARB_buffer_storage")) {
+					bufferStorage = (BufferStorageFn)glfwGetProcAddress("glBufferStorage");
+				}
+
+				if (bufferStorage != nullptr) {
+					// the rasterizer reads back what it blends over, client storage and a read mapping keep
+					// the buffer in cached system memory instead of write combined memory
+					const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+					glGenBuffers(1, &m_UploadBuffers[0]);
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_UploadBuffers[0]);
+					bufferStorage(GL_PIXEL_UNPACK_BUFFER, size, m_PixelData, flags | GL_CLIENT_STORAGE_BIT);
+					m_MappedPixels = (Color*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+					if (m_MappedPixels != nullptr) {
+						// from here on the context draws into the mapped buffer
+						m_Pixels = m_MappedPixels;
+						logging::GetInstance()->info("Drawing into a persistently mapped buffer", "PixelRenderer");
+						return;
+					}
+
+					glDeleteBuffers(1, &m_UploadBuffers[0]);
+					m_UploadBuffers[0] = 0;
+				}
+
+				logging::GetInstance()->warn("Persistent mapping not supported, streaming the frame instead", "PixelRenderer");
+				m_UploadMode = FrameUpload::Streamed;
+			}
+
+			if (m_UploadMode == FrameUpload::Streamed) {
+				glGenBuffers(UPLOAD_BUFFER_COUNT, m_UploadBuffers);
+				for (u32 i = 0; i < UPLOAD_BUFFER_COUNT; ++i) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_UploadBuffers[i]);
+					glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		}
 
-			// initialize 
+		void PixelRenderer::ReleaseUploadBuffers() {
+			for (u32 i = 0; i < UPLOAD_BUFFER_COUNT; ++i) {
+				WaitForUpload(i);
+			}
+
+			if (m_MappedPixels != nullptr) {
+				// hand the frame back to memory we own, the mapping goes away with the buffer
+				memcpy(m_PixelData, m_MappedPixels, m_PixelDataLength * sizeof(Color));
+				m_Pixels = m_PixelData;
+				m_MappedPixels = nullptr;
+
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_UploadBuffers[0]);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+
+			for (u32 i = 0; i < UPLOAD_BUFFER_COUNT; ++i) {
+				if (m_UploadBuffers[i] != 0) {
+					glDeleteBuffers(1, &m_UploadBuffers[i]);
+					m_UploadBuffers[i] = 0;
+				}
+			}
+		}
+
+		void PixelRenderer::WaitForUpload(u32 buffer) {
+			GLsync fence = (GLsync)m_UploadFences[buffer];
+			if (fence == nullptr) return;
+
+			GLenum status;
+			do {
+				status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+
+			glDeleteSync(fence);
+			m_UploadFences[buffer] = nullptr;
+		}
+
+		void PixelRenderer::CollectUploadRuns() {
+			// everything drawn since the last upload goes up, changed or not
+			m_UploadRuns.assign(Dirty().begin(), Dirty().end());
+		}
+
+		void PixelRenderer::UploadDirty() {
+			if (Dirty().empty()) return;
+
+			CollectUploadRuns();
+			ClearDirty();
+			if (m_UploadRuns.empty()) return;
+
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)m_Width);
+
+			u32 buffer = 0;
+			bool fromBuffer = false;
+
+			if (m_UploadMode == FrameUpload::Streamed) {
+				buffer = m_NextUploadBuffer;
+				m_NextUploadBuffer = (m_NextUploadBuffer + 1) % UPLOAD_BUFFER_COUNT;
+
+				// the transfer issued from this buffer UPLOAD_BUFFER_COUNT frames ago has to be done
+				WaitForUpload(buffer);
+
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_UploadBuffers[buffer]);
+				Color* mapped = (Color*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)(m_PixelDataLength * sizeof(Color)), GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+				if (mapped != nullptr) {
+					// same layout as the frame, so the offsets below work for both
+					for (const math::Rect& run : m_UploadRuns) {
+						for (i32 y = run.y; y < run.y2(); ++y) {
+							size_t offset = (size_t)y * m_Width + run.x;
+							memcpy(mapped + offset, m_PixelData + offset, (size_t)run.width * sizeof(Color));
+						}
+					}
+					glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+					fromBuffer = true;
+				}
+				else {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				}
+			}
+			else if (m_MappedPixels != nullptr) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_UploadBuffers[0]);
+				fromBuffer = true;
+			}
+
+			// with an unpack buffer bound the pointer is an offset into it
+			const Color* base = fromBuffer ? nullptr : m_PixelData;
+			for (const math::Rect& run : m_UploadRuns) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, run.x, run.y, run.width, run.height, GL_RGBA, GL_UNSIGNED_BYTE, base + (size_t)run.y * m_Width + run.x);
+			}
+
+			if (fromBuffer) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				m_UploadFences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 		}
 
 		void PixelRenderer::CompileShader() {
@@ -312,7 +546,7 @@ namespace amor {
 				logging::GetInstance()->fail("Failed to compile default shader", "PixelRenderer");
 				throw std::runtime_error("comiler error");
 			}
-			logging::GetInstance()->info(std::string("Applied ") + std::to_string(m_Effects.size()) + std::string(" custom effects to the pixel shader"), "PixelRenderer");
+			AMOR_LOG_INFO("PixelRenderer", "Applied %zu custom effects to the pixel shader", m_Effects.size());
 			logging::GetInstance()->info("Pixel Shader compiled", "PixelRenderer");
 
 			m_ProgramID.bind();
@@ -324,18 +558,32 @@ namespace amor {
 			glDeleteVertexArrays(1, &m_VAO);
 			glDeleteBuffers(1, &m_VBO);
 
+			ReleaseUploadBuffers();
+			glDeleteTextures(1, &m_glFrameTexture);
+
 			//glDeleteProgram(m_ProgramID);
 		}
 
+		void PixelRenderer::BeginFrame(WindowBase* win) {
+			// the client is about to draw into the buffer the last frame was uploaded from
+			if (m_MappedPixels != nullptr) {
+				WaitForUpload(0);
+			}
+		}
+
 		void PixelRenderer::PrepareFrame(WindowBase* win) {
 			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 			glClear(GL_COLOR_BUFFER_BIT);
 		}
 		void PixelRenderer::RenderFrame(WindowBase* win) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)m_Width, (GLsizei)m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_PixelData);
-			glGenerateMipmap(GL_TEXTURE_2D);
+			AMOR_PROFILE_SCOPE("PixelRenderer::RenderFrame");
+			// deferred draw calls have to land before the upload
+			Flush();
 
+			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, m_glFrameTexture);
+			UploadDirty();
+
 			m_ProgramID.bind();
 			glUniform1i(m_uniTexture, 0);
 			glBindVertexArray(m_VAO);
@@ -0,0 +1,1068 @@
+#include "pch.h"
+#include "Pxim.h"
+#include "Graphics.h"
+#include "JobSystem.h"
+
+#include <zlib.h>
+
+namespace amor {
+	namespace graphics {
+
+		// not truly noendian, but this will use math to force a specific endian
+		// format for the u32 bytes, unsafe because there's no buffer checks
+		// so be careful with buffer overflows
+		void write_u32_noendian_unsafe(byte* buffer, u32 value, u64& index) {
+			buffer[index++] = (byte)((value >> 24) & 0xFF);
+			buffer[index++] = (byte)((value >> 16) & 0xFF);
+			buffer[index++] = (byte)((value >>  8) & 0xFF);
+			buffer[index++] = (byte)((value) & 0xFF);
+		}
+
+		void read_u32_noendian_unsafe(byte* buffer, u32& value, u64& index) {
+			value = (static_cast<u32>(buffer[index]) << 24) |
+					(static_cast<u32>(buffer[index+1]) << 16) |
+					(static_cast<u32>(buffer[index+2]) << 8) |
+					(static_cast<u32>(buffer[index+3]));
+			index += 4;
+		}
+
+		namespace pxim {
+
+			static constexpr u32 V1_HEADER_SIZE = 12;
+			static constexpr u32 HEADER_SIZE = 32;
+			static constexpr u32 TILE_ENTRY_SIZE = 16;
+			static constexpr u32 INPUT_CHUNK = 64 * 1024;
+
+			/*
+				Fast codec, the LZ4 block layout: sequences of a token (literal count in the high nibble,
+				match length - 4 in the low one, 15 means more follows in 255 steps), the literals, a
+				little endian u16 offset back into the output and the rest of the match length. The
+				last sequence is literals only.
+			*/
+			static constexpr u32 LZ_HASH_BITS = 14;
+			static constexpr u32 LZ_MIN_MATCH = 4;
+			static constexpr u32 LZ_MAX_OFFSET = 65535;
+			// matches stop this far from the end, the last sequence always has literals
+			static constexpr u32 LZ_END_LITERALS = 5;
+
+			static inline u32 lz_bound(u32 size) {
+				return size + size / 255 + 16;
+			}
+
+			static inline u32 lz_load32(const byte* at) {
+				u32 value;
+				memcpy(&value, at, sizeof(value));
+				return value;
+			}
+
+			static inline byte* lz_write_length(byte* out, u32 length) {
+				for (; length >= 255; length -= 255) {
+					*out++ = 255;
+				}
+				*out++ = (byte)length;
+				return out;
+			}
+
+			// output needs lz_bound(size) bytes, table 1 << LZ_HASH_BITS entries. Returns the compressed size
+			static u32 lz_compress(const byte* input, u32 size, byte* output, u32* table) {
+				std::fill(table, table + (1u << LZ_HASH_BITS), 0u);
+
+				byte* out = output;
+				u32 anchor = 0, position = 0;
+				u32 limit = size > LZ_MIN_MATCH + LZ_END_LITERALS ? size - LZ_MIN_MATCH - LZ_END_LITERALS : 0;
+
+				auto emit = [&](u32 literals, u32 offset, u32 match) {
+					byte* token = out++;
+					*token = (byte)(math::min(literals, 15u) << 4);
+					if (literals >= 15) {
+						out = lz_write_length(out, literals - 15);
+					}
+					memcpy(out, input + anchor, literals);
+					out += literals;
+
+					if (offset != 0) {
+						*out++ = (byte)(offset & 0xFF);
+						*out++ = (byte)(offset >> 8);
+						match -= LZ_MIN_MATCH;
+						*token |= (byte)math::min(match, 15u);
+						if (match >= 15) {
+							out = lz_write_length(out, match - 15);
+						}
+					}
+				};
+
+				while (position < limit) {
+					u32 sequence = lz_load32(input + position);
+					u32 hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+					// positions are stored + 1, 0 is an empty slot
+					u32 candidate = table[hash];
+					table[hash] = position + 1;
+
+					if (candidate != 0 && position - (candidate - 1) <= LZ_MAX_OFFSET && lz_load32(input + candidate - 1) == sequence) {
+						u32 reference = candidate - 1;
+						u32 length = LZ_MIN_MATCH;
+						u32 end = size - LZ_END_LITERALS;
+						while (position + length < end && input[reference + length] == input[position + length]) {
+							++length;
+						}
+
+						emit(position - anchor, position - reference, length);
+						position += length;
+						anchor = position;
+					}
+					else {
+						// the longer nothing matched the further ahead the next try
+						position += 1 + ((position - anchor) >> 6);
+					}
+				}
+
+				emit(size - anchor, 0, 0);
+				return (u32)(out - output);
+			}
+
+			// false if input doesn't decode to at most capacity bytes, size is what it decoded to
+			static bool lz_decompress(const byte* input, u32 inputSize, byte* output, u32 capacity, u32& size) {
+				const byte* in = input;
+				const byte* inEnd = input + inputSize;
+				byte* out = output;
+				byte* outEnd = output + capacity;
+
+				auto read_length = [&](u32& length) {
+					byte next;
+					do {
+						if (in >= inEnd) return false;
+						next = *in++;
+						length += next;
+					} while (next == 255);
+					return true;
+				};
+
+				while (in < inEnd) {
+					byte token = *in++;
+
+					u32 literals = token >> 4;
+					if (literals == 15 && !read_length(literals)) return false;
+					if ((u64)(inEnd - in) < literals || (u64)(outEnd - out) < literals) return false;
+					memcpy(out, in, literals);
+					in += literals;
+					out += literals;
+
+					if (in == inEnd) break;
+
+					if (inEnd - in < 2) return false;
+					u32 offset = in[0] | ((u32)in[1] << 8);
+					in += 2;
+					if (offset == 0 || offset > (u64)(out - output)) return false;
+
+					u32 match = token & 15;
+					if (match == 15 && !read_length(match)) return false;
+					match += LZ_MIN_MATCH;
+					if ((u64)(outEnd - out) < match) return false;
+
+					// overlapping copies repeat the last offset bytes, which is how runs are encoded
+					const byte* from = out - offset;
+					if (offset >= match) {
+						memcpy(out, from, match);
+						out += match;
+					}
+					else {
+						for (u32 i = 0; i < match; ++i) {
+							*out++ = from[i];
+						}
+					}
+				}
+
+				size = (u32)(out - output);
+				return true;
+			}
+
+			/*
+				Filters, PNG's row prediction. Every row of a filtered tile starts with its filter type
+				and holds the differences to the prediction from the pixel to the left (bpp bytes back),
+				the one above and the one above left. The row before the first one is zeroes.
+				A row is one or two segments that are predicted on their own: RGBA pixels, RGB then the
+				alpha plane, or palette indices.
+			*/
+			enum RowFilter : byte {
+				ROW_NONE = 0,
+				ROW_SUB = 1,
+				ROW_UP = 2,
+				ROW_AVERAGE = 3,
+				ROW_PAETH = 4,
+				ROW_FILTER_COUNT = 5
+			};
+
+			struct Segment {
+				u32 offset, length, bpp;
+			};
+
+			// segments of one row of a tile width pixels wide, returns how many
+			static u32 row_segments(Filter filter, u32 width, Segment* segments) {
+				switch (filter) {
+				case Filter::SeparateAlpha:
+					segments[0] = { 0, width * 3, 3 };
+					segments[1] = { width * 3, width, 1 };
+					return 2;
+				case Filter::Palette:
+					segments[0] = { 0, width, 1 };
+					return 1;
+				default:
+					segments[0] = { 0, width * 4, 4 };
+					return 1;
+				}
+			}
+
+			static inline byte paeth(byte a, byte b, byte c) {
+				i32 p = (i32)a + b - c;
+				i32 pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+				if (pa <= pb && pa <= pc) return a;
+				return pb <= pc ? b : c;
+			}
+
+			// the prediction of a byte from a (left), b (above) and c (above left)
+			template<byte type> static inline byte predict(byte a, byte b, byte c) {
+				if constexpr (type == ROW_SUB) return a;
+				else if constexpr (type == ROW_UP) return b;
+				else if constexpr (type == ROW_AVERAGE) return (byte)(((u32)a + b) >> 1);
+				else if constexpr (type == ROW_PAETH) return paeth(a, b, c);
+				else return 0;
+			}
+
+			// one segment, the first bpp bytes have nothing to their left. Returns the sum of the residues
+			// as signed bytes, the usual guess at which filter compresses best
+			template<byte type> static u32 filter_segment(const byte* raw, const byte* prev, byte* out, u32 length, u32 bpp) {
+				u32 cost = 0;
+				u32 i = 0;
+				for (; i < bpp && i < length; ++i) {
+					out[i] = (byte)(raw[i] - predict<type>(0, prev[i], 0));
+					cost += (u32)abs((i8)out[i]);
+				}
+				for (; i < length; ++i) {
+					out[i] = (byte)(raw[i] - predict<type>(raw[i - bpp], prev[i], prev[i - bpp]));
+					cost += (u32)abs((i8)out[i]);
+				}
+				return cost;
+			}
+
+			template<byte type> static void unfilter_segment(byte* row, const byte* prev, u32 length, u32 bpp) {
+				u32 i = 0;
+				for (; i < bpp && i < length; ++i) {
+					row[i] = (byte)(row[i] + predict<type>(0, prev[i], 0));
+				}
+				for (; i < length; ++i) {
+					row[i] = (byte)(row[i] + predict<type>(row[i - bpp], prev[i], prev[i - bpp]));
+				}
+			}
+
+			// filters raw with prev as the row above into out, returns the summed residues
+			static u32 filter_row(byte type, const byte* raw, const byte* prev, byte* out, const Segment* segments, u32 segmentCount) {
+				u32 cost = 0;
+				for (u32 s = 0; s < segmentCount; ++s) {
+					const Segment& segment = segments[s];
+					const byte* r = raw + segment.offset;
+					const byte* p = prev + segment.offset;
+					byte* o = out + segment.offset;
+					switch (type) {
+					case ROW_SUB: cost += filter_segment<ROW_SUB>(r, p, o, segment.length, segment.bpp); break;
+					case ROW_UP: cost += filter_segment<ROW_UP>(r, p, o, segment.length, segment.bpp); break;
+					case ROW_AVERAGE: cost += filter_segment<ROW_AVERAGE>(r, p, o, segment.length, segment.bpp); break;
+					case ROW_PAETH: cost += filter_segment<ROW_PAETH>(r, p, o, segment.length, segment.bpp); break;
+					default: cost += filter_segment<ROW_NONE>(r, p, o, segment.length, segment.bpp); break;
+					}
+				}
+				return cost;
+			}
+
+			static bool unfilter_row(byte type, byte* row, const byte* prev, const Segment* segments, u32 segmentCount) {
+				for (u32 s = 0; s < segmentCount; ++s) {
+					const Segment& segment = segments[s];
+					byte* r = row + segment.offset;
+					const byte* p = prev + segment.offset;
+					switch (type) {
+					case ROW_NONE: break;
+					case ROW_SUB: unfilter_segment<ROW_SUB>(r, p, segment.length, segment.bpp); break;
+					case ROW_UP: unfilter_segment<ROW_UP>(r, p, segment.length, segment.bpp); break;
+					case ROW_AVERAGE: unfilter_segment<ROW_AVERAGE>(r, p, segment.length, segment.bpp); break;
+					case ROW_PAETH: unfilter_segment<ROW_PAETH>(r, p, segment.length, segment.bpp); break;
+					default: return false;
+					}
+				}
+				return true;
+			}
+
+			// buffers for encoding one tile
+			struct EncodeScratch {
+				std::vector<byte> output;
+				// the tile's rows in the layout of a filter, before and after filtering
+				std::vector<byte> raw, prepared, candidate;
+				std::vector<byte> row, zeroes;
+				std::vector<u32> table;
+				Codec codec;
+				Filter filter;
+			};
+
+			// up to 256 colors of the tile into palette and raw as indices, false if there are more
+			static bool build_palette(const Color* pixels, u32 stride, const math::Rect& rect, EncodeScratch& scratch, std::vector<byte>& palette) {
+				// open addressing over twice the palette size. Every color is a valid key (opaque white is
+				// all ones), so which slots are taken is kept apart
+				u32 keys[512];
+				bool used[512] = {};
+				byte indices[512];
+				u32 count = 0;
+
+				scratch.raw.resize((u64)rect.width * rect.height);
+				for (i32 row = 0; row < rect.height; ++row) {
+					const Color* source = pixels + (u64)(rect.y + row) * stride + rect.x;
+					byte* out = scratch.raw.data() + (u64)row * rect.width;
+					for (i32 x = 0; x < rect.width; ++x) {
+						u32 color;
+						memcpy(&color, source + x, sizeof(color));
+
+						u32 slot = (color * 2654435761u) >> 23;
+						while (used[slot] && keys[slot] != color) {
+							slot = (slot + 1) & 511;
+						}
+						if (!used[slot]) {
+							if (count == 256) {
+								return false;
+							}
+							used[slot] = true;
+							keys[slot] = color;
+							indices[slot] = (byte)count++;
+							palette.insert(palette.end(), (const byte*)&source[x], (const byte*)&source[x] + sizeof(Color));
+						}
+						out[x] = indices[slot];
+					}
+				}
+				return true;
+			}
+
+			// filters every row of scratch.raw (rows of rowBytes in the layout of filter) into out, picking the
+			// filter type per row. Returns the summed residues
+			static u64 filter_tile(Filter filter, u32 width, u32 height, EncodeScratch& scratch, std::vector<byte>& out) {
+				Segment segments[2];
+				u32 segmentCount = row_segments(filter, width, segments);
+				u32 rowBytes = filter == Filter::Palette ? width : width * 4;
+
+				scratch.zeroes.assign(rowBytes, 0);
+				scratch.row.resize(rowBytes);
+				u64 start = out.size();
+				out.resize(start + (u64)height * (rowBytes + 1));
+
+				u64 total = 0;
+				for (u32 row = 0; row < height; ++row) {
+					const byte* raw = scratch.raw.data() + (u64)row * rowBytes;
+					const byte* prev = row > 0 ? raw - rowBytes : scratch.zeroes.data();
+					byte* target = out.data() + start + (u64)row * (rowBytes + 1);
+
+					u32 best = ~0u;
+					for (byte type = ROW_NONE; type < ROW_FILTER_COUNT; ++type) {
+						u32 cost = filter_row(type, raw, prev, scratch.row.data(), segments, segmentCount);
+						if (cost < best) {
+							best = cost;
+							target[0] = type;
+							std::copy(scratch.row.begin(), scratch.row.end(), target + 1);
+						}
+					}
+					total += best;
+				}
+				return total;
+			}
+
+			// the tile as filtered rows in scratch.prepared, in the layout that predicts best: a palette when
+			// there are few enough colors, otherwise RGBA or RGB with a separate alpha plane
+			static Filter prepare_tile(const Color* pixels, u32 stride, const math::Rect& rect, EncodeScratch& scratch) {
+				std::vector<byte>& prepared = scratch.prepared;
+				prepared.clear();
+
+				prepared.push_back(0);
+				if (build_palette(pixels, stride, rect, scratch, prepared)) {
+					prepared[0] = (byte)((prepared.size() - 1) / sizeof(Color) - 1);
+					filter_tile(Filter::Palette, rect.width, rect.height, scratch, prepared);
+					return Filter::Palette;
+				}
+				prepared.clear();
+
+				scratch.raw.resize((u64)rect.width * rect.height * sizeof(Color));
+				for (i32 row = 0; row < rect.height; ++row) {
+					const Color* source = pixels + (u64)(rect.y + row) * stride + rect.x;
+					std::copy((const byte*)source, (const byte*)(source + rect.width), scratch.raw.data() + (u64)row * rect.width * sizeof(Color));
+				}
+				u64 interleaved = filter_tile(Filter::Rows, rect.width, rect.height, scratch, prepared);
+
+				// the same rows as RGB followed by the alpha plane
+				for (i32 row = 0; row < rect.height; ++row) {
+					const Color* source = pixels + (u64)(rect.y + row) * stride + rect.x;
+					byte* rgb = scratch.raw.data() + (u64)row * rect.width * sizeof(Color);
+					byte* alpha = rgb + rect.width * 3;
+					for (i32 x = 0; x < rect.width; ++x) {
+						rgb[x * 3] = source[x].r;
+						rgb[x * 3 + 1] = source[x].g;
+						rgb[x * 3 + 2] = source[x].b;
+						alpha[x] = source[x].a;
+					}
+				}
+				scratch.candidate.clear();
+				u64 separate = filter_tile(Filter::SeparateAlpha, rect.width, rect.height, scratch, scratch.candidate);
+
+				if (separate < interleaved) {
+					std::swap(prepared, scratch.candidate);
+					return Filter::SeparateAlpha;
+				}
+				return Filter::Rows;
+			}
+
+			// the tile in scratch.output, filtered and compressed as asked or its raw rows if that comes out smaller
+			static void encode_tile(const Color* pixels, u32 stride, const math::Rect& rect, Compression compression, EncodeScratch& scratch) {
+				u32 rowBytes = rect.width * sizeof(Color);
+				u32 rawSize = rowBytes * rect.height;
+				std::vector<byte>& output = scratch.output;
+
+				if (compression != Compression::None) {
+					scratch.filter = prepare_tile(pixels, stride, rect, scratch);
+					const std::vector<byte>& prepared = scratch.prepared;
+
+					if (compression == Compression::Fast) {
+						scratch.table.resize(1u << LZ_HASH_BITS);
+						output.resize(lz_bound((u32)prepared.size()));
+
+						u32 size = lz_compress(prepared.data(), (u32)prepared.size(), output.data(), scratch.table.data());
+						if (size < rawSize) {
+							output.resize(size);
+							scratch.codec = Codec::Fast;
+							return;
+						}
+					}
+					else {
+						uLongf size = compressBound((uLong)prepared.size());
+						output.resize(size);
+						int level = compression == Compression::Best ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION;
+						if (compress2(output.data(), &size, prepared.data(), (uLong)prepared.size(), level) == Z_OK && size < rawSize) {
+							output.resize(size);
+							scratch.codec = Codec::Deflate;
+							return;
+						}
+					}
+				}
+
+				output.resize(rawSize);
+				for (i32 row = 0; row < rect.height; ++row) {
+					const Color* source = pixels + (u64)(rect.y + row) * stride + rect.x;
+					std::copy((const byte*)source, (const byte*)(source + rect.width), output.data() + (u64)row * rowBytes);
+				}
+				scratch.codec = Codec::Stored;
+				scratch.filter = Filter::None;
+			}
+
+			static void write_entry(byte* table, u64& index, u64 offset, u32 size, Codec codec, Filter filter) {
+				write_u32_noendian_unsafe(table, (u32)(offset >> 32), index);
+				write_u32_noendian_unsafe(table, (u32)offset, index);
+				write_u32_noendian_unsafe(table, size, index);
+				table[index++] = (byte)codec;
+				table[index++] = (byte)filter;
+				table[index++] = 0;
+				table[index++] = 0;
+			}
+
+			bool Write(const char* filename, const Color* pixels, u32 width, u32 height, const WriteOptions& options) {
+				// mappable files are one tile covering the image
+				bool mappable = options.mappable;
+				u32 tileSize = mappable ? math::max(math::max(width, height), 1u) : options.tileSize;
+				if (tileSize == 0) {
+					AMOR_LOG_ERROR("Pxim", "Tile size can't be zero, not writing %s", filename);
+					return false;
+				}
+
+				std::ofstream file(filename, std::ios::binary | std::ios::out);
+				if (!file.is_open()) {
+					AMOR_LOG_ERROR("Pxim", "Unable to open %s for writing", filename);
+					return false;
+				}
+
+				u32 tilesX = (width + tileSize - 1) / tileSize;
+				u32 tilesY = (height + tileSize - 1) / tileSize;
+				if (width == 0 || height == 0) {
+					tilesX = tilesY = 0;
+				}
+				u32 tileCount = tilesX * tilesY;
+
+				u64 imageSize = (u64)width * height * sizeof(Color);
+				if (mappable && imageSize > ~0u) {
+					AMOR_LOG_ERROR("Pxim", "%ux%u is too large to be stored as a single tile, not writing %s", width, height, filename);
+					return false;
+				}
+
+				// the table is written once the tiles are, until then it's zeroes
+				std::vector<byte> header(HEADER_SIZE + (u64)tileCount * TILE_ENTRY_SIZE, 0);
+				file.write((char*)header.data(), header.size());
+
+				u64 index = 0;
+				header[index++] = 'P';
+				header[index++] = 'X';
+				header[index++] = 'I';
+				header[index++] = 'M';
+				write_u32_noendian_unsafe(header.data(), 0, index);
+				write_u32_noendian_unsafe(header.data(), VERSION, index);
+				write_u32_noendian_unsafe(header.data(), width, index);
+				write_u32_noendian_unsafe(header.data(), height, index);
+				write_u32_noendian_unsafe(header.data(), tileSize, index);
+				// flags and reserved
+				write_u32_noendian_unsafe(header.data(), mappable ? FLAG_MAPPABLE : 0, index);
+				write_u32_noendian_unsafe(header.data(), 0, index);
+
+				if (mappable && tileCount != 0) {
+					// padded up to the page the pixels start on, then the pixels as they are
+					u64 offset = (header.size() + MAP_ALIGNMENT - 1) / MAP_ALIGNMENT * MAP_ALIGNMENT;
+					std::vector<byte> padding(offset - header.size(), 0);
+					file.write((char*)padding.data(), padding.size());
+					file.write((const char*)pixels, imageSize);
+					write_entry(header.data(), index, offset, (u32)imageSize, Codec::Stored, Filter::None);
+				}
+				else {
+					// a few tiles per thread are encoded at once and written in order
+					bool serial = options.threads == 1;
+					u32 batchSize = serial ? 1 : math::min(tileCount, util::JobSystem::Get().thread_count() * 2);
+					std::vector<EncodeScratch> batch(math::max(batchSize, 1u));
+
+					u64 offset = header.size();
+					for (u32 first = 0; first < tileCount; first += batchSize) {
+						u32 count = math::min(batchSize, tileCount - first);
+
+						auto encode = [&](u32 begin, u32 end) {
+							for (u32 i = begin; i < end; ++i) {
+								u32 tile = first + i;
+								u32 tx = tile % tilesX, ty = tile / tilesX;
+								math::Rect rect(tx * tileSize, ty * tileSize, math::min(tileSize, width - tx * tileSize), math::min(tileSize, height - ty * tileSize));
+								encode_tile(pixels, width, rect, options.compression, batch[i]);
+							}
+						};
+						if (count > 1) {
+							util::JobSystem::Get().parallel_for(0, count, encode, 1);
+						}
+						else {
+							encode(0, count);
+						}
+
+						for (u32 i = 0; i < count; ++i) {
+							const std::vector<byte>& data = batch[i].output;
+							file.write((char*)data.data(), data.size());
+
+							write_entry(header.data(), index, offset, (u32)data.size(), batch[i].codec, batch[i].filter);
+							offset += data.size();
+						}
+					}
+				}
+
+				file.seekp(0);
+				file.write((char*)header.data(), header.size());
+				file.close();
+
+				if (file.fail()) {
+					AMOR_LOG_ERROR("Pxim", "Unable to write %s", filename);
+					return false;
+				}
+				return true;
+			}
+
+
+			// hands out the bytes of a zlib stream, refill gives the stream more input and returns false once
+			// there's none left
+			template<typename Refill> class InflateSource {
+			public:
+				InflateSource(Refill refill) : m_Stream{}, m_Refill(refill), m_Ready(inflateInit(&m_Stream) == Z_OK) {}
+				~InflateSource() {
+					if (m_Ready) inflateEnd(&m_Stream);
+				}
+
+				bool operator()(byte* out, u32 size) {
+					if (!m_Ready) {
+						return false;
+					}
+
+					m_Stream.next_out = out;
+					m_Stream.avail_out = size;
+					while (m_Stream.avail_out > 0) {
+						if (m_Stream.avail_in == 0 && !m_Refill(m_Stream)) {
+							return false;
+						}
+
+						int status = inflate(&m_Stream, Z_NO_FLUSH);
+						if (status == Z_STREAM_END) {
+							return m_Stream.avail_out == 0;
+						}
+						if (status != Z_OK) {
+							return false;
+						}
+					}
+					return true;
+				}
+
+			private:
+				z_stream m_Stream;
+				Refill m_Refill;
+				bool m_Ready;
+			};
+
+			struct MemorySource {
+				const byte* at;
+				const byte* end;
+
+				bool operator()(byte* out, u32 size) {
+					if ((u64)(end - at) < size) {
+						return false;
+					}
+					memcpy(out, at, size);
+					at += size;
+					return true;
+				}
+			};
+
+			// decodes the tile's rows down to the bottom of clip from what read hands out, the ones inside clip
+			// go to dest. Nothing below clip is read
+			template<typename Source> static bool decode_rows(Filter filter, const math::Rect& rect, const math::Rect& clip, Color* dest, u32 stride,
+					Reader::Scratch& scratch, Source& read) {
+				u32 width = rect.width;
+				bool fullRows = clip.x == rect.x && clip.width == rect.width;
+
+				if (filter == Filter::None) {
+					if (scratch.row.size() < width) {
+						scratch.row.resize(width);
+					}
+					for (i32 row = rect.y; row < clip.y2(); ++row) {
+						bool wanted = row >= clip.y;
+						Color* out = wanted && fullRows ? dest + (u64)(row - clip.y) * stride : scratch.row.data();
+						if (!read((byte*)out, width * sizeof(Color))) {
+							return false;
+						}
+						if (wanted && !fullRows) {
+							std::copy(scratch.row.data() + (clip.x - rect.x), scratch.row.data() + (clip.x2() - rect.x), dest + (u64)(row - clip.y) * stride);
+						}
+					}
+					return true;
+				}
+
+				// unused entries stay black, a damaged index can't read past the palette
+				Color palette[256] = {};
+				if (filter == Filter::Palette) {
+					byte last;
+					if (!read(&last, 1) || !read((byte*)palette, ((u32)last + 1) * sizeof(Color))) {
+						return false;
+					}
+				}
+
+				Segment segments[2];
+				u32 segmentCount = row_segments(filter, width, segments);
+				u32 rowBytes = filter == Filter::Palette ? width : width * 4;
+				scratch.current.resize(rowBytes);
+				scratch.previous.assign(rowBytes, 0);
+
+				u32 skip = clip.x - rect.x;
+				for (i32 row = rect.y; row < clip.y2(); ++row) {
+					byte type;
+					byte* current = scratch.current.data();
+					if (!read(&type, 1) || !read(current, rowBytes) || !unfilter_row(type, current, scratch.previous.data(), segments, segmentCount)) {
+						return false;
+					}
+
+					if (row >= clip.y) {
+						Color* out = dest + (u64)(row - clip.y) * stride;
+						switch (filter) {
+						case Filter::Rows:
+							memcpy(out, current + skip * sizeof(Color), clip.width * sizeof(Color));
+							break;
+						case Filter::SeparateAlpha: {
+							const byte* alpha = current + width * 3;
+							for (i32 x = 0; x < clip.width; ++x) {
+								const byte* rgb = current + (skip + x) * 3;
+								out[x] = { rgb[0], rgb[1], rgb[2], alpha[skip + x] };
+							}
+							break;
+						}
+						default:
+							for (i32 x = 0; x < clip.width; ++x) {
+								out[x] = palette[current[skip + x]];
+							}
+							break;
+						}
+					}
+					std::swap(scratch.current, scratch.previous);
+				}
+				return true;
+			}
+
+			// the clip part of a decoded tile (packed rows of rect) to dest
+			static void copy_tile_rows(const Color* tile, const math::Rect& rect, const math::Rect& clip, Color* dest, u32 stride) {
+				for (i32 row = clip.y; row < clip.y2(); ++row) {
+					const Color* source = tile + (u64)(row - rect.y) * rect.width + (clip.x - rect.x);
+					std::copy(source, source + clip.width, dest + (u64)(row - clip.y) * stride);
+				}
+			}
+
+			// decodes a tile whose compressed bytes are all in memory, safe to run for several tiles at once
+			static bool decode_tile_data(const TileEntry& entry, const byte* data, const math::Rect& rect, const math::Rect& clip,
+					Color* dest, u32 stride, Reader::Scratch& scratch) {
+				switch (entry.codec) {
+				case Codec::Stored:
+					copy_tile_rows((const Color*)data, rect, clip, dest, stride);
+					return true;
+
+				case Codec::Deflate: {
+					bool given = false;
+					InflateSource source([&](z_stream& stream) {
+						if (given) return false;
+						stream.next_in = (Bytef*)data;
+						stream.avail_in = entry.size;
+						given = true;
+						return true;
+					});
+					return decode_rows(entry.filter, rect, clip, dest, stride, scratch, source);
+				}
+
+				case Codec::Fast: {
+					// matches reach back across rows, the tile is unpacked whole before it's unfiltered.
+					// Nothing decodes to more than a palette and filtered RGBA rows
+					u32 capacity = 1 + 256 * sizeof(Color) + rect.height * (1 + rect.width * sizeof(Color));
+					u32 size;
+					scratch.unpacked.resize(capacity);
+					if (!lz_decompress(data, entry.size, scratch.unpacked.data(), capacity, size)) {
+						return false;
+					}
+					MemorySource source = { scratch.unpacked.data(), scratch.unpacked.data() + size };
+					return decode_rows(entry.filter, rect, clip, dest, stride, scratch, source);
+				}
+				}
+				return false;
+			}
+
+
+			Reader::Reader() : m_FileSize(0), m_Version(0), m_Flags(0), m_Width(0), m_Height(0), m_TileSize(0), m_TilesX(0), m_TilesY(0), m_Serial(false) {}
+
+			Reader::~Reader() {
+				close();
+			}
+
+			bool Reader::open(const char* filename) {
+				close();
+
+				m_File.open(filename, std::ios::binary | std::ios::in);
+				if (!m_File.is_open()) {
+					AMOR_LOG_ERROR("Pxim", "Unable to open %s for reading", filename);
+					return false;
+				}
+
+				m_File.seekg(0, std::ios::end);
+				m_FileSize = (u64)m_File.tellg();
+				m_File.seekg(0);
+
+				byte header[HEADER_SIZE];
+				if (m_FileSize < V1_HEADER_SIZE || !m_File.read((char*)header, math::min<u64>(m_FileSize, HEADER_SIZE))) {
+					AMOR_LOG_ERROR("Pxim", "%s is too short to be a texture", filename);
+					close();
+					return false;
+				}
+
+				if ((char)header[0] != 'P' || (char)header[1] != 'X' || (char)header[2] != 'I' || (char)header[3] != 'M') {
+					AMOR_LOG_ERROR("Pxim", "%s is not a PXIM file", filename);
+					close();
+					return false;
+				}
+
+				u64 index = 4;
+				u32 first, second;
+				read_u32_noendian_unsafe(header, first, index);
+				read_u32_noendian_unsafe(header, second, index);
+
+				if (first != 0 || second < 2) {
+					// version 1, a single zlib stream after width and height
+					m_Version = 1;
+					m_Width = first;
+					m_Height = second;
+					m_TileSize = math::max(math::max(m_Width, m_Height), 1u);
+					m_TilesX = m_TilesY = (m_Width != 0 && m_Height != 0) ? 1 : 0;
+					if (m_TilesX != 0) {
+						m_Tiles.push_back({ V1_HEADER_SIZE, (u32)math::min<u64>(m_FileSize - V1_HEADER_SIZE, ~0u), Codec::Deflate, Filter::None });
+					}
+					return true;
+				}
+
+				if (second > VERSION) {
+					AMOR_LOG_ERROR("Pxim", "%s is PXIM version %u, only up to %u can be read", filename, second, VERSION);
+					close();
+					return false;
+				}
+				if (m_FileSize < HEADER_SIZE) {
+					AMOR_LOG_ERROR("Pxim", "%s is too short to be a texture", filename);
+					close();
+					return false;
+				}
+
+				m_Version = second;
+				read_u32_noendian_unsafe(header, m_Width, index);
+				read_u32_noendian_unsafe(header, m_Height, index);
+				read_u32_noendian_unsafe(header, m_TileSize, index);
+				read_u32_noendian_unsafe(header, m_Flags, index);
+				if (m_TileSize == 0) {
+					AMOR_LOG_ERROR("Pxim", "%s has a tile size of zero", filename);
+					close();
+					return false;
+				}
+
+				m_TilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+				m_TilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+				if (m_Width == 0 || m_Height == 0) {
+					m_TilesX = m_TilesY = 0;
+				}
+
+				u64 tileCount = (u64)m_TilesX * m_TilesY;
+				if (HEADER_SIZE + tileCount * TILE_ENTRY_SIZE > m_FileSize) {
+					AMOR_LOG_ERROR("Pxim", "%s is cut off in its tile table", filename);
+					close();
+					return false;
+				}
+
+				std::vector<byte> table(tileCount * TILE_ENTRY_SIZE);
+				m_File.read((char*)table.data(), table.size());
+				m_Tiles.resize(tileCount);
+
+				index = 0;
+				for (u64 i = 0; i < tileCount; ++i) {
+					u32 high, low;
+					TileEntry& entry = m_Tiles[i];
+					read_u32_noendian_unsafe(table.data(), high, index);
+					read_u32_noendian_unsafe(table.data(), low, index);
+					read_u32_noendian_unsafe(table.data(), entry.size, index);
+					entry.offset = ((u64)high << 32) | low;
+					entry.codec = (Codec)table[index++];
+					entry.filter = (Filter)table[index++];
+					index += 2;
+
+					math::Rect rect = tile_rect((u32)(i % m_TilesX), (u32)(i / m_TilesX));
+					bool valid = entry.offset + entry.size <= m_FileSize && entry.offset >= HEADER_SIZE;
+					if (entry.codec == Codec::Stored) {
+						valid = valid && entry.size == (u64)rect.width * rect.height * sizeof(Color) && entry.filter == Filter::None;
+					}
+					else if (entry.codec != Codec::Deflate && entry.codec != Codec::Fast) {
+						valid = false;
+					}
+					if ((u8)entry.filter > (u8)Filter::Palette) {
+						valid = false;
+					}
+
+					if (!valid) {
+						AMOR_LOG_ERROR("Pxim", "%s has a broken entry for tile %llu", filename, (unsigned long long)i);
+						close();
+						return false;
+					}
+				}
+				return true;
+			}
+
+			void Reader::close() {
+				if (m_File.is_open()) {
+					m_File.close();
+				}
+				m_File.clear();
+				m_FileSize = 0;
+				m_Version = 0;
+				m_Flags = 0;
+				m_Width = m_Height = 0;
+				m_TileSize = m_TilesX = m_TilesY = 0;
+				m_Tiles.clear();
+			}
+
+			bool Reader::is_mappable() const {
+				// the entry was checked to hold exactly the image's pixels when it's stored
+				return (m_Flags & FLAG_MAPPABLE) != 0 && m_Tiles.size() == 1 && m_Tiles[0].codec == Codec::Stored &&
+					m_Tiles[0].offset % MAP_ALIGNMENT == 0 && m_TileSize >= math::max(m_Width, m_Height);
+			}
+
+			u64 Reader::pixel_offset() const {
+				return m_Tiles.empty() ? 0 : m_Tiles[0].offset;
+			}
+
+			math::Rect Reader::tile_rect(u32 tileX, u32 tileY) const {
+				u32 x = tileX * m_TileSize;
+				u32 y = tileY * m_TileSize;
+				return math::Rect(x, y, math::min(m_TileSize, m_Width - x), math::min(m_TileSize, m_Height - y));
+			}
+
+			bool Reader::read_tile(u32 tileX, u32 tileY, Color* dest, u32 stride) {
+				if (tileX >= m_TilesX || tileY >= m_TilesY) {
+					AMOR_LOG_ERROR("Pxim", "Tile %u,%u is outside the %ux%u tiles of the image", tileX, tileY, m_TilesX, m_TilesY);
+					return false;
+				}
+				return decode_tile(tileY * m_TilesX + tileX, tile_rect(tileX, tileY), dest, stride);
+			}
+
+			bool Reader::read_region(const math::Rect& region, Color* dest, u32 stride) {
+				if (!is_open()) {
+					AMOR_LOG_ERROR("Pxim", "Reading a region without an open file");
+					return false;
+				}
+				if (region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0 ||
+						(u32)region.x2() > m_Width || (u32)region.y2() > m_Height) {
+					AMOR_LOG_ERROR("Pxim", "Region %d,%d %dx%d is outside the %ux%u image", region.x, region.y, region.width, region.height, m_Width, m_Height);
+					return false;
+				}
+
+				struct Part {
+					u32 tile;
+					math::Rect clip;
+					Color* at;
+				};
+				std::vector<Part> parts;
+
+				u32 firstX = region.x / m_TileSize, lastX = (region.x2() - 1) / m_TileSize;
+				u32 firstY = region.y / m_TileSize, lastY = (region.y2() - 1) / m_TileSize;
+				for (u32 ty = firstY; ty <= lastY; ++ty) {
+					for (u32 tx = firstX; tx <= lastX; ++tx) {
+						math::Rect rect = tile_rect(tx, ty);
+						math::Rect clip;
+						clip.x = math::max(rect.x, region.x);
+						clip.y = math::max(rect.y, region.y);
+						clip.width = math::min(rect.x2(), region.x2()) - clip.x;
+						clip.height = math::min(rect.y2(), region.y2()) - clip.y;
+
+						Color* at = dest + (u64)(clip.y - region.y) * stride + (clip.x - region.x);
+						parts.push_back({ ty * m_TilesX + tx, clip, at });
+					}
+				}
+
+				if (m_Serial || parts.size() < 2) {
+					for (const Part& part : parts) {
+						if (!decode_tile(part.tile, part.clip, part.at, stride)) {
+							return false;
+						}
+					}
+					return true;
+				}
+
+				// the batch's compressed tiles are read in file order, then decoded in parallel. Stored
+				// tiles go straight from the file to dest
+				util::JobSystem& jobs = util::JobSystem::Get();
+				u32 batchSize = math::min((u32)parts.size(), jobs.thread_count() * 2);
+				if (m_Batch.size() < batchSize) {
+					m_Batch.resize(batchSize);
+				}
+				std::vector<u8> decoded(batchSize);
+
+				for (u32 first = 0; first < (u32)parts.size(); first += batchSize) {
+					u32 count = math::min(batchSize, (u32)parts.size() - first);
+					for (u32 i = 0; i < count; ++i) {
+						const Part& part = parts[first + i];
+						const TileEntry& entry = m_Tiles[part.tile];
+						m_File.clear();
+
+						bool read = entry.codec == Codec::Stored ?
+							read_stored_tile(entry, tile_rect(part.tile % m_TilesX, part.tile / m_TilesX), part.clip, part.at, stride) :
+							read_tile_data(entry, m_Batch[i].input);
+						if (!read) {
+							AMOR_LOG_ERROR("Pxim", "Tile %u is damaged", part.tile);
+							return false;
+						}
+					}
+
+					jobs.parallel_for(0, count, [&](u32 begin, u32 end) {
+						for (u32 i = begin; i < end; ++i) {
+							const Part& part = parts[first + i];
+							const TileEntry& entry = m_Tiles[part.tile];
+							if (entry.codec == Codec::Stored) {
+								decoded[i] = 1;
+								continue;
+							}
+
+							Scratch& scratch = m_Batch[i];
+							math::Rect rect = tile_rect(part.tile % m_TilesX, part.tile / m_TilesX);
+							decoded[i] = decode_tile_data(entry, scratch.input.data(), rect, part.clip, part.at, stride, scratch);
+						}
+					}, 1);
+
+					for (u32 i = 0; i < count; ++i) {
+						if (!decoded[i]) {
+							AMOR_LOG_ERROR("Pxim", "Tile %u is damaged", parts[first + i].tile);
+							return false;
+						}
+					}
+				}
+				return true;
+			}
+
+			bool Reader::read(Color* dest) {
+				if (is_open() && (m_Width == 0 || m_Height == 0)) {
+					return true;
+				}
+				return read_region(math::Rect(0, 0, m_Width, m_Height), dest, m_Width);
+			}
+
+			bool Reader::decode_tile(u32 tile, const math::Rect& clip, Color* dest, u32 stride) {
+				const TileEntry& entry = m_Tiles[tile];
+				math::Rect rect = tile_rect(tile % m_TilesX, tile / m_TilesX);
+
+				m_File.clear();
+				bool decoded;
+				switch (entry.codec) {
+				case Codec::Stored:
+					decoded = read_stored_tile(entry, rect, clip, dest, stride);
+					break;
+				case Codec::Deflate:
+					decoded = inflate_tile(entry, rect, clip, dest, stride);
+					break;
+				default:
+					decoded = read_tile_data(entry, m_Scratch.input) &&
+						decode_tile_data(entry, m_Scratch.input.data(), rect, clip, dest, stride, m_Scratch);
+					break;
+				}
+
+				if (!decoded) {
+					AMOR_LOG_ERROR("Pxim", "Tile %u is damaged", tile);
+				}
+				return decoded;
+			}
+
+			bool Reader::read_tile_data(const TileEntry& entry, std::vector<byte>& input) {
+				input.resize(entry.size);
+				m_File.seekg(entry.offset);
+				return (bool)m_File.read((char*)input.data(), entry.size);
+			}
+
+			bool Reader::read_stored_tile(const TileEntry& entry, const math::Rect& rect, const math::Rect& clip, Color* dest, u32 stride) {
+				u64 rowBytes = (u64)rect.width * sizeof(Color);
+
+				// whole rows into packed destination rows are one read
+				if (clip.x == rect.x && clip.width == rect.width && stride == (u32)rect.width) {
+					m_File.seekg(entry.offset + (clip.y - rect.y) * rowBytes);
+					return (bool)m_File.read((char*)dest, rowBytes * clip.height);
+				}
+
+				for (i32 row = clip.y; row < clip.y2(); ++row) {
+					m_File.seekg(entry.offset + (row - rect.y) * rowBytes + (u64)(clip.x - rect.x) * sizeof(Color));
+					if (!m_File.read((char*)(dest + (u64)(row - clip.y) * stride), (u64)clip.width * sizeof(Color))) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			bool Reader::inflate_tile(const TileEntry& entry, const math::Rect& rect, const math::Rect& clip, Color* dest, u32 stride) {
+				std::vector<byte>& input = m_Scratch.input;
+				input.resize(INPUT_CHUNK);
+
+				// the file is read a chunk at a time as the rows need it
+				m_File.seekg(entry.offset);
+				u64 remaining = entry.size;
+				InflateSource source([&](z_stream& stream) {
+					u32 chunk = (u32)math::min<u64>(remaining, input.size());
+					if (chunk == 0 || !m_File.read((char*)input.data(), chunk)) {
+						return false;
+					}
+					remaining -= chunk;
+					stream.next_in = input.data();
+					stream.avail_in = chunk;
+					return true;
+				});
+				return decode_rows(entry.filter, rect, clip, dest, stride, m_Scratch, source);
+			}
+
+		}
+	}
+}
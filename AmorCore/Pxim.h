@@ -0,0 +1,172 @@
+#pragma once
+#include "Common.h"
+#include "Core.h"
+
+#include <fstream>
+#include <vector>
+
+/*
+	PXIM, the texture file format of Texture::save/load.
+
+	Version 1 is "PXIM", width, height and one zlib stream of the RGBA pixels. Version 2 cuts the
+	image into square tiles (the ones on the right and bottom edge are cut to the image) that are
+	compressed on their own and indexed by a table after the header:
+
+		"PXIM" 0 version width height tileSize flags reserved     8 u32, the 0 is where v1 has its width
+		tile table, row major: offset (u64) size (u32) codec (u8) filter (u8) reserved (u16)
+		tile data
+
+	Numbers are big endian. A tile is its rows of RGBA pixels, compressed by the codec in its entry or
+	stored as they are when that doesn't make them smaller. The Fast codec is a byte oriented LZ77
+	(the LZ4 block layout) that decodes several times faster than deflate and compresses less, it's
+	meant for assets loaded at runtime. Deflate at its best level is for archives.
+
+	Since version 3 the rows are run through PNG's prediction filters (picked per row) before they're
+	compressed, in the layout the tile's filter byte names: RGBA, RGB with the alpha plane after it,
+	or palette indices when the tile has at most 256 colors. The layout is picked per tile by which
+	predicts best. Version 2 tiles are unfiltered RGBA.
+
+	Tiles are encoded and decoded in parallel on the shared util::JobSystem, a batch at a time so
+	only a few compressed tiles are held in memory. Only the file access is serial.
+
+	Tiles are decoded straight into the destination a row at a time while the file is read in small
+	pieces, so loading needs the pixels and little else. A region only reads the tiles it overlaps,
+	and only as far down as it goes. Version 1 files read as one tile covering the whole image.
+*/
+
+namespace amor {
+	namespace graphics {
+		struct Color;
+
+		namespace pxim {
+
+			constexpr u32 VERSION = 3;
+			constexpr u32 DEFAULT_TILE_SIZE = 256;
+
+			// header flags
+			constexpr u32 FLAG_MAPPABLE = 1;
+			// where the pixels of a mappable file start, a page on every system we run on
+			constexpr u32 MAP_ALIGNMENT = 4096;
+
+			enum class Codec : u8 {
+				Stored = 0,
+				Deflate = 1,
+				Fast = 2
+			};
+
+			// speed against size, from no compression to the smallest files
+			enum class Compression : u8 {
+				None = 0,
+				Fast = 1,
+				Default = 2,
+				Best = 3
+			};
+
+			struct WriteOptions {
+				Compression compression = Compression::Default;
+				u32 tileSize = DEFAULT_TILE_SIZE;
+				// 1 encodes on the calling thread only, anything else spreads the tiles over the shared job system
+				u32 threads = 0;
+				// the uncompressed page aligned layout that can be mapped, compression and tileSize are ignored
+				bool mappable = false;
+			};
+
+			// how a tile's rows are laid out before they're compressed
+			enum class Filter : u8 {
+				// raw RGBA, always the case for stored tiles
+				None = 0,
+				// a filter type byte and RGBA per row
+				Rows = 1,
+				// a filter type byte, RGB and then alpha per row
+				SeparateAlpha = 2,
+				// the last palette index and the RGBA palette, then a filter type byte and the indices per row
+				Palette = 3
+			};
+
+			struct TileEntry {
+				u64 offset;
+				u32 size;
+				Codec codec;
+				Filter filter;
+			};
+
+			// pixels are width x height packed rows. Logs and returns false if the file can't be written
+			bool Write(const char* filename, const Color* pixels, u32 width, u32 height, const WriteOptions& options = {});
+
+			class Reader {
+			public:
+				Reader();
+				~Reader();
+
+				Reader(const Reader&) = delete;
+				Reader& operator=(const Reader&) = delete;
+
+				// reads the header and tile table, false (logged) if it isn't a PXIM file
+				bool open(const char* filename);
+				void close();
+				inline bool is_open() const { return m_File.is_open(); }
+
+				// 1 decodes on the calling thread only, anything else spreads the tiles over the shared job system
+				inline void set_threads(u32 threads) { m_Serial = threads == 1; }
+
+				inline u32 version() const { return m_Version; }
+				inline u32 width() const { return m_Width; }
+				inline u32 height() const { return m_Height; }
+				inline u32 tile_size() const { return m_TileSize; }
+				inline u32 tiles_x() const { return m_TilesX; }
+				inline u32 tiles_y() const { return m_TilesY; }
+				inline u32 flags() const { return m_Flags; }
+
+				// the file is laid out so its pixels can be mapped, they start at pixel_offset() as
+				// width x height packed rows
+				bool is_mappable() const;
+				u64 pixel_offset() const;
+
+				// pixels of the image the tile covers
+				math::Rect tile_rect(u32 tileX, u32 tileY) const;
+				// where the tile is in the file and how it's encoded
+				inline const TileEntry& tile(u32 tileX, u32 tileY) const { return m_Tiles[(u64)tileY * m_TilesX + tileX]; }
+
+				// dest is the tile's top left pixel, stride in pixels
+				bool read_tile(u32 tileX, u32 tileY, Color* dest, u32 stride);
+				// region has to lie inside the image, dest is its top left pixel
+				bool read_region(const math::Rect& region, Color* dest, u32 stride);
+				// the whole image, dest holds width x height pixels
+				bool read(Color* dest);
+
+				// per tile decode buffers, one per tile of a parallel batch
+				struct Scratch {
+					std::vector<byte> input;
+					std::vector<byte> unpacked;
+					// rows being unfiltered
+					std::vector<byte> current, previous;
+					std::vector<Color> row;
+				};
+
+			private:
+				// decodes the part of the tile inside clip (image pixels) to dest, the top left of clip,
+				// reading the file as it goes
+				bool decode_tile(u32 tile, const math::Rect& clip, Color* dest, u32 stride);
+				bool inflate_tile(const TileEntry& entry, const math::Rect& rect, const math::Rect& clip, Color* dest, u32 stride);
+				bool read_stored_tile(const TileEntry& entry, const math::Rect& rect, const math::Rect& clip, Color* dest, u32 stride);
+				// the tile's compressed bytes into input
+				bool read_tile_data(const TileEntry& entry, std::vector<byte>& input);
+
+			private:
+				std::ifstream m_File;
+				u64 m_FileSize;
+				u32 m_Version;
+				u32 m_Flags;
+				u32 m_Width, m_Height;
+				u32 m_TileSize, m_TilesX, m_TilesY;
+				std::vector<TileEntry> m_Tiles;
+
+				bool m_Serial;
+				// buffers of the serial path, then of every tile in a parallel batch
+				Scratch m_Scratch;
+				std::vector<Scratch> m_Batch;
+			};
+
+		}
+	}
+}
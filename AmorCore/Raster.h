@@ -0,0 +1,417 @@
+#pragma once
+#include "Common.h"
+#include "Graphics.h"
+#include "SpanKernels.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+/*
+	Rasterizer internals for PrimitiveContext2D. Not meant to be included by client code.
+
+	Filled shapes are broken into clipped rows and go straight to the span kernels.
+	Outlines are written once as a template over a Writer. A Writer combines a
+	blend policy (how a pixel is combined with the destination) with a clip policy
+	(whether a pixel still needs a bounds check). Both are known at compile time so the
+	inner loops inline down to a store or a blend, no indirect call per pixel.
+
+	An outline checks its bounding box against the surface clip once. If it's fully
+	inside it is rasterized with Unclipped, only primitives crossing the edge pay for the
+	per pixel check.
+
+	Every draw call of PrimitiveContext2D is turned into a Command. In immediate mode it is
+	executed right away against the whole target, in deferred mode it is recorded and later
+	executed once per screen tile it touches (see TileRasterizer.h). Execute never writes
+	outside the clip rect of the surface it is given, that is what keeps tiles independent.
+*/
+
+namespace amor {
+	namespace graphics {
+		namespace raster {
+
+			// target of a rasterizer. x0, y0 inclusive, x1, y1 exclusive
+			struct Surface {
+				Color* pixels;
+				i32 stride;
+				i32 x0, y0, x1, y1;
+
+				inline bool contains(i32 x, i32 y) const {
+					return x >= x0 && y >= y0 && x < x1 && y < y1;
+				}
+
+				// inclusive box
+				inline bool contains(i32 minX, i32 minY, i32 maxX, i32 maxY) const {
+					return minX >= x0 && minY >= y0 && maxX < x1 && maxY < y1;
+				}
+
+				inline Color& at(i32 x, i32 y) const {
+					return pixels[(size_t)y * stride + x];
+				}
+			};
+
+			// clips dest against the surface and moves the source origin by the same amount
+			// returns false if there is nothing left to draw
+			inline bool clip_rect(const Surface& s, math::Rect& dest, i32& srcX, i32& srcY) {
+				if (dest.x < s.x0) {
+					dest.width -= s.x0 - dest.x;
+					srcX += s.x0 - dest.x;
+					dest.x = s.x0;
+				}
+				if (dest.y < s.y0) {
+					dest.height -= s.y0 - dest.y;
+					srcY += s.y0 - dest.y;
+					dest.y = s.y0;
+				}
+				if (dest.x2() > s.x1) {
+					dest.width = s.x1 - dest.x;
+				}
+				if (dest.y2() > s.y1) {
+					dest.height = s.y1 - dest.y;
+				}
+
+				return dest.width > 0 && dest.height > 0;
+			}
+
+#pragma region Commands
+			enum class Op : byte {
+				Clear = 0,
+				Plot,
+				FillRect,
+				FillEllipse,
+				DrawCircle,
+				DrawLine,
+				Blit,
+				BlitCutout,
+				BlitUpscaled,
+			};
+
+			// one recorded draw call, the meaning of a and b depends on op:
+			// FillRect     -> width, height
+			// FillEllipse  -> radius x, radius y
+			// DrawCircle   -> radius
+			// DrawLine     -> end point
+			// BlitUpscaled -> scale x, scale y
+			// for BlitCutout color is the cutout key. The texture is not owned and has to
+			// outlive the command
+			struct Command {
+				Op op;
+				BlendMode mode;
+				i32 x, y;
+				i32 a, b;
+				Color color;
+				const Texture* texture;
+			};
+
+			// rasterizes cmd into the clip rect of surface
+			void Execute(const Command& cmd, const Surface& surface);
+			// a DrawCircle command from its octant (see circle_octant), what the tiles use so the octant is
+			// only walked once per circle
+			void ExecuteCircle(const Command& cmd, const Surface& surface, const i32* octant, u32 count);
+
+			// screen area cmd can touch, x1 and y1 exclusive. Conservative, used for binning.
+			// returns false if the command draws nothing
+			bool Bounds(const Command& cmd, i32& x0, i32& y0, i32& x1, i32& y1);
+#pragma endregion
+
+#pragma region Policies
+			struct Overwrite {
+				static constexpr BlendMode mode = BlendMode::None;
+				static inline void apply(Color& dst, const Color& src) { dst = src; }
+			};
+
+			template<BlendMode Mode, Color(*Blend)(const Color&, const Color&)>
+			struct Blended {
+				static constexpr BlendMode mode = Mode;
+				static inline void apply(Color& dst, const Color& src) { dst = Blend(src, dst); }
+			};
+
+			struct Clipped {
+				static inline bool accept(const Surface& s, i32 x, i32 y) { return s.contains(x, y); }
+			};
+
+			// clipping has already been done for the whole primitive
+			struct Unclipped {
+				static inline bool accept(const Surface&, i32, i32) { return true; }
+			};
+
+			template<typename BlendPolicy, typename ClipPolicy>
+			struct Writer {
+				Surface surface;
+
+				inline void plot(i32 x, i32 y, const Color& color) const {
+					if (!ClipPolicy::accept(surface, x, y)) return;
+					BlendPolicy::apply(surface.at(x, y), color);
+				}
+
+			};
+
+			// calls f with the Writer matching mode and clip, the branch happens once per primitive
+			template<typename ClipPolicy, typename F>
+			inline void with_blend(BlendMode mode, const Surface& surface, F&& f) {
+				switch (mode) {
+				case BlendMode::Normal: f(Writer<Blended<BlendMode::Normal, kernels::BlendNormal>, ClipPolicy>{ surface }); break;
+				case BlendMode::Additive: f(Writer<Blended<BlendMode::Additive, kernels::BlendAdditive>, ClipPolicy>{ surface }); break;
+				case BlendMode::Multiply: f(Writer<Blended<BlendMode::Multiply, kernels::BlendMultiply>, ClipPolicy>{ surface }); break;
+				case BlendMode::Screen: f(Writer<Blended<BlendMode::Screen, kernels::BlendScreen>, ClipPolicy>{ surface }); break;
+				case BlendMode::PremultipliedOver: f(Writer<Blended<BlendMode::PremultipliedOver, kernels::BlendPremultipliedOver>, ClipPolicy>{ surface }); break;
+				default: f(Writer<Overwrite, ClipPolicy>{ surface }); break;
+				}
+			}
+
+			template<typename F>
+			inline void dispatch(BlendMode mode, const Surface& surface, bool clip, F&& f) {
+				if (clip) {
+					with_blend<Clipped>(mode, surface, f);
+				}
+				else {
+					with_blend<Unclipped>(mode, surface, f);
+				}
+			}
+#pragma endregion
+#pragma region Primitives
+			// one half of a Bresenham line: dMajor steps along the major axis from (major, minor), the minor
+			// coordinate moves by dir whenever the error term says so. A zero error steps when ties is 0 (the
+			// x major half) and doesn't when it's 1 (the y major half). Only the steps with the major coordinate
+			// in [majorLo, majorHi) and the minor one in [minorLo, minorHi) are walked. The minor steps taken
+			// after k major steps are floor((2 dMinor k + dMajor - ties) / (2 dMajor)), so the walk starts right
+			// at the clip with the error term it would have had there
+			template<typename Plot>
+			inline void line_steps(i32 major, i32 minor, i32 dir, i32 dMajor, i32 dMinor, i32 ties,
+					i32 majorLo, i32 majorHi, i32 minorLo, i32 minorHi, Plot&& plot) {
+				auto steps = [&](i64 k) -> i64 {
+					return dMajor == 0 ? 0 : (2 * (i64)dMinor * k + dMajor - ties) / (2 * (i64)dMajor);
+				};
+
+				i64 first = math::max<i64>(0, (i64)majorLo - major);
+				i64 last = math::min<i64>(dMajor, (i64)majorHi - 1 - major);
+				// minor steps that keep the minor coordinate inside
+				i64 stepsLo = dir > 0 ? (i64)minorLo - minor : (i64)minor - (minorHi - 1);
+				i64 stepsHi = dir > 0 ? (i64)minorHi - 1 - minor : (i64)minor - minorLo;
+				if (first > last || stepsLo > stepsHi) return;
+
+				// the minor steps only grow with k, the first k reaching stepsLo and the last one not past stepsHi
+				i64 lo = first, hi = last + 1;
+				while (lo < hi) {
+					i64 mid = (lo + hi) / 2;
+					if (steps(mid) >= stepsLo) hi = mid;
+					else lo = mid + 1;
+				}
+				first = lo;
+
+				hi = last + 1;
+				while (lo < hi) {
+					i64 mid = (lo + hi) / 2;
+					if (steps(mid) > stepsHi) hi = mid;
+					else lo = mid + 1;
+				}
+				last = lo - 1;
+				if (first > last) return;
+
+				i64 taken = steps(first);
+				i32 a = major + (i32)first;
+				i32 b = minor + dir * (i32)taken;
+				i32 error = (i32)(2 * (i64)dMinor * (first + 1) - dMajor - 2 * (i64)dMajor * taken);
+
+				plot(a, b);
+				for (i64 k = first; k < last; ++k) {
+					++a;
+					if (error < ties) {
+						error = error + 2 * dMinor;
+					}
+					else {
+						b += dir;
+						error = error + 2 * (dMinor - dMajor);
+					}
+					plot(a, b);
+				}
+			}
+
+			// Bresenham's Line algorithm. Only the part inside the writer's surface is walked, so a line binned
+			// into many tiles costs each tile its own pixels. The pixels are the ones the whole walk plots
+			template<typename W>
+			void line(const W& w, i32 x1, i32 y1, i32 x2, i32 y2, const Color& color) {
+				i32 dx = x2 - x1;
+				i32 dy = y2 - y1;
+				i32 dx1 = dx < 0 ? -dx : dx;
+				i32 dy1 = dy < 0 ? -dy : dy;
+
+				// both ends step in the same direction
+				const bool sameSign = (dx < 0 && dy < 0) || (dx > 0 && dy > 0);
+				const Surface& s = w.surface;
+
+				if (dy1 <= dx1) {
+					// left to right
+					i32 x = dx >= 0 ? x1 : x2;
+					i32 y = dx >= 0 ? y1 : y2;
+					line_steps(x, y, sameSign ? 1 : -1, dx1, dy1, 0, s.x0, s.x1, s.y0, s.y1,
+						[&](i32 major, i32 minor) { w.plot(major, minor, color); });
+				}
+				else {
+					// top to bottom
+					i32 x = dy >= 0 ? x1 : x2;
+					i32 y = dy >= 0 ? y1 : y2;
+					line_steps(y, x, sameSign ? 1 : -1, dy1, dx1, 1, s.y0, s.y1, s.x0, s.x1,
+						[&](i32 major, i32 minor) { w.plot(minor, major, color); });
+				}
+			}
+
+			template<typename W>
+			inline void plot8(const W& w, i32 xc, i32 yc, i32 x, i32 y, const Color& color) {
+				w.plot(xc + x, yc + y, color);
+				w.plot(xc - x, yc + y, color);
+				w.plot(xc + x, yc - y, color);
+				w.plot(xc - x, yc - y, color);
+				w.plot(xc + y, yc + x, color);
+				w.plot(xc - y, yc + x, color);
+				w.plot(xc + y, yc - x, color);
+				w.plot(xc - y, yc - x, color);
+			}
+
+			// bresenham's circle algorithm
+			template<typename W>
+			void circle(const W& w, i32 x, i32 y, i32 radius, const Color& color) {
+				i32 xx = 0;
+				i32 yy = radius;
+				i32 d = 3 - (2 * radius);
+				plot8(w, x, y, xx, yy, color);
+
+				while (yy >= xx) {
+					xx++;
+
+					if (d > 0) {
+						--yy;
+						d = d + 4 * (xx - yy) + 10;
+					}
+					else {
+						d = d + 4 * xx + 6;
+					}
+
+					plot8(w, x, y, xx, yy, color);
+				}
+			}
+
+			// the octant circle() walks, appended to octant: entry k is the y plotted at x = k (mirrored 8 ways).
+			// Stored without sign, the mirroring covers both. From radius 1 up it never grows
+			inline void circle_octant(i32 radius, std::vector<i32>& octant) {
+				i32 xx = 0;
+				i32 yy = radius;
+				i32 d = 3 - (2 * radius);
+				octant.push_back(std::abs(yy));
+
+				while (yy >= xx) {
+					xx++;
+
+					if (d > 0) {
+						--yy;
+						d = d + 4 * (xx - yy) + 10;
+					}
+					else {
+						d = d + 4 * xx + 6;
+					}
+
+					octant.push_back(std::abs(yy));
+				}
+			}
+
+			// distances from 0 covered by [lo, hi], false if it's empty
+			inline bool distance_range(i32 lo, i32 hi, i32& dmin, i32& dmax) {
+				if (hi < lo) return false;
+				if (lo >= 0) { dmin = lo; dmax = hi; }
+				else if (hi <= 0) { dmin = -hi; dmax = -lo; }
+				else { dmin = 0; dmax = math::max(-lo, hi); }
+				return true;
+			}
+
+			// circle() from an octant of circle_octant, plotting only the steps that can land inside the writer's
+			// surface. Both coordinates of the octant are monotonic, so those steps are found by binary search and
+			// a tile of a large circle costs its own pixels. The pixels, and how often each is plotted, are circle()'s
+			template<typename W>
+			void circle_clipped(const W& w, i32 x, i32 y, const i32* octant, u32 count, const Color& color) {
+				const Surface& s = w.surface;
+				i32 rowMin, rowMax, colMin, colMax;
+				if (!distance_range(s.y0 - y, s.y1 - 1 - y, rowMin, rowMax) || !distance_range(s.x0 - x, s.x1 - 1 - x, colMin, colMax)) {
+					return;
+				}
+
+				// the steps with k in [kMin, kMax] and octant[k] in [vMin, vMax]
+				auto range = [&](i32 kMin, i32 kMax, i32 vMin, i32 vMax, u32& begin, u32& end) {
+					begin = 0;
+					end = count;
+					// short octants (radius 0 among them) aren't monotonic, the writer clips them
+					if (count < 16) return;
+
+					begin = (u32)(std::lower_bound(octant, octant + count, vMax, std::greater<i32>()) - octant);
+					end = (u32)(std::upper_bound(octant, octant + count, vMin, std::greater<i32>()) - octant);
+					begin = math::max(begin, (u32)kMin);
+					end = math::min(end, (u32)math::min<i64>((i64)kMax + 1, count));
+				};
+
+				// the first half of plot8, x offset k and y offset octant[k]
+				u32 begin, end;
+				range(colMin, colMax, rowMin, rowMax, begin, end);
+				for (u32 k = begin; k < end; ++k) {
+					i32 v = octant[k];
+					w.plot(x + (i32)k, y + v, color);
+					w.plot(x - (i32)k, y + v, color);
+					w.plot(x + (i32)k, y - v, color);
+					w.plot(x - (i32)k, y - v, color);
+				}
+
+				// and the second, swapped
+				range(rowMin, rowMax, colMin, colMax, begin, end);
+				for (u32 k = begin; k < end; ++k) {
+					i32 v = octant[k];
+					w.plot(x + v, y + (i32)k, color);
+					w.plot(x - v, y + (i32)k, color);
+					w.plot(x + v, y - (i32)k, color);
+					w.plot(x - v, y - (i32)k, color);
+				}
+			}
+
+			// fills [xa, xb) on row y, clipped against the surface
+			inline void hspan(const Surface& s, kernels::BlendFillFn fill, i32 xa, i32 xb, i32 y, const Color& color) {
+				if (y < s.y0 || y >= s.y1) return;
+				if (xa < s.x0) xa = s.x0;
+				if (xb > s.x1) xb = s.x1;
+				if (xb <= xa) return;
+				fill(&s.at(xa, y), color, (u32)(xb - xa));
+			}
+
+			// filled ellipse, one span per row. Covers the pixels where
+			// dx*dx * ry*ry + dy*dy * rx*rx < rx*rx * ry*ry - rx * ry * min(rx, ry)
+			// which for rx == ry == r is dx*dx + dy*dy < r*r - r, the coverage FillCircle always had.
+			// The half width only shrinks while walking away from the center so it is tracked
+			// incrementally, O(rx + ry) in total
+			inline void fill_ellipse(const Surface& s, kernels::BlendFillFn fill, i32 x, i32 y, i32 rx, i32 ry, const Color& color) {
+				if (rx <= 0 || ry <= 0) return;
+
+				const i64 rx2 = (i64)rx * rx;
+				const i64 ry2 = (i64)ry * ry;
+				const i64 limit = rx2 * ry2 - (i64)rx * ry * (rx < ry ? rx : ry);
+
+				i64 h = rx - 1;
+				for (i64 dy = 0; dy < ry; ++dy) {
+					const i64 t = limit - dy * dy * rx2;
+					while (h >= 0 && h * h * ry2 >= t) --h;
+					if (h < 0) break;
+
+					hspan(s, fill, x - (i32)h, x + (i32)h + 1, y + (i32)dy, color);
+					if (dy) hspan(s, fill, x - (i32)h, x + (i32)h + 1, y - (i32)dy, color);
+				}
+			}
+
+			// blits width x height pixels from src (row pitch srcStride) to x, y skipping the cutout color
+			template<typename W>
+			void blit_cutout(const W& w, i32 x, i32 y, const Color* src, i32 srcStride, i32 width, i32 height, const Color& cutout) {
+				for (i32 j = 0; j < height; ++j, src += srcStride) {
+					for (i32 i = 0; i < width; ++i) {
+						if (src[i] == cutout) continue;
+						w.plot(x + i, y + j, src[i]);
+					}
+				}
+			}
+#pragma endregion
+		}
+	}
+}
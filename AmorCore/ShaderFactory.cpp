@@ -118,7 +118,7 @@ namespace amor {
 
 				void ShaderFactory::InsertFromSource(const char* filename) {
 					if (!std::filesystem::exists(filename)) {
-						logging::GetInstance()->error("File '" + std::string(filename) + "' does not exist");
+						AMOR_LOG_ERROR("", "File '%s' does not exist", filename);
 						return;
 					}
 
@@ -181,6 +181,7 @@ namespace amor {
 
 
 				Shader ShaderFactory::CompileGlProgram() const {
+					AMOR_PROFILE_SCOPE("ShaderFactory::CompileGlProgram");
 					constexpr i32 BUFFER_SIZE = 1024;
 					u32 vID, fID, pID;
 					const i8* sourcePtr = m_VertexShader.c_str();
@@ -16,6 +16,8 @@ namespace amor {
 				constexpr i32 AUTO_LAYOUT = -1;
 				constexpr i32 NO_LAYOUT = -2;
 
+				// shared handle to a linked program, the program is deleted with the last copy. Copies may be
+				// passed between threads, the last one still has to go away on the thread owning the GL context
 				class Shader {
 					friend class ShaderFactory;
 				public:
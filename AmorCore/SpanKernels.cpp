@@ -0,0 +1,431 @@
+#include "pch.h"
+#include "SpanKernels.h"
+
+#include <cstring>
+
+#if !defined(AMOR_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define AMOR_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AMOR_TARGET_AVX2
+#else
+#define AMOR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace amor {
+	namespace graphics {
+		namespace kernels {
+
+			static_assert(sizeof(Color) == sizeof(u32), "span kernels expect a tightly packed 32 bit Color");
+
+			static inline u32 pack(const Color& color) {
+				u32 value;
+				std::memcpy(&value, &color, sizeof(u32));
+				return value;
+			}
+
+#pragma region Scalar
+			static void fill_scalar(Color* dst, const Color& color, u32 count) {
+				std::fill(dst, dst + count, color);
+			}
+
+			static void copy_scalar(Color* dst, const Color* src, u32 count) {
+				std::memcpy(dst, src, (size_t)count * sizeof(Color));
+			}
+
+			static void copy_keyed_scalar(Color* dst, const Color* src, u32 count, const Color& key) {
+				for (u32 i = 0; i < count; ++i) {
+					if (src[i] != key) dst[i] = src[i];
+				}
+			}
+
+			template<Color(*Blend)(const Color&, const Color&)>
+			static void blend_scalar(Color* dst, const Color* src, u32 count) {
+				for (u32 i = 0; i < count; ++i) {
+					dst[i] = Blend(src[i], dst[i]);
+				}
+			}
+
+			template<Color(*Blend)(const Color&, const Color&)>
+			static void blend_fill_scalar(Color* dst, const Color& color, u32 count) {
+				for (u32 i = 0; i < count; ++i) {
+					dst[i] = Blend(color, dst[i]);
+				}
+			}
+#pragma endregion
+#ifdef AMOR_SIMD_X86
+#pragma region SSE2
+			static void fill_sse2(Color* dst, const Color& color, u32 count) {
+				const __m128i value = _mm_set1_epi32((i32)pack(color));
+				u32 i = 0;
+				for (; i + 4 <= count; i += 4) {
+					_mm_storeu_si128((__m128i*)(dst + i), value);
+				}
+				for (; i < count; ++i) {
+					dst[i] = color;
+				}
+			}
+
+			static void copy_sse2(Color* dst, const Color* src, u32 count) {
+				u32 i = 0;
+				for (; i + 4 <= count; i += 4) {
+					_mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+				}
+				for (; i < count; ++i) {
+					dst[i] = src[i];
+				}
+			}
+
+			static void copy_keyed_sse2(Color* dst, const Color* src, u32 count, const Color& key) {
+				const __m128i keyValue = _mm_set1_epi32((i32)pack(key));
+				u32 i = 0;
+				for (; i + 4 <= count; i += 4) {
+					__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+					__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+					__m128i mask = _mm_cmpeq_epi32(s, keyValue);
+
+					// keep the destination where the source matched the key
+					__m128i out = _mm_or_si128(_mm_and_si128(mask, d), _mm_andnot_si128(mask, s));
+					_mm_storeu_si128((__m128i*)(dst + i), out);
+				}
+				for (; i < count; ++i) {
+					if (src[i] != key) dst[i] = src[i];
+				}
+			}
+
+			/*
+				The blend kernels widen 2 pixels at a time to 16 bits per channel. Every blend op
+				receives the source, the destination and the source alpha broadcast over the 4
+				channels of its pixel. No intermediate exceeds 255 * 255 + 255 so everything fits
+				into unsigned 16 bit lanes, the final pack saturates to 0..255.
+			*/
+			static inline __m128i div255_sse2(__m128i x) {
+				x = _mm_add_epi16(x, _mm_set1_epi16(128));
+				return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+			}
+
+			// lanes 3 and 7 hold the alpha channel of the two pixels
+			static inline __m128i alpha_lanes_sse2() {
+				return _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+			}
+
+			static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b) {
+				return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+			}
+
+			static inline __m128i alpha16_sse2(__m128i px16) {
+				return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			}
+
+			static inline __m128i over_alpha_sse2(__m128i a16, __m128i d16, __m128i ia16) {
+				return _mm_add_epi16(a16, div255_sse2(_mm_mullo_epi16(d16, ia16)));
+			}
+#pragma endregion
+#pragma region AVX2
+			AMOR_TARGET_AVX2 static void fill_avx2(Color* dst, const Color& color, u32 count) {
+				const __m256i value = _mm256_set1_epi32((i32)pack(color));
+				u32 i = 0;
+				for (; i + 8 <= count; i += 8) {
+					_mm256_storeu_si256((__m256i*)(dst + i), value);
+				}
+				for (; i < count; ++i) {
+					dst[i] = color;
+				}
+			}
+
+			AMOR_TARGET_AVX2 static void copy_avx2(Color* dst, const Color* src, u32 count) {
+				u32 i = 0;
+				for (; i + 8 <= count; i += 8) {
+					_mm256_storeu_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
+				}
+				for (; i < count; ++i) {
+					dst[i] = src[i];
+				}
+			}
+
+			AMOR_TARGET_AVX2 static void copy_keyed_avx2(Color* dst, const Color* src, u32 count, const Color& key) {
+				const __m256i keyValue = _mm256_set1_epi32((i32)pack(key));
+				u32 i = 0;
+				for (; i + 8 <= count; i += 8) {
+					__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+					__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+					__m256i mask = _mm256_cmpeq_epi32(s, keyValue);
+					_mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(s, d, mask));
+				}
+				for (; i < count; ++i) {
+					if (src[i] != key) dst[i] = src[i];
+				}
+			}
+
+			// same layout as the sse2 helpers, 4 pixels per register
+			AMOR_TARGET_AVX2 static inline __m256i div255_avx2(__m256i x) {
+				x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+				return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+			}
+
+			AMOR_TARGET_AVX2 static inline __m256i alpha_lanes_avx2() {
+				return _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+			}
+
+			AMOR_TARGET_AVX2 static inline __m256i alpha16_avx2(__m256i px16) {
+				return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			}
+
+			AMOR_TARGET_AVX2 static inline __m256i over_alpha_avx2(__m256i a16, __m256i d16, __m256i ia16) {
+				return _mm256_add_epi16(a16, div255_avx2(_mm256_mullo_epi16(d16, ia16)));
+			}
+#pragma endregion
+#pragma region Blend Ops
+			struct NormalOp {
+				static Color pixel(const Color& s, const Color& d) { return BlendNormal(s, d); }
+
+				// forcing the source alpha lane to 255 turns the color formula into the over formula for alpha
+				static inline __m128i sse2(__m128i s16, __m128i d16, __m128i a16) {
+					__m128i ia16 = _mm_sub_epi16(_mm_set1_epi16(255), a16);
+					__m128i s = _mm_or_si128(s16, _mm_and_si128(alpha_lanes_sse2(), _mm_set1_epi16(255)));
+					return div255_sse2(_mm_add_epi16(_mm_mullo_epi16(s, a16), _mm_mullo_epi16(d16, ia16)));
+				}
+				AMOR_TARGET_AVX2 static inline __m256i avx2(__m256i s16, __m256i d16, __m256i a16) {
+					__m256i ia16 = _mm256_sub_epi16(_mm256_set1_epi16(255), a16);
+					__m256i s = _mm256_or_si256(s16, _mm256_and_si256(alpha_lanes_avx2(), _mm256_set1_epi16(255)));
+					return div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(s, a16), _mm256_mullo_epi16(d16, ia16)));
+				}
+			};
+
+			struct AdditiveOp {
+				static Color pixel(const Color& s, const Color& d) { return BlendAdditive(s, d); }
+
+				static inline __m128i sse2(__m128i s16, __m128i d16, __m128i a16) {
+					__m128i ia16 = _mm_sub_epi16(_mm_set1_epi16(255), a16);
+					__m128i rgb = _mm_add_epi16(d16, div255_sse2(_mm_mullo_epi16(s16, a16)));
+					return select_sse2(alpha_lanes_sse2(), over_alpha_sse2(a16, d16, ia16), rgb);
+				}
+				AMOR_TARGET_AVX2 static inline __m256i avx2(__m256i s16, __m256i d16, __m256i a16) {
+					__m256i ia16 = _mm256_sub_epi16(_mm256_set1_epi16(255), a16);
+					__m256i rgb = _mm256_add_epi16(d16, div255_avx2(_mm256_mullo_epi16(s16, a16)));
+					return _mm256_blendv_epi8(rgb, over_alpha_avx2(a16, d16, ia16), alpha_lanes_avx2());
+				}
+			};
+
+			struct MultiplyOp {
+				static Color pixel(const Color& s, const Color& d) { return BlendMultiply(s, d); }
+
+				static inline __m128i sse2(__m128i s16, __m128i d16, __m128i a16) {
+					__m128i ia16 = _mm_sub_epi16(_mm_set1_epi16(255), a16);
+					__m128i m = div255_sse2(_mm_mullo_epi16(s16, d16));
+					__m128i rgb = div255_sse2(_mm_add_epi16(_mm_mullo_epi16(m, a16), _mm_mullo_epi16(d16, ia16)));
+					return select_sse2(alpha_lanes_sse2(), over_alpha_sse2(a16, d16, ia16), rgb);
+				}
+				AMOR_TARGET_AVX2 static inline __m256i avx2(__m256i s16, __m256i d16, __m256i a16) {
+					__m256i ia16 = _mm256_sub_epi16(_mm256_set1_epi16(255), a16);
+					__m256i m = div255_avx2(_mm256_mullo_epi16(s16, d16));
+					__m256i rgb = div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(m, a16), _mm256_mullo_epi16(d16, ia16)));
+					return _mm256_blendv_epi8(rgb, over_alpha_avx2(a16, d16, ia16), alpha_lanes_avx2());
+				}
+			};
+
+			struct ScreenOp {
+				static Color pixel(const Color& s, const Color& d) { return BlendScreen(s, d); }
+
+				static inline __m128i sse2(__m128i s16, __m128i d16, __m128i a16) {
+					__m128i ia16 = _mm_sub_epi16(_mm_set1_epi16(255), a16);
+					__m128i scr = _mm_sub_epi16(_mm_add_epi16(s16, d16), div255_sse2(_mm_mullo_epi16(s16, d16)));
+					__m128i rgb = div255_sse2(_mm_add_epi16(_mm_mullo_epi16(scr, a16), _mm_mullo_epi16(d16, ia16)));
+					return select_sse2(alpha_lanes_sse2(), over_alpha_sse2(a16, d16, ia16), rgb);
+				}
+				AMOR_TARGET_AVX2 static inline __m256i avx2(__m256i s16, __m256i d16, __m256i a16) {
+					__m256i ia16 = _mm256_sub_epi16(_mm256_set1_epi16(255), a16);
+					__m256i scr = _mm256_sub_epi16(_mm256_add_epi16(s16, d16), div255_avx2(_mm256_mullo_epi16(s16, d16)));
+					__m256i rgb = div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(scr, a16), _mm256_mullo_epi16(d16, ia16)));
+					return _mm256_blendv_epi8(rgb, over_alpha_avx2(a16, d16, ia16), alpha_lanes_avx2());
+				}
+			};
+
+			// the source alpha lane already holds a, so alpha needs no special casing
+			struct PremultipliedOverOp {
+				static Color pixel(const Color& s, const Color& d) { return BlendPremultipliedOver(s, d); }
+
+				static inline __m128i sse2(__m128i s16, __m128i d16, __m128i a16) {
+					__m128i ia16 = _mm_sub_epi16(_mm_set1_epi16(255), a16);
+					return _mm_add_epi16(s16, div255_sse2(_mm_mullo_epi16(d16, ia16)));
+				}
+				AMOR_TARGET_AVX2 static inline __m256i avx2(__m256i s16, __m256i d16, __m256i a16) {
+					__m256i ia16 = _mm256_sub_epi16(_mm256_set1_epi16(255), a16);
+					return _mm256_add_epi16(s16, div255_avx2(_mm256_mullo_epi16(d16, ia16)));
+				}
+			};
+#pragma endregion
+#pragma region Blend Kernels
+			// 4 pixels per step
+			template<typename Op>
+			static void blend_sse2(Color* dst, const Color* src, u32 count) {
+				const __m128i zero = _mm_setzero_si128();
+				u32 i = 0;
+				for (; i + 4 <= count; i += 4) {
+					__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+					__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+					__m128i slo = _mm_unpacklo_epi8(s, zero);
+					__m128i shi = _mm_unpackhi_epi8(s, zero);
+
+					__m128i lo = Op::sse2(slo, _mm_unpacklo_epi8(d, zero), alpha16_sse2(slo));
+					__m128i hi = Op::sse2(shi, _mm_unpackhi_epi8(d, zero), alpha16_sse2(shi));
+					_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+				}
+				blend_scalar<Op::pixel>(dst + i, src + i, count - i);
+			}
+
+			template<typename Op>
+			static void blend_fill_sse2(Color* dst, const Color& color, u32 count) {
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i s16 = _mm_unpacklo_epi8(_mm_set1_epi32((i32)pack(color)), zero);
+				const __m128i a16 = alpha16_sse2(s16);
+
+				u32 i = 0;
+				for (; i + 4 <= count; i += 4) {
+					__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+					__m128i lo = Op::sse2(s16, _mm_unpacklo_epi8(d, zero), a16);
+					__m128i hi = Op::sse2(s16, _mm_unpackhi_epi8(d, zero), a16);
+					_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+				}
+				blend_fill_scalar<Op::pixel>(dst + i, color, count - i);
+			}
+
+			// 8 pixels per register. unpack and pack both work per 128 bit lane so pixel order is preserved
+			template<typename Op>
+			AMOR_TARGET_AVX2 static inline __m256i blend8_avx2(__m256i s, __m256i d) {
+				const __m256i zero = _mm256_setzero_si256();
+				__m256i slo = _mm256_unpacklo_epi8(s, zero);
+				__m256i shi = _mm256_unpackhi_epi8(s, zero);
+
+				__m256i lo = Op::avx2(slo, _mm256_unpacklo_epi8(d, zero), alpha16_avx2(slo));
+				__m256i hi = Op::avx2(shi, _mm256_unpackhi_epi8(d, zero), alpha16_avx2(shi));
+				return _mm256_packus_epi16(lo, hi);
+			}
+
+			template<typename Op>
+			AMOR_TARGET_AVX2 static void blend_avx2(Color* dst, const Color* src, u32 count) {
+				u32 i = 0;
+				// 16 pixels per step, two independent halves to keep both multipliers busy
+				for (; i + 16 <= count; i += 16) {
+					__m256i s0 = _mm256_loadu_si256((const __m256i*)(src + i));
+					__m256i s1 = _mm256_loadu_si256((const __m256i*)(src + i + 8));
+					__m256i d0 = _mm256_loadu_si256((const __m256i*)(dst + i));
+					__m256i d1 = _mm256_loadu_si256((const __m256i*)(dst + i + 8));
+					_mm256_storeu_si256((__m256i*)(dst + i), blend8_avx2<Op>(s0, d0));
+					_mm256_storeu_si256((__m256i*)(dst + i + 8), blend8_avx2<Op>(s1, d1));
+				}
+				for (; i + 8 <= count; i += 8) {
+					__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+					__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+					_mm256_storeu_si256((__m256i*)(dst + i), blend8_avx2<Op>(s, d));
+				}
+				blend_sse2<Op>(dst + i, src + i, count - i);
+			}
+
+			template<typename Op>
+			AMOR_TARGET_AVX2 static void blend_fill_avx2(Color* dst, const Color& color, u32 count) {
+				const __m256i zero = _mm256_setzero_si256();
+				const __m256i s16 = _mm256_unpacklo_epi8(_mm256_set1_epi32((i32)pack(color)), zero);
+				const __m256i a16 = alpha16_avx2(s16);
+
+				u32 i = 0;
+				for (; i + 8 <= count; i += 8) {
+					__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+					__m256i lo = Op::avx2(s16, _mm256_unpacklo_epi8(d, zero), a16);
+					__m256i hi = Op::avx2(s16, _mm256_unpackhi_epi8(d, zero), a16);
+					_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+				}
+				blend_fill_sse2<Op>(dst + i, color, count - i);
+			}
+#pragma endregion
+#endif // AMOR_SIMD_X86
+
+			// the blend tables follow the order of the BlendMode enum
+			static_assert(BLEND_MODE_COUNT == 6, "kernels_for needs a kernel for every BlendMode");
+
+			static SpanKernels kernels_for(SimdLevel level) {
+				switch (level) {
+#ifdef AMOR_SIMD_X86
+				case SimdLevel::AVX2:
+					return {
+						fill_avx2, copy_avx2, copy_keyed_avx2,
+						{ copy_avx2, blend_avx2<NormalOp>, blend_avx2<AdditiveOp>, blend_avx2<MultiplyOp>, blend_avx2<ScreenOp>, blend_avx2<PremultipliedOverOp> },
+						{ fill_avx2, blend_fill_avx2<NormalOp>, blend_fill_avx2<AdditiveOp>, blend_fill_avx2<MultiplyOp>, blend_fill_avx2<ScreenOp>, blend_fill_avx2<PremultipliedOverOp> },
+					};
+				case SimdLevel::SSE2:
+					return {
+						fill_sse2, copy_sse2, copy_keyed_sse2,
+						{ copy_sse2, blend_sse2<NormalOp>, blend_sse2<AdditiveOp>, blend_sse2<MultiplyOp>, blend_sse2<ScreenOp>, blend_sse2<PremultipliedOverOp> },
+						{ fill_sse2, blend_fill_sse2<NormalOp>, blend_fill_sse2<AdditiveOp>, blend_fill_sse2<MultiplyOp>, blend_fill_sse2<ScreenOp>, blend_fill_sse2<PremultipliedOverOp> },
+					};
+#endif
+				default:
+					return {
+						fill_scalar, copy_scalar, copy_keyed_scalar,
+						{ copy_scalar, blend_scalar<BlendNormal>, blend_scalar<BlendAdditive>, blend_scalar<BlendMultiply>, blend_scalar<BlendScreen>, blend_scalar<BlendPremultipliedOver> },
+						{ fill_scalar, blend_fill_scalar<BlendNormal>, blend_fill_scalar<BlendAdditive>, blend_fill_scalar<BlendMultiply>, blend_fill_scalar<BlendScreen>, blend_fill_scalar<BlendPremultipliedOver> },
+					};
+				}
+			}
+
+			SimdLevel DetectSimdLevel() {
+#ifdef AMOR_SIMD_X86
+#ifdef _MSC_VER
+				i32 info[4];
+				__cpuid(info, 0);
+				i32 maxLeaf = info[0];
+
+				__cpuid(info, 1);
+				bool sse2 = (info[3] & (1 << 26)) != 0;
+				bool osxsave = (info[2] & (1 << 27)) != 0;
+				bool avx = (info[2] & (1 << 28)) != 0;
+
+				bool avx2 = false;
+				// the os must also save the ymm registers on context switch
+				if (osxsave && avx && (_xgetbv(0) & 0x6) == 0x6 && maxLeaf >= 7) {
+					__cpuidex(info, 7, 0);
+					avx2 = (info[1] & (1 << 5)) != 0;
+				}
+#else
+				__builtin_cpu_init();
+				bool sse2 = __builtin_cpu_supports("sse2");
+				bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+				if (avx2) return SimdLevel::AVX2;
+				if (sse2) return SimdLevel::SSE2;
+#endif
+				return SimdLevel::Scalar;
+			}
+
+			static SimdLevel& active_level() {
+				static SimdLevel s_Level = DetectSimdLevel();
+				return s_Level;
+			}
+
+			static SpanKernels& active_kernels() {
+				static SpanKernels s_Kernels = kernels_for(active_level());
+				return s_Kernels;
+			}
+
+			SimdLevel ActiveSimdLevel() {
+				return active_level();
+			}
+
+			void SetSimdLevel(SimdLevel level) {
+				SimdLevel supported = DetectSimdLevel();
+				if ((i32)level > (i32)supported) {
+					level = supported;
+				}
+
+				active_level() = level;
+				active_kernels() = kernels_for(level);
+			}
+
+			const SpanKernels& Active() {
+				return active_kernels();
+			}
+		}
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include "Common.h"
+#include "Graphics.h"
+
+/*
+	Row (span) kernels used by the software rasterizer in PrimitiveContext2D.
+	Every rectangular primitive is clipped once and then broken down into rows, each row
+	is handed to one of the kernels below which operate on a contiguous run of pixels.
+
+	The kernels come in a scalar, SSE2 and AVX2 flavour. The best set supported by the
+	running cpu is selected the first time any kernel is used. Define AMOR_NO_SIMD to
+	compile the scalar kernels only (e.g. for non-x86 targets).
+
+	Every blend mode has its own kernel, picking the mode happens once per span and never
+	inside the pixel loop. The inline Blend* functions below are the per pixel reference the
+	simd kernels are checked against.
+*/
+
+namespace amor {
+	namespace graphics {
+		namespace kernels {
+
+			enum class SimdLevel {
+				Scalar = 0,
+				SSE2,
+				AVX2,
+			};
+
+			// round(x / 255) without a divide, exact for x <= 255 * 255
+			inline byte div255(u32 x) {
+				x += 128;
+				return (byte)((x + (x >> 8)) >> 8);
+			}
+
+			inline byte saturate(u32 x) {
+				return (byte)(x > 255 ? 255 : x);
+			}
+
+			// porter-duff "over" for the alpha channel, shared by all the straight alpha modes
+			inline byte over_alpha(u32 a, u32 dstA) {
+				return (byte)(a + div255(dstA * (255 - a)));
+			}
+
+			// 8 bit fixed point alpha blend: (src * a + dst * (255 - a)) / 255, rounded.
+			// Within 1 of the floating point result
+			inline Color BlendNormal(const Color& src, const Color& dst) {
+				u32 a = src.a;
+				u32 ia = 255 - a;
+				return {
+					div255(src.r * a + dst.r * ia),
+					div255(src.g * a + dst.g * ia),
+					div255(src.b * a + dst.b * ia),
+					over_alpha(a, dst.a)
+				};
+			}
+
+			// dst + src * a, saturated
+			inline Color BlendAdditive(const Color& src, const Color& dst) {
+				u32 a = src.a;
+				return {
+					saturate(dst.r + div255(src.r * a)),
+					saturate(dst.g + div255(src.g * a)),
+					saturate(dst.b + div255(src.b * a)),
+					over_alpha(a, dst.a)
+				};
+			}
+
+			// dst * src, faded towards dst by the source alpha
+			inline Color BlendMultiply(const Color& src, const Color& dst) {
+				u32 a = src.a;
+				u32 ia = 255 - a;
+				return {
+					div255(div255(src.r * dst.r) * a + dst.r * ia),
+					div255(div255(src.g * dst.g) * a + dst.g * ia),
+					div255(div255(src.b * dst.b) * a + dst.b * ia),
+					over_alpha(a, dst.a)
+				};
+			}
+
+			// 1 - (1 - src) * (1 - dst), faded towards dst by the source alpha
+			inline Color BlendScreen(const Color& src, const Color& dst) {
+				u32 a = src.a;
+				u32 ia = 255 - a;
+				return {
+					div255((src.r + dst.r - div255(src.r * dst.r)) * a + dst.r * ia),
+					div255((src.g + dst.g - div255(src.g * dst.g)) * a + dst.g * ia),
+					div255((src.b + dst.b - div255(src.b * dst.b)) * a + dst.b * ia),
+					over_alpha(a, dst.a)
+				};
+			}
+
+			// src is premultiplied: src + dst * (255 - a). One multiply and divide less than Normal
+			inline Color BlendPremultipliedOver(const Color& src, const Color& dst) {
+				u32 ia = 255 - src.a;
+				return {
+					saturate(src.r + div255(dst.r * ia)),
+					saturate(src.g + div255(dst.g * ia)),
+					saturate(src.b + div255(dst.b * ia)),
+					saturate(src.a + div255(dst.a * ia))
+				};
+			}
+
+			inline Color BlendPixel(BlendMode mode, const Color& src, const Color& dst) {
+				switch (mode) {
+				case BlendMode::Normal: return BlendNormal(src, dst);
+				case BlendMode::Additive: return BlendAdditive(src, dst);
+				case BlendMode::Multiply: return BlendMultiply(src, dst);
+				case BlendMode::Screen: return BlendScreen(src, dst);
+				case BlendMode::PremultipliedOver: return BlendPremultipliedOver(src, dst);
+				default: return src;
+				}
+			}
+
+			typedef void(*BlendSpanFn)(Color* dst, const Color* src, u32 count);
+			typedef void(*BlendFillFn)(Color* dst, const Color& color, u32 count);
+
+			struct SpanKernels {
+				// dst[0..count) = color
+				void(*fill)(Color* dst, const Color& color, u32 count);
+
+				// dst[0..count) = src[0..count), the spans must not overlap
+				void(*copy)(Color* dst, const Color* src, u32 count);
+
+				// same as copy, but any source pixel equal to key is skipped
+				void(*copy_keyed)(Color* dst, const Color* src, u32 count, const Color& key);
+
+				// dst[i] = BlendPixel(mode, src[i], dst[i]), indexed by BlendMode.
+				// BlendMode::None maps onto copy
+				BlendSpanFn blend[BLEND_MODE_COUNT];
+
+				// dst[i] = BlendPixel(mode, color, dst[i]), indexed by BlendMode.
+				// BlendMode::None maps onto fill
+				BlendFillFn blend_fill[BLEND_MODE_COUNT];
+			};
+
+			// highest simd level supported by both the cpu and the build
+			SimdLevel DetectSimdLevel();
+
+			SimdLevel ActiveSimdLevel();
+
+			// overrides the kernel set in use. Levels above what DetectSimdLevel reports are
+			// clamped. Mostly useful for benchmarking and for comparing against the scalar path
+			void SetSimdLevel(SimdLevel level);
+
+			const SpanKernels& Active();
+
+			inline void FillSpan(Color* dst, const Color& color, u32 count) { Active().fill(dst, color, count); }
+			inline void CopySpan(Color* dst, const Color* src, u32 count) { Active().copy(dst, src, count); }
+			inline void CopySpanKeyed(Color* dst, const Color* src, u32 count, const Color& key) { Active().copy_keyed(dst, src, count, key); }
+			inline void BlendSpan(Color* dst, const Color* src, u32 count, BlendMode mode = BlendMode::Normal) { Active().blend[(u32)mode](dst, src, count); }
+			inline void BlendFillSpan(Color* dst, const Color& color, u32 count, BlendMode mode = BlendMode::Normal) { Active().blend_fill[(u32)mode](dst, color, count); }
+		}
+	}
+}
@@ -0,0 +1,223 @@
+#include "pch.h"
+#include "TextureLoader.h"
+#include "Graphics.h"
+#include "Pxim.h"
+#include "stb_image.h"
+
+#include <filesystem>
+
+namespace amor {
+	namespace graphics {
+
+		TextureRequest::TextureRequest(const std::string& path, const TextureCallback& callback) :
+				m_Path(path), m_Callback(callback), m_Status(Status::Queued), m_Texture(nullptr), m_Bytes(0), m_Measured(false) {}
+
+		TextureRequest::~TextureRequest() {
+			delete m_Texture;
+		}
+
+		Texture* TextureRequest::take() {
+			if (status() != Status::Loaded) {
+				return nullptr;
+			}
+			Texture* texture = m_Texture;
+			m_Texture = nullptr;
+			return texture;
+		}
+
+		void TextureRequest::cancel() {
+			Status current = status();
+			while (current < Status::Loaded) {
+				if (m_Status.compare_exchange_weak(current, Status::Cancelled, std::memory_order_acq_rel, std::memory_order_acquire)) {
+					return;
+				}
+			}
+		}
+
+
+		TextureLoader::TextureLoader(u32 threads, u64 memoryBudget) :
+				m_ThreadCount(math::max(threads, 1u)), m_Budget(memoryBudget), m_Reserved(0), m_Pending(0), m_Quit(false) {}
+
+		TextureLoader::~TextureLoader() {
+			{
+				std::lock_guard<std::mutex> lock(m_Lock);
+				m_Quit = true;
+			}
+			m_Wake.notify_all();
+
+			for (std::thread& thread : m_Threads) {
+				thread.join();
+			}
+
+			// whoever still holds a handle sees it won't come
+			for (TextureHandle& handle : m_Queue) {
+				handle->cancel();
+			}
+			for (TextureHandle& handle : m_Finished) {
+				handle->cancel();
+				delete handle->m_Texture;
+				handle->m_Texture = nullptr;
+			}
+		}
+
+		TextureHandle TextureLoader::load(const std::string& path, const TextureCallback& callback) {
+			TextureHandle handle = util::make_intrusive<TextureRequest>(path, callback);
+			{
+				std::lock_guard<std::mutex> lock(m_Lock);
+				if (m_Threads.empty()) {
+					for (u32 i = 0; i < m_ThreadCount; ++i) {
+						m_Threads.emplace_back(&TextureLoader::decode_thread, this);
+					}
+				}
+				m_Queue.push_back(handle);
+				++m_Pending;
+			}
+			m_Wake.notify_one();
+			return handle;
+		}
+
+		u32 TextureLoader::dispatch() {
+			std::vector<TextureHandle> finished;
+			{
+				std::lock_guard<std::mutex> lock(m_Lock);
+				if (m_Finished.empty()) {
+					return 0;
+				}
+				finished.swap(m_Finished);
+				for (TextureHandle& handle : finished) {
+					m_Reserved -= handle->m_Bytes;
+				}
+				m_Pending -= (u32)finished.size();
+			}
+			// the memory went back to the budget
+			m_Wake.notify_all();
+
+			u32 delivered = 0;
+			for (TextureHandle& handle : finished) {
+				TextureRequest::Status decoding = TextureRequest::Status::Decoding;
+				TextureRequest::Status result = handle->m_Texture != nullptr ? TextureRequest::Status::Loaded : TextureRequest::Status::Failed;
+				if (!handle->m_Status.compare_exchange_strong(decoding, result, std::memory_order_acq_rel)) {
+					// cancelled while it decoded
+					delete handle->m_Texture;
+					handle->m_Texture = nullptr;
+					continue;
+				}
+
+				// the callback goes with the delivery, it can't keep its own request alive
+				TextureCallback callback = std::move(handle->m_Callback);
+				handle->m_Callback = nullptr;
+				if (callback) {
+					callback(handle);
+				}
+				++delivered;
+			}
+			return delivered;
+		}
+
+		u32 TextureLoader::pending() const {
+			std::lock_guard<std::mutex> lock(m_Lock);
+			return m_Pending;
+		}
+
+		u64 TextureLoader::reserved() const {
+			std::lock_guard<std::mutex> lock(m_Lock);
+			return m_Reserved;
+		}
+
+		bool TextureLoader::can_start() const {
+			if (m_Queue.empty()) {
+				return false;
+			}
+
+			// unmeasured files are taken to be measured, cancelled ones to be dropped
+			const TextureHandle& front = m_Queue.front();
+			if (!front->m_Measured || front->status() == TextureRequest::Status::Cancelled) {
+				return true;
+			}
+			return m_Reserved == 0 || m_Reserved + front->m_Bytes <= m_Budget;
+		}
+
+		void TextureLoader::decode_thread() {
+			std::unique_lock<std::mutex> lock(m_Lock);
+			for (;;) {
+				m_Wake.wait(lock, [this] { return m_Quit || can_start(); });
+				if (m_Quit) {
+					break;
+				}
+
+				TextureHandle handle = std::move(m_Queue.front());
+				m_Queue.pop_front();
+
+				if (handle->status() == TextureRequest::Status::Cancelled) {
+					--m_Pending;
+					continue;
+				}
+
+				if (!handle->m_Measured) {
+					lock.unlock();
+					u64 bytes = measure(handle->m_Path);
+					lock.lock();
+
+					// back in line in the same place, now it waits for the budget like everything else
+					handle->m_Bytes = bytes;
+					handle->m_Measured = true;
+					m_Queue.push_front(std::move(handle));
+					continue;
+				}
+
+				TextureRequest::Status queued = TextureRequest::Status::Queued;
+				if (!handle->m_Status.compare_exchange_strong(queued, TextureRequest::Status::Decoding, std::memory_order_acq_rel)) {
+					--m_Pending;
+					continue;
+				}
+				m_Reserved += handle->m_Bytes;
+
+				lock.unlock();
+				Texture* texture = decode(handle->m_Path);
+				lock.lock();
+
+				handle->m_Texture = texture;
+				m_Finished.push_back(std::move(handle));
+			}
+		}
+
+		u64 TextureLoader::measure(const std::string& path) {
+			if (std::filesystem::path(path).extension() == ".pxim") {
+				pxim::Reader reader;
+				if (!reader.open(path.c_str())) {
+					return 0;
+				}
+				return (u64)reader.width() * reader.height() * sizeof(Color);
+			}
+
+			i32 w, h, n;
+			if (!stbi_info(path.c_str(), &w, &h, &n)) {
+				return 0;
+			}
+			return (u64)w * h * sizeof(Color);
+		}
+
+		Texture* TextureLoader::decode(const std::string& path) {
+			AMOR_PROFILE_SCOPE("TextureLoader::decode");
+			if (std::filesystem::path(path).extension() == ".pxim") {
+				// on this thread only, the tiles would go to the frame jobs otherwise
+				Texture* texture = new Texture();
+				texture->load(path.c_str(), 1);
+				if (texture->data() == nullptr) {
+					delete texture;
+					return nullptr;
+				}
+				return texture;
+			}
+
+			// the constructor logs what went wrong
+			try {
+				return new Texture(path.c_str());
+			}
+			catch (const std::runtime_error&) {
+				return nullptr;
+			}
+		}
+
+	}
+}
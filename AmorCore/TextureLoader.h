@@ -0,0 +1,139 @@
+#pragma once
+#include "Common.h"
+#include "Util.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Loads textures without stalling the loop threads.
+
+	load() queues the file and returns a handle right away. A few decode threads of the loader's own
+	(image decoding mostly waits on the disk, it would hold up the frame jobs on the shared job
+	system) read the files one each, PXIM through Texture::load and everything else through
+	stb_image. Before a file is decoded its pixels are counted against the memory budget, and it
+	waits in the queue while the decoded textures not delivered yet would go over it. A file larger
+	than the whole budget goes alone.
+
+	Finished loads are delivered by dispatch(), which runs their callbacks on the thread calling it.
+	WindowBase does that on the main thread between updates (with the update thread stopped in
+	threaded mode), so callbacks can upload and register textures like OnUserHandoff can.
+
+		graphics::TextureHandle tiles = texture_loader().load("tiles.png", [this](graphics::TextureHandle& handle) {
+			if (handle->status() == graphics::TextureRequest::Status::Loaded) {
+				m_Tiles = handle->take();
+			}
+		});
+*/
+
+namespace amor {
+	namespace graphics {
+		class Texture;
+		class TextureRequest;
+		class TextureLoader;
+
+		// shared between the loader and whoever waits for the texture, the request lives as long as either
+		using TextureHandle = util::IntrusiveRef<TextureRequest>;
+		using TextureCallback = std::function<void(TextureHandle&)>;
+
+		class TextureRequest : public util::RefCounted<> {
+		public:
+			enum class Status : u8 {
+				Queued,
+				Decoding,
+				// the texture is there, set on the thread delivering it right before the callback
+				Loaded,
+				Failed,
+				Cancelled
+			};
+
+			TextureRequest(const std::string& path, const TextureCallback& callback);
+			~TextureRequest();
+
+			TextureRequest(const TextureRequest&) = delete;
+			TextureRequest& operator=(const TextureRequest&) = delete;
+
+			inline Status status() const { return m_Status.load(std::memory_order_acquire); }
+			// loaded, failed or cancelled, nothing happens to the request anymore
+			inline bool done() const { return status() >= Status::Loaded; }
+			inline const std::string& path() const { return m_Path; }
+
+			// the texture once Loaded, owned by the request until it's taken
+			inline Texture* texture() const { return m_Texture; }
+			// hands the texture over, the caller deletes it. nullptr unless Loaded
+			Texture* take();
+
+			// the texture is dropped and the callback doesn't run. A decode that already started still
+			// finishes, its result is thrown away. Does nothing once the request is done
+			void cancel();
+
+		private:
+			friend class TextureLoader;
+
+			std::string m_Path;
+			TextureCallback m_Callback;
+			std::atomic<Status> m_Status;
+
+			// written by the decode thread, read once it's delivered
+			Texture* m_Texture;
+			// decoded pixels counted against the budget, known once measured
+			u64 m_Bytes;
+			bool m_Measured;
+		};
+
+		class TextureLoader {
+		public:
+			static constexpr u64 DEFAULT_MEMORY_BUDGET = 256ull * 1024 * 1024;
+
+			// threads is how many files are decoded at once, started on the first load. memoryBudget bounds
+			// the bytes of the textures decoding or decoded and not delivered yet
+			TextureLoader(u32 threads = 2, u64 memoryBudget = DEFAULT_MEMORY_BUDGET);
+			// waits for the running decodes, undelivered textures are dropped without their callbacks
+			~TextureLoader();
+
+			TextureLoader(const TextureLoader&) = delete;
+			TextureLoader& operator=(const TextureLoader&) = delete;
+
+			TextureHandle load(const std::string& path, const TextureCallback& callback = {});
+
+			// delivers the loads finished since the last call: releases their memory, sets their status
+			// and runs their callbacks on the calling thread. Returns how many were delivered
+			u32 dispatch();
+
+			// loads the loader still holds, cancelled ones until a decode thread or dispatch drops them.
+			// A loading screen is done when it's 0
+			u32 pending() const;
+			// bytes counted against the budget right now
+			u64 reserved() const;
+
+		private:
+			void decode_thread();
+			// whether the front of the queue can start, with m_Lock held
+			bool can_start() const;
+			// bytes of the pixels a file decodes to, read from its header. 0 when it can't be read, the
+			// decode reports why
+			static u64 measure(const std::string& path);
+			static Texture* decode(const std::string& path);
+
+		private:
+			u32 m_ThreadCount;
+			u64 m_Budget;
+			std::vector<std::thread> m_Threads;
+
+			mutable std::mutex m_Lock;
+			std::condition_variable m_Wake;
+			std::deque<TextureHandle> m_Queue;
+			std::vector<TextureHandle> m_Finished;
+			u64 m_Reserved;
+			u32 m_Pending;
+			bool m_Quit;
+		};
+
+	}
+}
@@ -0,0 +1,114 @@
+#include "pch.h"
+#include "TileRasterizer.h"
+#include "JobSystem.h"
+
+namespace amor {
+    namespace graphics {
+        namespace raster {
+
+            TileRasterizer::TileRasterizer(u32 tileSize, u32 threads) :
+                    m_TileSize(tileSize ? tileSize : 64), m_TilesX(0), m_TilesY(0), m_Surface{},
+                    m_Serial(threads == 1) {
+
+            }
+
+            TileRasterizer::~TileRasterizer() {}
+
+            u32 TileRasterizer::thread_count() const {
+                return m_Serial ? 1 : util::JobSystem::Get().thread_count();
+            }
+
+            void TileRasterizer::Flush(const Surface& surface) {
+                if (m_Commands.empty()) return;
+
+                Bin(surface);
+                u32 tiles = m_TilesX * m_TilesY;
+
+                if (m_Serial) {
+                    for (u32 tile = 0; tile < tiles; ++tile) {
+                        RunTile(tile);
+                    }
+                }
+                else {
+                    // tiles cost very different amounts, one per job lets stealing balance them
+                    util::JobSystem::Get().parallel_for(0, tiles, [this](u32 begin, u32 end) {
+                        for (u32 tile = begin; tile < end; ++tile) {
+                            RunTile(tile);
+                        }
+                    }, 1);
+                }
+
+                m_Commands.clear();
+            }
+
+            void TileRasterizer::Bin(const Surface& surface) {
+                m_Surface = surface;
+                i32 width = surface.x1 - surface.x0;
+                i32 height = surface.y1 - surface.y0;
+                m_TilesX = width > 0 ? ((u32)width + m_TileSize - 1) / m_TileSize : 0;
+                m_TilesY = height > 0 ? ((u32)height + m_TileSize - 1) / m_TileSize : 0;
+
+                size_t tiles = (size_t)m_TilesX * m_TilesY;
+                if (m_Bins.size() < tiles) {
+                    m_Bins.resize(tiles);
+                }
+                for (size_t i = 0; i < tiles; ++i) {
+                    m_Bins[i].clear();
+                }
+
+                m_Octants.clear();
+                m_OctantRanges.resize(m_Commands.size());
+
+                const i32 ts = (i32)m_TileSize;
+                for (u32 index = 0; index < (u32)m_Commands.size(); ++index) {
+                    i32 x0, y0, x1, y1;
+                    if (!Bounds(m_Commands[index], x0, y0, x1, y1)) continue;
+
+                    // to tile space, clamped to the target
+                    x0 = math::max(x0, surface.x0) - surface.x0;
+                    y0 = math::max(y0, surface.y0) - surface.y0;
+                    x1 = math::min(x1, surface.x1) - surface.x0;
+                    y1 = math::min(y1, surface.y1) - surface.y0;
+                    if (x1 <= x0 || y1 <= y0) continue;
+
+                    if (m_Commands[index].op == Op::DrawCircle) {
+                        OctantRange& range = m_OctantRanges[index];
+                        range.start = (u32)m_Octants.size();
+                        circle_octant(m_Commands[index].a, m_Octants);
+                        range.count = (u32)m_Octants.size() - range.start;
+                    }
+
+                    for (i32 ty = y0 / ts; ty <= (y1 - 1) / ts; ++ty) {
+                        for (i32 tx = x0 / ts; tx <= (x1 - 1) / ts; ++tx) {
+                            m_Bins[(size_t)ty * m_TilesX + tx].push_back(index);
+                        }
+                    }
+                }
+            }
+
+            void TileRasterizer::RunTile(u32 tile) {
+                const std::vector<u32>& bin = m_Bins[tile];
+                if (bin.empty()) return;
+
+                const i32 ts = (i32)m_TileSize;
+                Surface s = m_Surface;
+                s.x0 = m_Surface.x0 + (i32)(tile % m_TilesX) * ts;
+                s.y0 = m_Surface.y0 + (i32)(tile / m_TilesX) * ts;
+                s.x1 = math::min(s.x0 + ts, m_Surface.x1);
+                s.y1 = math::min(s.y0 + ts, m_Surface.y1);
+
+                for (u32 index : bin) {
+                    const Command& cmd = m_Commands[index];
+                    if (cmd.op == Op::DrawCircle) {
+                        const OctantRange& range = m_OctantRanges[index];
+                        ExecuteCircle(cmd, s, m_Octants.data() + range.start, range.count);
+                    }
+                    else {
+                        Execute(cmd, s);
+                    }
+                }
+            }
+
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "Common.h"
+#include "Raster.h"
+
+#include <vector>
+
+/*
+	Deferred backend of PrimitiveContext2D.
+
+	Draw calls are recorded as raster::Command. On Flush the target is split into square
+	tiles, every command is binned into each tile its bounds overlap (in submission order)
+	and the tiles are rasterized as jobs on the shared util::JobSystem. Lines and circles only
+	walk the part of their outline inside the tile, a circle's octant is walked once while
+	binning and shared by its tiles. A tile is only ever
+	touched by one thread and runs its commands in the order they were recorded, so the result
+	is the same as drawing immediately.
+
+	The calling thread works on tiles too and Flush only returns once the whole target is done.
+*/
+
+namespace amor {
+	namespace graphics {
+		namespace raster {
+
+			class TileRasterizer {
+			public:
+				// threads = 1 rasterizes on the thread calling Flush only, anything else spreads the
+				// tiles over the shared job system
+				TileRasterizer(u32 tileSize = 64, u32 threads = 0);
+				~TileRasterizer();
+
+				TileRasterizer(const TileRasterizer&) = delete;
+				TileRasterizer& operator=(const TileRasterizer&) = delete;
+
+				inline void Record(const Command& cmd) { m_Commands.push_back(cmd); }
+				inline bool Empty() const { return m_Commands.empty(); }
+				inline void Discard() { m_Commands.clear(); }
+
+				inline u32 tile_size() const { return m_TileSize; }
+				u32 thread_count() const;
+
+				// rasterizes everything recorded so far into surface and empties the buffer
+				void Flush(const Surface& surface);
+
+			private:
+				void Bin(const Surface& surface);
+				void RunTile(u32 tile);
+
+			private:
+				std::vector<Command> m_Commands;
+
+				// command indices per tile, kept between flushes so they don't reallocate every frame
+				std::vector<std::vector<u32>> m_Bins;
+				// the octants of the circles recorded, per command index where in m_Octants its octant is
+				struct OctantRange {
+					u32 start, count;
+				};
+				std::vector<i32> m_Octants;
+				std::vector<OctantRange> m_OctantRanges;
+				u32 m_TileSize;
+				u32 m_TilesX, m_TilesY;
+				Surface m_Surface;
+				bool m_Serial;
+			};
+
+		}
+	}
+}
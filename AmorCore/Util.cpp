@@ -1,6 +1,24 @@
 #include "pch.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace amor {
 	namespace util {
 
@@ -9,7 +27,7 @@ namespace amor {
 
 		void Timer::start() {
 			m_IsStarted = true;
-			m_StartTimestamp = get_timestamp_ms();
+			m_StartTimestamp = now_ns();
 			m_LastTimestamp = m_StartTimestamp;
 		}
 
@@ -21,27 +39,293 @@ namespace amor {
 		}
 
 		u64 Timer::delta() {
-			u64 now = get_timestamp_ms();
+			// the part of a millisecond left over counts towards the next call
+			u64 milliseconds = (now_ns() - m_LastTimestamp) / 1000000u;
+			m_LastTimestamp += milliseconds * 1000000u;
+			return milliseconds;
+		}
+
+		u64 Timer::delta_ns() {
+			u64 now = now_ns();
 			u64 delta = now - m_LastTimestamp;
 			m_LastTimestamp = now;
 			return delta;
 		}
 
 		double Timer::delta_seconds() {
-			return (double)(delta()) / 1000.0;
+			return (double)(delta_ns()) / 1e9;
 		}
 
 		u64 Timer::elapsed() {
-			return get_timestamp_ms() - m_StartTimestamp;
+			return elapsed_ns() / 1000000u;
+		}
+
+		u64 Timer::elapsed_ns() {
+			return now_ns() - m_StartTimestamp;
 		}
 
 		double Timer::elapsed_seconds() {
-			return (double)(elapsed()) / 1000.0;
+			return (double)(elapsed_ns()) / 1e9;
 		}
 
-		u64 Timer::get_timestamp_ms() const {
-			return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+		u64 Timer::now_ns() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 		}
-	}
-}
 
+		namespace trace {
+			/*
+				One single producer ring per thread. The owning thread writes the slot and then
+				publishes it by bumping head (release). A flush reads from its own tail up to head
+				and afterwards checks whether the producer lapped it in the meantime, any slot that
+				may have been rewritten while it was copied is dropped instead of emitted torn.
+			*/
+			struct ThreadBuffer {
+				Event events[THREAD_CAPACITY];
+				std::atomic<u64> head{ 0 };
+				u64 tail = 0;
+				u32 thread;
+			};
+
+			static std::mutex s_RegistryMutex;
+			static std::vector<std::unique_ptr<ThreadBuffer>> s_Registry;
+			static thread_local ThreadBuffer* t_Buffer = nullptr;
+
+			static ThreadBuffer* register_thread() {
+				std::lock_guard<std::mutex> lock(s_RegistryMutex);
+
+				// buffers outlive their thread so whatever it recorded can still be flushed
+				s_Registry.push_back(std::make_unique<ThreadBuffer>());
+				s_Registry.back()->thread = (u32)s_Registry.size();
+				return s_Registry.back().get();
+			}
+
+			u64 now_ns() {
+				return Timer::now_ns();
+			}
+
+			void Record(const char* name, u64 begin, u64 end) {
+				ThreadBuffer* buffer = t_Buffer;
+				if (buffer == nullptr) {
+					buffer = t_Buffer = register_thread();
+				}
+
+				u64 head = buffer->head.load(std::memory_order_relaxed);
+				buffer->events[head % THREAD_CAPACITY] = { name, begin, end };
+				buffer->head.store(head + 1, std::memory_order_release);
+			}
+
+			// copies the events published since the last drain, returns the ones that are known intact
+			static void drain(ThreadBuffer& buffer, std::vector<Event>& out) {
+				u64 head = buffer.head.load(std::memory_order_acquire);
+				u64 from = buffer.tail;
+				if (head - from > THREAD_CAPACITY) {
+					from = head - THREAD_CAPACITY;
+				}
+
+				size_t first = out.size();
+				for (u64 i = from; i < head; ++i) {
+					out.push_back(buffer.events[i % THREAD_CAPACITY]);
+				}
+
+				// the producer may be rewriting slot head_now % capacity, which held event head_now - capacity,
+				// so everything up to and including that one may have been overwritten while copying
+				u64 headNow = buffer.head.load(std::memory_order_acquire);
+				if (headNow - from >= THREAD_CAPACITY) {
+					size_t torn = (size_t)std::min<u64>(headNow - THREAD_CAPACITY - from + 1, head - from);
+					out.erase(out.begin() + first, out.begin() + first + torn);
+				}
+
+				buffer.tail = head;
+			}
+
+			bool Flush(const std::string& filename) {
+				std::ofstream file(filename, std::ios::out | std::ios::trunc);
+				if (!file.is_open()) {
+					AMOR_LOG_ERROR("Trace", "Unable to open %s", filename.c_str());
+					return false;
+				}
+
+				// copied out under the lock and written after it, a thread recording its first event
+				// registers under the same lock and shouldn't wait on the file
+				std::vector<Event> events;
+				// thread id and the end of its events
+				std::vector<std::pair<u32, size_t>> threads;
+				{
+					std::lock_guard<std::mutex> lock(s_RegistryMutex);
+					threads.reserve(s_Registry.size());
+					for (auto& buffer : s_Registry) {
+						drain(*buffer, events);
+						threads.emplace_back(buffer->thread, events.size());
+					}
+				}
+
+				char line[256];
+				bool first = true;
+				file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+				size_t at = 0;
+				for (const auto& [thread, end] : threads) {
+					for (; at < end; ++at) {
+						const Event& e = events[at];
+						snprintf(line, sizeof(line), "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+							first ? "" : ",", e.name, thread, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+						file << line;
+						first = false;
+					}
+				}
+
+				file << "\n]}\n";
+				if (!file.good()) {
+					AMOR_LOG_ERROR("Trace", "Unable to write %s", filename.c_str());
+					return false;
+				}
+				return true;
+			}
+
+			void Discard() {
+				std::lock_guard<std::mutex> lock(s_RegistryMutex);
+				for (auto& buffer : s_Registry) {
+					buffer->tail = buffer->head.load(std::memory_order_acquire);
+				}
+			}
+		}
+
+
+		MappedFile::MappedFile() : m_Data(nullptr), m_Size(0),
+#ifdef _WIN32
+			m_File(INVALID_HANDLE_VALUE), m_Mapping(nullptr) {}
+#else
+			m_File(-1) {}
+#endif
+
+		MappedFile::~MappedFile() {
+			close();
+		}
+
+		bool MappedFile::fail(const std::string& reason) {
+			m_Error = reason;
+			close();
+			return false;
+		}
+
+#ifdef _WIN32
+		bool MappedFile::open(const std::string& filename, Mode mode, u64 size) {
+			close();
+			m_Error.clear();
+			bool write = mode == Mode::ReadWrite;
+
+			std::wstring path = std::filesystem::path(filename).wstring();
+			m_File = CreateFileW(path.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+				FILE_SHARE_READ | (write ? 0 : FILE_SHARE_WRITE), nullptr, write ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (m_File == INVALID_HANDLE_VALUE) {
+				return fail("Unable to open " + filename + " (error " + std::to_string(GetLastError()) + ")");
+			}
+
+			LARGE_INTEGER length;
+			if (write) {
+				length.QuadPart = (LONGLONG)size;
+				if (!SetFilePointerEx(m_File, length, nullptr, FILE_BEGIN) || !SetEndOfFile(m_File)) {
+					return fail("Unable to resize " + filename + " (error " + std::to_string(GetLastError()) + ")");
+				}
+			}
+			else if (!GetFileSizeEx(m_File, &length)) {
+				return fail("Unable to read the size of " + filename + " (error " + std::to_string(GetLastError()) + ")");
+			}
+
+			// empty files can't be mapped
+			if (length.QuadPart == 0) {
+				return fail("Unable to map " + filename + ", it's empty");
+			}
+
+			bool copy = mode == Mode::CopyOnWrite;
+			m_Mapping = CreateFileMappingW(m_File, nullptr, write ? PAGE_READWRITE : (copy ? PAGE_WRITECOPY : PAGE_READONLY), 0, 0, nullptr);
+			if (m_Mapping != nullptr) {
+				m_Data = (byte*)MapViewOfFile(m_Mapping, write ? FILE_MAP_WRITE : (copy ? FILE_MAP_COPY : FILE_MAP_READ), 0, 0, 0);
+			}
+			if (m_Data == nullptr) {
+				return fail("Unable to map " + filename + " (error " + std::to_string(GetLastError()) + ")");
+			}
+
+			m_Size = (u64)length.QuadPart;
+			return true;
+		}
+
+		void MappedFile::close() {
+			if (m_Data != nullptr) {
+				UnmapViewOfFile(m_Data);
+				m_Data = nullptr;
+			}
+			if (m_Mapping != nullptr) {
+				CloseHandle(m_Mapping);
+				m_Mapping = nullptr;
+			}
+			if (m_File != INVALID_HANDLE_VALUE) {
+				CloseHandle(m_File);
+				m_File = INVALID_HANDLE_VALUE;
+			}
+			m_Size = 0;
+		}
+
+		void MappedFile::flush() {
+			if (m_Data != nullptr) {
+				FlushViewOfFile(m_Data, 0);
+				FlushFileBuffers(m_File);
+			}
+		}
+#else
+		bool MappedFile::open(const std::string& filename, Mode mode, u64 size) {
+			close();
+			m_Error.clear();
+			bool write = mode == Mode::ReadWrite;
+
+			m_File = ::open(filename.c_str(), write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+			if (m_File < 0) {
+				return fail("Unable to open " + filename + " (" + strerror(errno) + ")");
+			}
+
+			struct stat info;
+			if (write) {
+				if (ftruncate(m_File, (off_t)size) != 0) {
+					return fail("Unable to resize " + filename + " (" + strerror(errno) + ")");
+				}
+			}
+			else if (fstat(m_File, &info) == 0) {
+				size = (u64)info.st_size;
+			}
+
+			// empty files can't be mapped
+			if (size == 0) {
+				return fail("Unable to map " + filename + ", it's empty");
+			}
+
+			bool copy = mode == Mode::CopyOnWrite;
+			void* data = mmap(nullptr, size, write || copy ? PROT_READ | PROT_WRITE : PROT_READ, copy ? MAP_PRIVATE : MAP_SHARED, m_File, 0);
+			if (data == MAP_FAILED) {
+				return fail("Unable to map " + filename + " (" + strerror(errno) + ")");
+			}
+
+			m_Data = (byte*)data;
+			m_Size = size;
+			return true;
+		}
+
+		void MappedFile::close() {
+			if (m_Data != nullptr) {
+				munmap(m_Data, m_Size);
+				m_Data = nullptr;
+			}
+			if (m_File >= 0) {
+				::close(m_File);
+				m_File = -1;
+			}
+			m_Size = 0;
+		}
+
+		void MappedFile::flush() {
+			if (m_Data != nullptr) {
+				msync(m_Data, m_Size, MS_SYNC);
+			}
+		}
+#endif
+	}
+}
\ No newline at end of file
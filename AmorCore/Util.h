@@ -3,9 +3,35 @@
 #include <chrono>
 #include <initializer_list>
 #include <functional>
+#include <string>
+#include <atomic>
+#include <new>
+
+/*
+	Scoped instrumentation. AMOR_PROFILE_SCOPE("name") records how long the enclosing scope took.
+	The name has to be a string literal, only the pointer is kept.
+
+	Define AMOR_PROFILE to record into per thread ring buffers (see util::trace), flush them with
+	util::trace::Flush. Define AMOR_PROFILE_TRACY instead to hand the scopes to a Tracy client
+	(include path and TracyClient.cpp have to be provided by the application). With neither defined
+	the macro expands to nothing.
+*/
+#define AMOR_CONCAT_IMPL(a, b) a##b
+#define AMOR_CONCAT(a, b) AMOR_CONCAT_IMPL(a, b)
+
+#if defined(AMOR_PROFILE_TRACY)
+#include <tracy/Tracy.hpp>
+#define AMOR_PROFILE_SCOPE(name) ZoneScopedN(name)
+#elif defined(AMOR_PROFILE)
+#define AMOR_PROFILE_SCOPE(name) ::amor::util::trace::Scope AMOR_CONCAT(_amor_profile_scope_, __LINE__)(name)
+#else
+#define AMOR_PROFILE_SCOPE(name) ((void)0)
+#endif
 
 namespace amor {
 	namespace util {
+		// monotonic (steady_clock) timer with nanosecond resolution. The millisecond getters are kept for
+		// existing callers, the _seconds variants are computed from nanoseconds so they don't jitter at high frame rates
 		class Timer {
 		public:
 			Timer();
@@ -17,19 +43,25 @@ namespace amor {
 			// stops and resets the timer
 			void stop();
 			
-			// returns the elapsed time since start or the previous elapsed call
-			// in milliseconds
+			// returns the elapsed time since start or the previous delta call
+			// in whole milliseconds, the remainder carries over to the next call
 			u64 delta();
 			
+			// same as delta but in nanoseconds
+			u64 delta_ns();
+
 			double delta_seconds();
 
 			// returns the elapsed time since start in milliseconds
 			u64 elapsed();
 
+			u64 elapsed_ns();
+
 			double elapsed_seconds();
 
-		private:
-			u64 get_timestamp_ms() const;
+			inline bool is_started() const { return m_IsStarted; }
+
+			static u64 now_ns();
 
 		private:
 			bool m_IsStarted;
@@ -38,76 +70,457 @@ namespace amor {
 		};
 
 
-		template<typename _Ref_Ty, void(*deallocator)(_Ref_Ty&) = [](_Ref_Ty&) {} > class CountedRef {
+		namespace trace {
+			// events kept per thread, older ones are overwritten when a thread records more between flushes
+			constexpr u32 THREAD_CAPACITY = 1 << 14;
+
+			struct Event {
+				const char* name;
+				u64 begin, end;
+			};
+
+			u64 now_ns();
+
+			// appends to the calling thread's ring buffer. No locks or allocation after the first call on a thread
+			void Record(const char* name, u64 begin, u64 end);
+
+			// drains every thread's buffer into filename as chrome trace events ("ph":"X", microseconds).
+			// The file loads in chrome://tracing, perfetto and Tracy's import-chrome. Returns false if the file
+			// couldn't be written. Safe to call while other threads keep recording
+			bool Flush(const std::string& filename);
+
+			// drops everything recorded so far
+			void Discard();
+
+			class Scope {
+			public:
+				inline Scope(const char* name) : m_Name(name), m_Begin(now_ns()) {}
+				inline ~Scope() { Record(m_Name, m_Begin, now_ns()); }
+
+				Scope(const Scope&) = delete;
+				Scope& operator=(const Scope&) = delete;
+
+			private:
+				const char* m_Name;
+				u64 m_Begin;
+			};
+		}
+
+
+		// front/back pair for handing state between an update and a render thread. The producer writes back(),
+		// the consumer reads front() and swap() exchanges them at a point where neither side touches either
+		// (e.g. WindowBase::OnUserHandoff). After a swap back() holds the snapshot from two swaps ago, so the
+		// producer has to write it completely
+		template<typename T> class DoubleBuffer {
 		public:
-			CountedRef(const _Ref_Ty& copy_existing) {
-				m_Reference = new std::pair<_Ref_Ty, u64>(copy_existing, 1u);
+			DoubleBuffer() : m_Buffers{}, m_Front(0) {}
+			DoubleBuffer(const T& initial) : m_Buffers{ initial, initial }, m_Front(0) {}
+
+			inline T& back() { return m_Buffers[m_Front ^ 1]; }
+			inline const T& front() const { return m_Buffers[m_Front]; }
+
+			inline void swap() { m_Front ^= 1; }
+
+		private:
+			T m_Buffers[2];
+			u32 m_Front;
+		};
+
+
+		// a file mapped into memory. Read maps an existing file read only, ReadWrite creates the file
+		// or resizes it to size and writes to data() end up in the file. Other processes mapping or
+		// reading the same file see the same pages. CopyOnWrite maps an existing file writable, but a
+		// written page becomes a private copy, the file and everyone else keep seeing the original.
+		// open() doesn't log, the log maps its own file with it. Callers report error() themselves
+		class MappedFile {
+		public:
+			enum class Mode {
+				Read,
+				ReadWrite,
+				CopyOnWrite
+			};
+
+			MappedFile();
+			~MappedFile();
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+
+			bool open(const std::string& filename, Mode mode, u64 size = 0);
+			void close();
+
+			// why the last open() failed, empty after one that worked
+			inline const std::string& error() const { return m_Error; }
+
+			// blocks until written pages are on disk, the system gets there by itself eventually
+			void flush();
+
+			inline byte* data() const { return m_Data; }
+			inline u64 size() const { return m_Size; }
+			inline bool is_open() const { return m_Data != nullptr; }
+
+		private:
+			// keeps the reason for error() and closes whatever was opened, returns false for open()
+			bool fail(const std::string& reason);
+
+		private:
+			byte* m_Data;
+			u64 m_Size;
+			std::string m_Error;
+#ifdef _WIN32
+			void* m_File;
+			void* m_Mapping;
+#else
+			int m_File;
+#endif
+		};
+
+
+		// reference count, atomic when it's shared between threads
+		template<bool threadSafe> class RefCount;
+
+		template<> class RefCount<true> {
+		public:
+			RefCount(u32 initial) : m_Count(initial) {}
+
+			inline void increment() { m_Count.fetch_add(1, std::memory_order_relaxed); }
+			// true when this dropped the last one
+			inline bool decrement() { return m_Count.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+			// fails once the count reached zero, it never comes back from there
+			inline bool increment_nonzero() {
+				u32 count = m_Count.load(std::memory_order_relaxed);
+				while (count != 0) {
+					if (m_Count.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+						return true;
+					}
+				}
+				return false;
+			}
+			inline u32 load() const { return m_Count.load(std::memory_order_acquire); }
+
+		private:
+			std::atomic<u32> m_Count;
+		};
+
+		template<> class RefCount<false> {
+		public:
+			RefCount(u32 initial) : m_Count(initial) {}
+
+			inline void increment() { ++m_Count; }
+			inline bool decrement() { return --m_Count == 0; }
+			inline bool increment_nonzero() {
+				if (m_Count == 0) return false;
+				++m_Count;
+				return true;
+			}
+			inline u32 load() const { return m_Count; }
+
+		private:
+			u32 m_Count;
+		};
+
+		// counts and value in one allocation. The value is destroyed with the last strong reference,
+		// the block with the last weak one (the strong references together hold one weak reference)
+		template<typename _Ref_Ty, bool threadSafe> struct CountedBlock {
+			RefCount<threadSafe> strong;
+			RefCount<threadSafe> weak;
+			alignas(_Ref_Ty) byte storage[sizeof(_Ref_Ty)];
+
+			template<typename... Args> CountedBlock(Args&&... args) : strong(1), weak(1) {
+				new (storage) _Ref_Ty(std::forward<Args>(args)...);
+			}
+
+			inline _Ref_Ty* value() { return std::launder(reinterpret_cast<_Ref_Ty*>(storage)); }
+
+			static void release_weak(CountedBlock* block) {
+				if (block->weak.decrement()) {
+					delete block;
+				}
 			}
+		};
+
+		template<typename _Ref_Ty> void no_deallocator(_Ref_Ty&) {}
+
+		template<typename _Ref_Ty, void(*deallocator)(_Ref_Ty&), bool threadSafe> class WeakRef;
 
-			CountedRef(const CountedRef<_Ref_Ty, deallocator>& reference_existing) {
-				m_Reference = reference_existing.m_Reference;
-				m_Reference->second++;
+		/*
+			Shared ownership of a value, deallocator runs on the value when the last reference goes away.
+			With threadSafe the count is atomic, so references to one value can be copied and dropped on
+			any thread (a single CountedRef object still can't be assigned from two threads at once).
+			threadSafe = false is cheaper for values that stay on one thread.
 
+			make_counted constructs the value in place, constructing from a value copies it in. Either way
+			it's a single allocation.
+		*/
+		template<typename _Ref_Ty, void(*deallocator)(_Ref_Ty&) = no_deallocator<_Ref_Ty>, bool threadSafe = true> class CountedRef {
+			using Block = CountedBlock<_Ref_Ty, threadSafe>;
+			friend class WeakRef<_Ref_Ty, deallocator, threadSafe>;
+
+		public:
+			CountedRef() : m_Block(nullptr) {}
+
+			CountedRef(const _Ref_Ty& copy_existing) : m_Block(new Block(copy_existing)) {}
+
+			CountedRef(const CountedRef& reference_existing) : m_Block(reference_existing.m_Block) {
+				if (m_Block != nullptr) {
+					m_Block->strong.increment();
+				}
 			}
 
-			CountedRef(CountedRef<_Ref_Ty, deallocator>&& mov_existing) noexcept {
-				m_Reference = mov_existing.m_Reference;
-				mov_existing.m_Reference = nullptr;
+			CountedRef(CountedRef&& mov_existing) noexcept : m_Block(mov_existing.m_Block) {
+				mov_existing.m_Block = nullptr;
 			}
 
 			~CountedRef() {
 				remove_reference();
 			}
 
-			void operator=(const CountedRef<_Ref_Ty, deallocator>& reference_existing) {
+			CountedRef& operator=(const CountedRef& reference_existing) {
+				// the new reference is taken first, so assigning a reference to itself (or to one sharing
+				// its value) never drops the last one
+				Block* block = reference_existing.m_Block;
+				if (block != nullptr) {
+					block->strong.increment();
+				}
 				remove_reference();
-
-				m_Reference = reference_existing.m_Reference;
-				m_Reference->second++;
+				m_Block = block;
+				return *this;
 			}
-			void operator=(CountedRef<_Ref_Ty, deallocator>&& move_existing) noexcept {
-				if (move_existing.m_Reference != this->m_Reference) {
-
+			CountedRef& operator=(CountedRef&& move_existing) noexcept {
+				if (&move_existing != this) {
 					remove_reference();
+					m_Block = move_existing.m_Block;
+					move_existing.m_Block = nullptr;
+				}
+				return *this;
+			}
 
-					m_Reference = move_existing.m_Reference;
+			template<typename... Args> static CountedRef make(Args&&... args) {
+				return CountedRef(new Block(std::forward<Args>(args)...), Adopt{});
+			}
 
-					move_existing.m_Reference = nullptr;
-				}
+			// drops this reference, the ref is empty afterwards
+			void reset() {
+				remove_reference();
 			}
 
-			_Ref_Ty *ptr() {
-				return &(m_Reference->first);
+			inline explicit operator bool() const { return m_Block != nullptr; }
+
+			// strong references to the value, 0 for an empty ref
+			inline u32 use_count() const { return m_Block != nullptr ? m_Block->strong.load() : 0; }
+
+			_Ref_Ty* ptr() {
+				return m_Block->value();
 			}
 			
 			_Ref_Ty& operator*() {
-				return m_Reference->first;
+				return *m_Block->value();
 			}
 			_Ref_Ty const& operator*() const {
-				return m_Reference->first;
+				return *m_Block->value();
 			}
 
 			_Ref_Ty* operator->() {
-				return &(m_Reference->first);
+				return m_Block->value();
 			}
 			const _Ref_Ty* operator->() const {
-				return &(m_Reference->first);
+				return m_Block->value();
 			}
 
 		private:
+			// takes over a reference already counted in block
+			struct Adopt {};
+			CountedRef(Block* block, Adopt) : m_Block(block) {}
+
 			void remove_reference() {
-				if (m_Reference != nullptr) {
-					if (--m_Reference->second == 0) {
-						deallocator(m_Reference->first);
-						delete m_Reference;
-					}
+				Block* block = m_Block;
+				m_Block = nullptr;
+
+				if (block != nullptr && block->strong.decrement()) {
+					_Ref_Ty* value = block->value();
+					deallocator(*value);
+					value->~_Ref_Ty();
+					Block::release_weak(block);
+				}
+			}
+
+		private:
+			Block* m_Block;
+		};
+
+		template<typename _Ref_Ty, void(*deallocator)(_Ref_Ty&) = no_deallocator<_Ref_Ty>, bool threadSafe = true, typename... Args>
+		inline CountedRef<_Ref_Ty, deallocator, threadSafe> make_counted(Args&&... args) {
+			return CountedRef<_Ref_Ty, deallocator, threadSafe>::make(std::forward<Args>(args)...);
+		}
+
+		template<typename _Ref_Ty> class IntrusiveRef;
+
+		// base for types carrying their own count, IntrusiveRef keeps them alive. The count starts at 0,
+		// the first IntrusiveRef adopting the object takes it to 1. Copies get a count of their own
+		template<bool threadSafe = true> class RefCounted {
+			template<typename _Ref_Ty> friend class IntrusiveRef;
+
+		public:
+			RefCounted() : m_RefCount(0) {}
+			RefCounted(const RefCounted&) : m_RefCount(0) {}
+			RefCounted& operator=(const RefCounted&) { return *this; }
+
+			inline u32 ref_count() const { return m_RefCount.load(); }
+
+		protected:
+			~RefCounted() = default;
+
+		private:
+			mutable RefCount<threadSafe> m_RefCount;
+		};
+
+		/*
+			Shared ownership of an object deriving from RefCounted, deleted with the last reference. The
+			count lives in the object, so a reference is a single pointer and one can be made again from
+			the raw pointer anywhere (handing this out of a member, passing it through a C callback).
+			Whether the count is atomic is up to the RefCounted base. There are no weak references, use
+			CountedRef for those.
 
-					m_Reference = nullptr;
+				class Request : public util::RefCounted<> { ... };
+				util::IntrusiveRef<Request> request = util::make_intrusive<Request>(path);
+		*/
+		template<typename _Ref_Ty> class IntrusiveRef {
+		public:
+			IntrusiveRef() : m_Value(nullptr) {}
+
+			// takes a reference on value, which may already be held by other refs
+			explicit IntrusiveRef(_Ref_Ty* value) : m_Value(value) {
+				if (m_Value != nullptr) {
+					m_Value->m_RefCount.increment();
+				}
+			}
+
+			IntrusiveRef(const IntrusiveRef& reference_existing) : IntrusiveRef(reference_existing.m_Value) {}
+
+			IntrusiveRef(IntrusiveRef&& mov_existing) noexcept : m_Value(mov_existing.m_Value) {
+				mov_existing.m_Value = nullptr;
+			}
+
+			~IntrusiveRef() {
+				remove_reference();
+			}
+
+			IntrusiveRef& operator=(const IntrusiveRef& reference_existing) {
+				// same order as CountedRef, the new reference goes first
+				_Ref_Ty* value = reference_existing.m_Value;
+				if (value != nullptr) {
+					value->m_RefCount.increment();
+				}
+				remove_reference();
+				m_Value = value;
+				return *this;
+			}
+			IntrusiveRef& operator=(IntrusiveRef&& move_existing) noexcept {
+				if (&move_existing != this) {
+					remove_reference();
+					m_Value = move_existing.m_Value;
+					move_existing.m_Value = nullptr;
+				}
+				return *this;
+			}
+
+			// drops this reference, the ref is empty afterwards
+			void reset() {
+				remove_reference();
+			}
+
+			inline explicit operator bool() const { return m_Value != nullptr; }
+
+			inline u32 use_count() const { return m_Value != nullptr ? m_Value->ref_count() : 0; }
+
+			inline _Ref_Ty* ptr() const { return m_Value; }
+			inline _Ref_Ty& operator*() const { return *m_Value; }
+			inline _Ref_Ty* operator->() const { return m_Value; }
+
+		private:
+			void remove_reference() {
+				_Ref_Ty* value = m_Value;
+				m_Value = nullptr;
+
+				if (value != nullptr && value->m_RefCount.decrement()) {
+					delete value;
+				}
+			}
+
+		private:
+			_Ref_Ty* m_Value;
+		};
+
+		template<typename _Ref_Ty, typename... Args> inline IntrusiveRef<_Ref_Ty> make_intrusive(Args&&... args) {
+			return IntrusiveRef<_Ref_Ty>(new _Ref_Ty(std::forward<Args>(args)...));
+		}
+
+		// observes a CountedRef without keeping its value alive, lock() gets a strong reference while there is one
+		template<typename _Ref_Ty, void(*deallocator)(_Ref_Ty&) = no_deallocator<_Ref_Ty>, bool threadSafe = true> class WeakRef {
+			using Strong = CountedRef<_Ref_Ty, deallocator, threadSafe>;
+			using Block = CountedBlock<_Ref_Ty, threadSafe>;
+
+		public:
+			WeakRef() : m_Block(nullptr) {}
+
+			WeakRef(const Strong& strong) : m_Block(strong.m_Block) {
+				if (m_Block != nullptr) {
+					m_Block->weak.increment();
+				}
+			}
+
+			WeakRef(const WeakRef& other) : m_Block(other.m_Block) {
+				if (m_Block != nullptr) {
+					m_Block->weak.increment();
+				}
+			}
+
+			WeakRef(WeakRef&& other) noexcept : m_Block(other.m_Block) {
+				other.m_Block = nullptr;
+			}
+
+			~WeakRef() {
+				release();
+			}
+
+			WeakRef& operator=(const WeakRef& other) {
+				Block* block = other.m_Block;
+				if (block != nullptr) {
+					block->weak.increment();
+				}
+				release();
+				m_Block = block;
+				return *this;
+			}
+			WeakRef& operator=(WeakRef&& other) noexcept {
+				if (&other != this) {
+					release();
+					m_Block = other.m_Block;
+					other.m_Block = nullptr;
+				}
+				return *this;
+			}
+
+			// empty once the last strong reference is gone
+			Strong lock() const {
+				if (m_Block != nullptr && m_Block->strong.increment_nonzero()) {
+					return Strong(m_Block, typename Strong::Adopt{});
+				}
+				return Strong();
+			}
+
+			inline bool expired() const { return m_Block == nullptr || m_Block->strong.load() == 0; }
+
+		private:
+			void release() {
+				if (m_Block != nullptr) {
+					Block::release_weak(m_Block);
+					m_Block = nullptr;
 				}
 			}
 
 		private:
-			std::pair<_Ref_Ty, u64>* m_Reference = nullptr;
+			Block* m_Block;
 		};
 
 	}
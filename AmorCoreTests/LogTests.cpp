@@ -0,0 +1,93 @@
+#include "Tests.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace amor;
+
+// the writer opens the binary log while the queue is full of records waiting for it. A failed open
+// can't go through the queue (the writer would wait on itself), it's reported once in the text outputs.
+// The log keeps a failed binary file for good, nothing else here logs binary
+AMOR_TEST(binary_log_unwritable_path) {
+	logging::Log* log = logging::GetInstance();
+	log->flush();
+
+	// a directory can't be opened as the file
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / "amor_tests_binary_log";
+	std::filesystem::path text = std::filesystem::temp_directory_path() / "amor_tests_binary_log.txt";
+	std::filesystem::create_directories(directory);
+	std::filesystem::remove(text);
+
+	u32 outputs = log->OutputMode();
+	log->LogFile() = text.string();
+	log->BinaryLogFile() = directory.string();
+	log->OutputMode() = logging::LOG_BINARY | logging::LOG_FILE;
+
+	constexpr u32 THREADS = 4, RECORDS = 4096;
+	std::mutex lock;
+	std::condition_variable done;
+	bool finished = false;
+
+	// a writer stuck on itself never finishes the flush
+	std::thread producers([&] {
+		std::thread threads[THREADS];
+		for (std::thread& thread : threads) {
+			thread = std::thread([log] {
+				for (u32 i = 0; i < RECORDS; ++i) {
+					log->out(logging::Level::Info, "record", "Test");
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		log->flush();
+
+		std::lock_guard<std::mutex> guard(lock);
+		finished = true;
+		done.notify_all();
+	});
+
+	bool flushed;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		flushed = done.wait_for(guard, std::chrono::seconds(30), [&] { return finished; });
+	}
+	AMOR_CHECK(flushed);
+	if (!flushed) {
+		// it can't be shut down anymore
+		printf("    the log writer is stuck\n");
+		fflush(stdout);
+		std::_Exit(1);
+	}
+	producers.join();
+	log->OutputMode() = outputs;
+
+	u32 records = 0, reports = 0, other = 0;
+	std::ifstream file(text);
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.find("[Info: Test] - record") != std::string::npos) {
+			++records;
+		}
+		else if (line.find("binary records are dropped") != std::string::npos) {
+			++reports;
+		}
+		else {
+			++other;
+		}
+	}
+	AMOR_CHECK(records == THREADS * RECORDS);
+	AMOR_CHECK(reports == 1);
+	AMOR_CHECK(other == 0);
+
+	file.close();
+	std::filesystem::remove(directory);
+}
@@ -0,0 +1,70 @@
+#include "Tests.h"
+#include "Graphics.h"
+#include "Pxim.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace amor;
+using namespace amor::graphics;
+
+static std::string temp_path(const char* name) {
+	return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// writes pixels and reads them back, false if they differ. Every tile's filter has to be filter
+static bool roundtrip(const std::vector<Color>& pixels, u32 width, u32 height, const pxim::WriteOptions& options, pxim::Filter filter, u64& fileSize) {
+	std::string path = temp_path("amor_tests.pxim");
+	if (!pxim::Write(path.c_str(), pixels.data(), width, height, options)) {
+		return false;
+	}
+	fileSize = std::filesystem::file_size(path);
+
+	pxim::Reader reader;
+	std::vector<Color> decoded((u64)width * height);
+	bool ok = reader.open(path.c_str()) && reader.read(decoded.data()) && decoded == pixels;
+	for (u32 y = 0; ok && y < reader.tiles_y(); ++y) {
+		for (u32 x = 0; ok && x < reader.tiles_x(); ++x) {
+			ok = reader.tile(x, y).filter == filter;
+		}
+	}
+	reader.close();
+	std::filesystem::remove(path);
+	return ok;
+}
+
+// glyphs of one color on a transparent background, like a font atlas
+static void glyph_sheet(std::vector<Color>& pixels, u32 width, u32 height, const Color& ink) {
+	pixels.resize((u64)width * height);
+	for (u32 y = 0; y < height; ++y) {
+		for (u32 x = 0; x < width; ++x) {
+			bool set = ((x / 3) * 7 + (y / 2) * 5 + x * y) % 11 < 4;
+			pixels[(u64)y * width + x] = set ? ink : Color{ 0, 0, 0, 0 };
+		}
+	}
+}
+
+// opaque white is all ones as a u32, it has to be a palette color like any other
+AMOR_TEST(pxim_palette_white) {
+	pxim::WriteOptions options;
+	options.tileSize = 64;
+	options.threads = 1;
+
+	std::vector<Color> white(64 * 64, Color{ 255, 255, 255, 255 });
+	u64 size;
+	AMOR_CHECK(roundtrip(white, 64, 64, options, pxim::Filter::Palette, size));
+
+	// white glyphs cost what glyphs of any other color cost
+	for (pxim::Compression compression : { pxim::Compression::Fast, pxim::Compression::Default }) {
+		options.compression = compression;
+
+		std::vector<Color> pixels;
+		u64 whiteSize = 0, inkSize = 0;
+		glyph_sheet(pixels, 300, 270, Color{ 255, 255, 255, 255 });
+		AMOR_CHECK(roundtrip(pixels, 300, 270, options, pxim::Filter::Palette, whiteSize));
+		glyph_sheet(pixels, 300, 270, Color{ 255, 255, 254, 255 });
+		AMOR_CHECK(roundtrip(pixels, 300, 270, options, pxim::Filter::Palette, inkSize));
+		AMOR_CHECK(whiteSize <= inkSize + 64);
+	}
+}
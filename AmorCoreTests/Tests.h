@@ -0,0 +1,40 @@
+#pragma once
+#include "Common.h"
+
+#include <vector>
+
+/*
+	A small runner for checks that don't need a window. AMOR_TEST(name) registers a test,
+	AMOR_CHECK records a failed condition and the test carries on. Tests run in the order their files
+	are linked, AmorCoreTests [name prefix] runs only the ones starting with it.
+
+	Logging goes through the one logging::Log instance, a test changing its outputs puts them back.
+*/
+
+namespace amor {
+	namespace test {
+		struct Case {
+			const char* name;
+			void(*run)();
+		};
+
+		std::vector<Case>& Cases();
+
+		// counts a failed check against the running test
+		void Fail(const char* file, i32 line, const char* expression);
+
+		struct Registrar {
+			Registrar(const char* name, void(*run)()) {
+				Cases().push_back({ name, run });
+			}
+		};
+	}
+}
+
+#define AMOR_TEST(name) \
+	static void test_##name(); \
+	static ::amor::test::Registrar registrar_##name(#name, test_##name); \
+	static void test_##name()
+
+#define AMOR_CHECK(expression) \
+	do { if (!(expression)) ::amor::test::Fail(__FILE__, __LINE__, #expression); } while (0)
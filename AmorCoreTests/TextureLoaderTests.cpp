@@ -0,0 +1,134 @@
+#include "Tests.h"
+#include "Graphics.h"
+#include "Pxim.h"
+#include "TextureLoader.h"
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace amor;
+using namespace amor::graphics;
+
+static constexpr u32 SIZE = 64;
+static constexpr u64 BYTES = (u64)SIZE * SIZE * sizeof(Color);
+
+// a PXIM file per index, filled with its index so a mixed up delivery shows
+static std::string image(u32 index) {
+	std::string path = (std::filesystem::temp_directory_path() / ("amor_tests_loader_" + std::to_string(index) + ".pxim")).string();
+	std::vector<Color> pixels((u64)SIZE * SIZE, Color{ (byte)index, 0, 0, 255 });
+	pxim::Write(path.c_str(), pixels.data(), SIZE, SIZE);
+	return path;
+}
+
+// polls until condition holds, false after a few seconds
+static bool wait_for(const std::function<bool()>& condition) {
+	for (u32 i = 0; i < 5000; ++i) {
+		if (condition()) {
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+// with room for one texture at a time the next file only starts once the last one is delivered
+AMOR_TEST(texture_loader_budget) {
+	TextureLoader loader(2, BYTES + BYTES / 2);
+
+	u32 delivered = 0;
+	std::vector<TextureHandle> handles;
+	for (u32 i = 0; i < 3; ++i) {
+		handles.push_back(loader.load(image(i), [&delivered, i](TextureHandle& handle) {
+			AMOR_CHECK(handle->status() == TextureRequest::Status::Loaded);
+			AMOR_CHECK(handle->texture() != nullptr && handle->texture()->data()[0].r == i);
+			++delivered;
+		}));
+	}
+
+	for (u32 i = 0; i < 3; ++i) {
+		AMOR_CHECK(wait_for([&] { return loader.reserved() == BYTES && handles[i]->status() == TextureRequest::Status::Decoding; }));
+		// the next one has to wait for this one to be delivered
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		AMOR_CHECK(loader.reserved() == BYTES);
+		AMOR_CHECK(loader.pending() == 3 - i);
+
+		AMOR_CHECK(loader.dispatch() == 1);
+		AMOR_CHECK(delivered == i + 1);
+	}
+	AMOR_CHECK(loader.pending() == 0 && loader.reserved() == 0);
+
+	// larger than the whole budget, it goes alone
+	TextureLoader small(1, BYTES / 2);
+	TextureHandle large = small.load(image(3));
+	AMOR_CHECK(wait_for([&] { return small.dispatch() == 1; }));
+	AMOR_CHECK(large->status() == TextureRequest::Status::Loaded);
+	Texture* texture = large->take();
+	AMOR_CHECK(texture != nullptr && large->texture() == nullptr);
+	delete texture;
+}
+
+AMOR_TEST(texture_loader_cancel) {
+	TextureLoader loader(1, BYTES);
+
+	bool called = false;
+	TextureHandle first = loader.load(image(0), [&called](TextureHandle&) { called = true; });
+	TextureHandle second = loader.load(image(1), [&called](TextureHandle&) { called = true; });
+
+	// first decodes (or is done decoding), second waits in the queue for the budget
+	AMOR_CHECK(wait_for([&] { return first->status() == TextureRequest::Status::Decoding; }));
+	first->cancel();
+	second->cancel();
+	AMOR_CHECK(first->status() == TextureRequest::Status::Cancelled);
+	AMOR_CHECK(second->status() == TextureRequest::Status::Cancelled);
+
+	// the finished decode is thrown away by dispatch, the queued one by the decode thread
+	AMOR_CHECK(wait_for([&] { loader.dispatch(); return loader.pending() == 0; }));
+	AMOR_CHECK(!called);
+	AMOR_CHECK(first->texture() == nullptr && second->texture() == nullptr);
+	AMOR_CHECK(loader.reserved() == 0);
+
+	// cancelling a delivered request changes nothing
+	TextureHandle third = loader.load(image(2));
+	AMOR_CHECK(wait_for([&] { return loader.dispatch() == 1; }));
+	third->cancel();
+	AMOR_CHECK(third->status() == TextureRequest::Status::Loaded && third->texture() != nullptr);
+}
+
+AMOR_TEST(texture_loader_failure) {
+	TextureLoader loader;
+	bool failed = false;
+	TextureHandle missing = loader.load((std::filesystem::temp_directory_path() / "amor_tests_missing.pxim").string(), [&failed](TextureHandle& handle) {
+		failed = handle->status() == TextureRequest::Status::Failed;
+	});
+	AMOR_CHECK(wait_for([&] { return loader.dispatch() == 1; }));
+	AMOR_CHECK(failed && missing->texture() == nullptr && missing->take() == nullptr);
+}
+
+// whatever wasn't delivered is cancelled and its texture dropped, handles outliving the loader stay valid
+AMOR_TEST(texture_loader_destructor) {
+	bool called = false;
+	std::vector<TextureHandle> handles;
+	{
+		TextureLoader loader(1, BYTES);
+		for (u32 i = 0; i < 4; ++i) {
+			handles.push_back(loader.load(image(i), [&called](TextureHandle&) { called = true; }));
+		}
+		// one decoded and waiting for dispatch, the rest queued behind the budget
+		AMOR_CHECK(wait_for([&] { return loader.reserved() == BYTES; }));
+	}
+
+	AMOR_CHECK(!called);
+	for (TextureHandle& handle : handles) {
+		AMOR_CHECK(handle->status() == TextureRequest::Status::Cancelled);
+		AMOR_CHECK(handle->texture() == nullptr);
+		AMOR_CHECK(handle.use_count() == 1);
+	}
+
+	for (u32 i = 0; i < 4; ++i) {
+		std::filesystem::remove(image(i));
+	}
+}
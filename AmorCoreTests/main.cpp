@@ -0,0 +1,47 @@
+#include "Tests.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace amor {
+	namespace test {
+		static u32 s_Failures = 0;
+
+		std::vector<Case>& Cases() {
+			static std::vector<Case> cases;
+			return cases;
+		}
+
+		void Fail(const char* file, i32 line, const char* expression) {
+			printf("    %s:%d: %s\n", file, line, expression);
+			++s_Failures;
+		}
+	}
+}
+
+using namespace amor;
+
+// AmorCoreTests [name prefix], returns the number of failed tests
+int main(int argc, char** argv) {
+	const char* filter = argc > 1 ? argv[1] : "";
+
+	u32 run = 0, failed = 0;
+	for (const test::Case& test : test::Cases()) {
+		if (strncmp(test.name, filter, strlen(filter)) != 0) {
+			continue;
+		}
+
+		printf("%s\n", test.name);
+		u32 before = test::s_Failures;
+		test.run();
+		++run;
+		if (test::s_Failures != before) {
+			printf("  failed\n");
+			++failed;
+		}
+	}
+
+	logging::GetInstance()->flush();
+	printf("%u of %u tests passed\n", run - failed, run);
+	return (int)failed;
+}
@@ -0,0 +1,33 @@
+#include "Common.h"
+
+#include <iostream>
+#include <fstream>
+
+using namespace amor;
+
+// turns a LOG_BINARY file back into text: LogDecoder <binary log> [output file], without an output file it goes to stdout
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "usage: LogDecoder <binary log> [output file]" << std::endl;
+		return 1;
+	}
+
+	logging::GetInstance()->OutputMode() = logging::LOG_STDOUT;
+
+	bool decoded = false;
+	if (argc > 2) {
+		std::ofstream output(argv[2], std::ios_base::binary);
+		if (output.is_open()) {
+			decoded = logging::DecodeBinaryLog(argv[1], output);
+		}
+		else {
+			std::cerr << "Unable to open " << argv[2] << std::endl;
+		}
+	}
+	else {
+		decoded = logging::DecodeBinaryLog(argv[1], std::cout);
+	}
+
+	logging::GetInstance()->flush();
+	return decoded ? 0 : 1;
+}
@@ -229,6 +229,9 @@ bool Editor::OnUserInit() {
 	center_on_display();
 	m_CurrentCanvas.GetContext().Clear({ 0, 0, 0, 0 });
 
+	// an editor only has to redraw when there's input
+	set_idle_mode(true);
+
 	return true;
 }
 bool Editor::OnUserUpdate(double delta) {
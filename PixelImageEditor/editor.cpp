@@ -143,8 +143,9 @@ ImageEditor::~ImageEditor() {
 		delete m_Tools[i];
 	}
 
-	for (u64 i = 0; i < m_undoSteps.size(); i++) {
-		delete[] m_undoSteps[i];
+	clear_undo_steps();
+	if (m_undoPool != nullptr) {
+		delete m_undoPool;
 	}
 
 	if (m_Texture != nullptr) {
@@ -187,19 +188,41 @@ bool ImageEditor::in_mask(i32 x, i32 y) {
 	return m_Mask->data()[x + y * m_Texture->width()].r == 255;
 }
 
+void ImageEditor::clear_undo_steps() {
+	for (u64 i = 0; i < m_undoSteps.size(); i++) {
+		m_undoPool->destroy_array(m_undoSteps[i], m_undoPixels);
+	}
+	m_undoSteps.clear();
+	m_undoStep = 0;
+}
+
 void ImageEditor::push_undo_step() {
 	logging::GetInstance()->info("Push undo step");
+
+	u64 pixels = (u64)m_Texture->width() * m_Texture->height();
+	if (m_undoPool == nullptr || m_Texture->width() != m_undoWidth || m_Texture->height() != m_undoHeight) {
+		if (m_undoPool != nullptr) {
+			clear_undo_steps();
+			delete m_undoPool;
+		}
+		m_undoWidth = m_Texture->width();
+		m_undoHeight = m_Texture->height();
+		m_undoPixels = pixels;
+		// a block per chunk, the history only takes the canvases it holds
+		m_undoPool = new util::Pool(pixels * sizeof(graphics::Color), alignof(graphics::Color), 1);
+	}
+
 	if (m_undoStep != m_undoSteps.size() - 1 && m_undoSteps.size() > 0) {
 		for (u32 i = m_undoSteps.size() - 1; i > m_undoStep; i--) {
-			delete[] m_undoSteps[i];
+			m_undoPool->destroy_array(m_undoSteps[i], m_undoPixels);
 			m_undoSteps.erase(m_undoSteps.begin() + i);
 		}
 		logging::GetInstance()->info("Erasing future");
 	}
 
 
-	graphics::Color* frame = new graphics::Color[m_Texture->width() * m_Texture->height()];
-	std::copy(m_Texture->data(), m_Texture->data() + (m_Texture->width() * m_Texture->height()), frame);
+	graphics::Color* frame = m_undoPool->make_array<graphics::Color>(pixels);
+	std::copy(m_Texture->data(), m_Texture->data() + pixels, frame);
 
 	m_undoSteps.push_back(frame);
 
@@ -216,7 +239,7 @@ void copy_buffer(graphics::Color* source, graphics::Color* dest, u64 size) {
 
 void ImageEditor::undo() {
 
-	logging::GetInstance()->info(std::string("Undo[") + std::to_string(m_undoStep - 1) + "/" + std::to_string(m_undoSteps.size()) + "]");
+	AMOR_LOG_INFO("", "Undo[%d/%zu]", m_undoStep - 1, m_undoSteps.size());
 
 	if (m_undoStep-1 > 0 || (m_undoSteps.size() == 1 && m_undoStep == 0)) {
 
@@ -231,7 +254,7 @@ void ImageEditor::undo() {
 	}
 }
 void ImageEditor::redo() {
-	logging::GetInstance()->info(std::string("Redo[") + std::to_string(m_undoStep) + "/" + std::to_string(m_undoSteps.size()) + "]");
+	AMOR_LOG_INFO("", "Redo[%d/%zu]", m_undoStep, m_undoSteps.size());
 
 
 	if (m_undoStep + 1 < m_undoSteps.size()) {
@@ -279,6 +302,9 @@ bool ImageEditor::OnUserInit() {
 
 	m_Tools[m_CurrentTool]->start(*this);
 
+	// an editor only has to redraw when there's input
+	set_idle_mode(true);
+
 	return true;
 }
 
@@ -122,6 +122,13 @@ private:
 
 	input::ActionsManager m_actions;
 
+	// every step is a copy of the canvas, they're all one size so they come from a pool made for
+	// m_undoPixels. The pool grows a canvas at a time and keeps what it grew to until a canvas of
+	// another width or height starts the history over
+	void clear_undo_steps();
+	util::Pool* m_undoPool = nullptr;
+	u64 m_undoPixels = 0;
+	u32 m_undoWidth = 0, m_undoHeight = 0;
 	std::vector<graphics::Color*> m_undoSteps;
 	i32 m_undoStep = 0;
 
@@ -0,0 +1,173 @@
+#include "Common.h"
+#include "Core.h"
+#include "Graphics.h"
+#include "JobSystem.h"
+#include "Pxim.h"
+#include "Util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+using namespace amor;
+using namespace amor::graphics;
+
+// something like a sprite sheet: flat backgrounds, gradients, outlined shapes and a little noise
+static void generate_sheet(std::vector<Color>& pixels, u32 width, u32 height) {
+	std::mt19937 rng(1234);
+	pixels.resize((u64)width * height);
+	for (u32 y = 0; y < height; ++y) {
+		for (u32 x = 0; x < width; ++x) {
+			u32 cellX = x / 64, cellY = y / 64;
+			u32 localX = x % 64, localY = y % 64;
+			Color& c = pixels[(u64)y * width + x];
+
+			if ((cellX + cellY) % 3 == 0) {
+				c = { 0, 0, 0, 0 };
+			}
+			else if ((cellX + cellY) % 3 == 1) {
+				c = { (byte)(localX * 4), (byte)(localY * 4), (byte)(cellX * 16), 255 };
+			}
+			else {
+				i32 dx = (i32)localX - 32, dy = (i32)localY - 32;
+				i32 distance = dx * dx + dy * dy;
+				if (distance < 20 * 20) {
+					c = { (byte)(200 + rng() % 8), 60, 40, 255 };
+				}
+				else if (distance < 22 * 22) {
+					c = { 20, 20, 20, 255 };
+				}
+				else {
+					c = { 0, 0, 0, 0 };
+				}
+			}
+		}
+	}
+}
+
+static const char* compression_name(pxim::Compression compression) {
+	switch (compression) {
+	case pxim::Compression::None: return "none";
+	case pxim::Compression::Fast: return "fast";
+	case pxim::Compression::Default: return "deflate";
+	case pxim::Compression::Best: return "deflate best";
+	}
+	return "?";
+}
+
+// encodes and decodes an image at every compression level, serial and on all threads, then maps it, and prints the throughput:
+// PximBench [image.pxim | width height] [rounds]. Without an image it makes a 4096x4096 sheet
+int main(int argc, char** argv) {
+	u32 width = 4096, height = 4096, rounds = 3;
+	std::vector<Color> pixels;
+
+	if (argc == 2 || argc == 3) {
+		pxim::Reader reader;
+		if (!reader.open(argv[1])) {
+			return 1;
+		}
+		width = reader.width();
+		height = reader.height();
+		pixels.resize((u64)width * height);
+		if (!reader.read(pixels.data())) {
+			return 1;
+		}
+		if (argc == 3) {
+			rounds = (u32)atoi(argv[2]);
+		}
+	}
+	else {
+		if (argc >= 3) {
+			width = (u32)atoi(argv[1]);
+			height = (u32)atoi(argv[2]);
+		}
+		if (argc >= 4) {
+			rounds = (u32)atoi(argv[3]);
+		}
+		generate_sheet(pixels, width, height);
+	}
+	rounds = math::max(rounds, 1u);
+
+	std::string path = (std::filesystem::temp_directory_path() / "pxim_bench.pxim").string();
+	double megabytes = (double)width * height * sizeof(Color) / (1024.0 * 1024.0);
+	std::vector<Color> decoded(pixels.size());
+
+	printf("%ux%u, %.1fMB, %u threads, best of %u\n", width, height, megabytes, util::JobSystem::Get().thread_count(), rounds);
+	printf("%-14s %-8s %12s %12s %8s\n", "compression", "threads", "encode MB/s", "decode MB/s", "ratio");
+
+	const pxim::Compression levels[] = { pxim::Compression::None, pxim::Compression::Fast, pxim::Compression::Default, pxim::Compression::Best };
+	for (pxim::Compression compression : levels) {
+		for (u32 threads : { 1u, 0u }) {
+			pxim::WriteOptions options;
+			options.compression = compression;
+			options.threads = threads;
+
+			double encodeSeconds = 1e30, decodeSeconds = 1e30;
+			bool ok = true;
+			for (u32 round = 0; round < rounds && ok; ++round) {
+				util::Timer timer;
+				timer.start();
+				ok = pxim::Write(path.c_str(), pixels.data(), width, height, options);
+				encodeSeconds = math::min(encodeSeconds, timer.elapsed_seconds());
+
+				pxim::Reader reader;
+				reader.set_threads(threads);
+				timer.start();
+				ok = ok && reader.open(path.c_str()) && reader.read(decoded.data());
+				decodeSeconds = math::min(decodeSeconds, timer.elapsed_seconds());
+			}
+
+			if (!ok || decoded != pixels) {
+				printf("%-14s %-8s failed\n", compression_name(compression), threads == 1 ? "1" : "all");
+				continue;
+			}
+
+			double ratio = (double)std::filesystem::file_size(path) / (megabytes * 1024.0 * 1024.0);
+			printf("%-14s %-8s %12.1f %12.1f %7.1f%%\n", compression_name(compression), threads == 1 ? "1" : "all",
+				megabytes / encodeSeconds, megabytes / decodeSeconds, ratio * 100.0);
+		}
+	}
+
+	// the mappable layout, loading maps the file and touches every page once so it's comparable to decoding
+	{
+		pxim::WriteOptions options;
+		options.mappable = true;
+
+		double encodeSeconds = 1e30, decodeSeconds = 1e30;
+		bool ok = true;
+		for (u32 round = 0; round < rounds && ok; ++round) {
+			util::Timer timer;
+			timer.start();
+			ok = pxim::Write(path.c_str(), pixels.data(), width, height, options);
+			encodeSeconds = math::min(encodeSeconds, timer.elapsed_seconds());
+
+			Texture texture;
+			timer.start();
+			texture.load(path.c_str());
+			volatile byte touched = 0;
+			const byte* bytes = (const byte*)texture.data();
+			for (u64 at = 0; bytes != nullptr && at < pixels.size() * sizeof(Color); at += pxim::MAP_ALIGNMENT) {
+				touched = bytes[at];
+			}
+			decodeSeconds = math::min(decodeSeconds, timer.elapsed_seconds());
+
+			ok = ok && bytes != nullptr && texture.width() == width && texture.height() == height &&
+				memcmp(bytes, pixels.data(), pixels.size() * sizeof(Color)) == 0;
+		}
+
+		if (!ok) {
+			printf("%-14s %-8s failed\n", "mapped", "1");
+		}
+		else {
+			double ratio = (double)std::filesystem::file_size(path) / (megabytes * 1024.0 * 1024.0);
+			printf("%-14s %-8s %12.1f %12.1f %7.1f%%\n", "mapped", "1", megabytes / encodeSeconds, megabytes / decodeSeconds, ratio * 100.0);
+		}
+	}
+
+	std::filesystem::remove(path);
+	logging::GetInstance()->flush();
+	return 0;
+}